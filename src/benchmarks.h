@@ -0,0 +1,1439 @@
+#pragma once
+
+#include <cmath>
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "scene/camera.h"
+#include "scene/scene.h"
+
+#include "object/bvh_node.h"
+#include "object/linear_bvh.h"
+#include "object/wide_bvh.h"
+#include "object/instance.h"
+#include "object/dynamic_bvh.h"
+#include "object/lazy_bvh.h"
+#include "object/compressed_bvh.h"
+#include "object/bvh_cache.h"
+#include "object/kd_tree.h"
+#include "object/grid.h"
+#include "object/static_bvh.h"
+#include "object/sphere.h"
+#include "object/triangle.h"
+#include "object/mesh.h"
+#include "object/sphere_group.h"
+#include "object/particle_cloud.h"
+
+#include "material/lambertian.h"
+#include "material/metal.h"
+#include "material/dielectric.h"
+
+#include "utils/timer.h"
+#include "utils/utils.h"
+
+class Benchmarks
+{
+    public:
+        static void run_all();
+
+        static void bench_bvh();
+        static void bench_linear_bvh();
+        static void bench_bvh_build_scaling();
+        static void bench_bvh_parallel_build();
+        static void bench_lbvh();
+        static void bench_sbvh();
+        static void bench_wide_bvh();
+        static void bench_instancing();
+        static void bench_refit();
+        static void bench_dynamic_bvh();
+        static void bench_lazy_bvh();
+        static void bench_node_layout();
+        static void bench_compressed_bvh();
+        static void bench_bvh_cache();
+        static void bench_kd_tree();
+        static void bench_grid();
+        static void bench_occlusion();
+        static void bench_deferred_attributes();
+        static void bench_material_table();
+        static void bench_static_dispatch();
+        static void bench_primitive_intersection();
+        static void bench_mesh();
+        static void bench_triangle_packets();
+        static void bench_sphere_groups();
+        static void bench_particle_cloud();
+
+    private:
+        // Same layout as random_scene, with (2 * half_extent)^2 small balls in a single flat scene
+        static Scene sphere_field(const Camera& camera, int half_extent);
+        static Camera default_camera();
+        // Latitude / longitude grid of (rings + 1) x (segments + 1) vertices on a unit sphere with bumps,
+        // quad (i, j) has the corners v, v + segments + 1, v + segments + 2 and v + 1, v = i * (segments + 1) + j
+        static std::vector<Point3D> bumpy_sphere(int rings, int segments, std::vector<Vector3>* normals = nullptr);
+
+        // One primary ray per pixel, deterministic for a given image size
+        static std::vector<Ray> camera_rays(const Camera& camera, int width, int height);
+
+        // Returns the number of closest-hit queries per second
+        static double trace(const Hittable& accelerator, const std::vector<Ray>& rays, std::size_t& hits);
+
+        static void print_header(const std::string& title);
+        static void print_row(const std::string& name, double build_time, double rays_per_second, const std::string& details);
+};
+
+Camera Benchmarks::default_camera() {
+    return Camera(Point3D(13, 2, 3), Point3D(0, 0, 0), Vector3(0, 1, 0), 20.0, 16.0 / 9.0, 10.0);
+}
+
+Scene Benchmarks::sphere_field(const Camera& camera, int half_extent) {
+    srand(42);
+
+    auto scene = Scene(camera);
+
+    auto ground_material = scene.add_material(std::make_shared<Lambertian>(Color(0.5, 0.5, 0.6)));
+    scene.add_object(std::make_shared<Sphere>(Point3D(0, -1000, 0), 1000, ground_material));
+
+    auto diffuse = scene.add_material(std::make_shared<Lambertian>(Color(0.4, 0.2, 0.1)));
+    auto metal = scene.add_material(std::make_shared<Metal>(Color(0.7, 0.6, 0.5), 0.1));
+    auto glass = scene.add_material(std::make_shared<Dielectric>(1.5));
+
+    for (int x = -half_extent; x < half_extent; ++x) {
+        for (int y = -half_extent; y < half_extent; ++y) {
+            auto random_mat = random_double();
+            auto center = Point3D(x + 0.9 * random_double(), 0.2, y + 0.9 * random_double());
+            auto material = random_mat < 0.8 ? diffuse : (random_mat < 0.95 ? metal : glass);
+
+            scene.add_object(std::make_shared<Sphere>(center, 0.2, material));
+        }
+    }
+
+    scene.add_object(std::make_shared<Sphere>(Point3D(-4, 1, 0), 1.0, diffuse));
+    scene.add_object(std::make_shared<Sphere>(Point3D(0, 1, 0), 1.0, glass));
+    scene.add_object(std::make_shared<Sphere>(Point3D(4, 1, 0), 1.0, metal));
+
+    return scene;
+}
+
+std::vector<Point3D> Benchmarks::bumpy_sphere(int rings, int segments, std::vector<Vector3>* normals) {
+    std::vector<Point3D> vertices;
+
+    for (int i = 0; i <= rings; ++i) {
+        for (int j = 0; j <= segments; ++j) {
+            auto theta = pi * i / rings;
+            auto phi = 2 * pi * j / segments;
+            auto normal = Vector3(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi));
+            auto radius = 1 + 0.02 * std::sin(40 * theta) * std::sin(40 * phi);
+
+            vertices.push_back(radius * normal);
+
+            if (normals)
+                normals->push_back(normal);
+        }
+    }
+
+    return vertices;
+}
+
+std::vector<Ray> Benchmarks::camera_rays(const Camera& camera, int width, int height) {
+    std::vector<Ray> rays;
+    rays.reserve(width * height);
+
+    for (int i = 0; i < height; ++i) {
+        for (int j = 0; j < width; ++j) {
+            auto u = (j + 0.5) / width;
+            auto v = (i + 0.5) / height;
+            rays.push_back(camera.ray(u, v));
+        }
+    }
+
+    return rays;
+}
+
+double Benchmarks::trace(const Hittable& accelerator, const std::vector<Ray>& rays, std::size_t& hits) {
+    hits = 0;
+
+    auto timer = Timer();
+
+    for (const auto& ray : rays) {
+        hit_record record;
+
+        if (accelerator.hit(ray, 0.001, infinity, record))
+            hits++;
+    }
+
+    return rays.size() / timer.elapsed();
+}
+
+void Benchmarks::print_header(const std::string& title) {
+    print_info(title.c_str());
+    std::cout << std::left << std::setw(22) << "  accelerator"
+              << std::right << std::setw(12) << "build (ms)"
+              << std::setw(14) << "Mrays/s"
+              << "  details\n";
+}
+
+void Benchmarks::print_row(const std::string& name, double build_time, double rays_per_second, const std::string& details) {
+    std::cout << std::left << std::setw(22) << ("  " + name)
+              << std::right << std::fixed << std::setprecision(2)
+              << std::setw(12) << build_time * 1000
+              << std::setw(14) << rays_per_second / 1e6
+              << "  " << details << "\n";
+}
+
+void Benchmarks::bench_bvh() {
+    auto camera = default_camera();
+    auto rays = camera_rays(camera, 320, 180);
+
+    for (int half_extent : { 4, 32, 100 }) {
+        auto scene = sphere_field(camera, half_extent);
+
+        print_header("BVH builders, " + std::to_string(scene.objects().size()) + " spheres");
+
+        auto median = BVHNode::median_options();
+        BVHBuildOptions sah;
+
+        for (const auto& [name, options] : { std::make_pair("median (random axis)", median), std::make_pair("binned SAH", sah) }) {
+            auto timer = Timer();
+            auto bvh = BVHNode(scene, options);
+            auto build_time = timer.elapsed();
+
+            std::size_t hits;
+            auto rays_per_second = trace(bvh, rays, hits);
+            auto stats = bvh.stats(options.traversal_cost, options.intersection_cost);
+
+            std::ostringstream details;
+            details << std::fixed << std::setprecision(2)
+                    << "SAH cost " << stats.sah_cost
+                    << ", " << stats.node_count << " nodes"
+                    << ", depth " << stats.max_depth
+                    << ", " << hits << " hits";
+
+            print_row(name, build_time, rays_per_second, details.str());
+        }
+    }
+}
+
+void Benchmarks::bench_linear_bvh() {
+    auto camera = default_camera();
+    auto rays = camera_rays(camera, 320, 180);
+
+    for (int half_extent : { 4, 32, 100 }) {
+        auto scene = sphere_field(camera, half_extent);
+
+        print_header("Pointer vs flattened BVH, " + std::to_string(scene.objects().size()) + " spheres");
+
+        std::size_t hits;
+
+        auto timer = Timer();
+        auto bvh = BVHNode(scene, BVHBuildOptions());
+        auto build_time = timer.elapsed();
+        auto rays_per_second = trace(bvh, rays, hits);
+        // make_shared puts each node next to its control block (two counters)
+        auto bvh_bytes = bvh.stats().node_count * (sizeof(BVHNode) + 2 * sizeof(long));
+
+        print_row("BVHNode", build_time, rays_per_second, std::to_string(bvh_bytes / 1024) + " KB of nodes");
+
+        timer.reset();
+        auto linear_bvh = LinearBVH(scene);
+        build_time = timer.elapsed();
+        rays_per_second = trace(linear_bvh, rays, hits);
+
+        print_row("LinearBVH", build_time, rays_per_second, std::to_string(linear_bvh.memory_usage() / 1024) + " KB of nodes and primitive references");
+    }
+}
+
+void Benchmarks::bench_bvh_build_scaling() {
+    auto camera = default_camera();
+
+    print_info("BVH build scaling (time / n log2 n should stay flat)");
+    std::cout << std::left << std::setw(22) << "  builder"
+              << std::right << std::setw(10) << "n"
+              << std::setw(12) << "build (ms)"
+              << std::setw(16) << "ns / n log2 n"
+              << std::setw(14) << "peak (KB)" << "\n";
+
+    for (int half_extent : { 16, 32, 64, 128 }) {
+        auto scene = sphere_field(camera, half_extent);
+        const auto& objects = scene.objects();
+        auto n = static_cast<double>(objects.size());
+
+        for (const auto& [name, options] : { std::make_pair("median", BVHNode::median_options()), std::make_pair("binned SAH", BVHBuildOptions()) }) {
+            auto builder = BVHBuilder(objects, options);
+            auto root = builder.build();
+            const auto& stats = builder.stats();
+
+            std::cout << std::left << std::setw(22) << (std::string("  ") + name)
+                      << std::right << std::fixed << std::setprecision(2)
+                      << std::setw(10) << objects.size()
+                      << std::setw(12) << stats.build_time * 1000
+                      << std::setw(16) << stats.build_time * 1e9 / (n * std::log2(n))
+                      << std::setw(14) << stats.peak_memory / 1024 << "\n";
+        }
+    }
+}
+
+void Benchmarks::bench_bvh_parallel_build() {
+    auto camera = default_camera();
+    auto scene = sphere_field(camera, 128);
+    const auto& objects = scene.objects();
+
+    print_info(("Parallel BVH build, " + std::to_string(objects.size()) + " spheres").c_str());
+    std::cout << std::left << std::setw(22) << "  builder"
+              << std::right << std::setw(10) << "threads"
+              << std::setw(12) << "build (ms)"
+              << std::setw(12) << "speedup" << "\n";
+
+    std::vector<std::size_t> thread_counts = { 1, 2, 4 };
+
+    if (ThreadPool::hardware_threads() > 4)
+        thread_counts.push_back(ThreadPool::hardware_threads());
+
+    for (const auto& [name, base_options] : { std::make_pair("median", BVHNode::median_options()), std::make_pair("binned SAH", BVHBuildOptions()) }) {
+        double serial_time = 0;
+
+        for (auto threads : thread_counts) {
+            auto options = base_options;
+            options.thread_count = threads;
+
+            auto builder = BVHBuilder(objects, options);
+            auto root = builder.build();
+            auto build_time = builder.stats().build_time;
+
+            if (threads == 1)
+                serial_time = build_time;
+
+            std::cout << std::left << std::setw(22) << (std::string("  ") + name)
+                      << std::right << std::fixed << std::setprecision(2)
+                      << std::setw(10) << threads
+                      << std::setw(12) << build_time * 1000
+                      << std::setw(11) << serial_time / build_time << "x\n";
+        }
+    }
+}
+
+void Benchmarks::bench_lbvh() {
+    auto camera = default_camera();
+    auto rays = camera_rays(camera, 320, 180);
+    auto scene = sphere_field(camera, 128);
+
+    print_header("LBVH vs recursive builders (LinearBVH), " + std::to_string(scene.objects().size()) + " spheres");
+
+    BVHBuildOptions sah;
+
+    BVHBuildOptions lbvh30;
+    lbvh30.split_method = BVHSplitMethod::LBVH;
+
+    auto lbvh63 = lbvh30;
+    lbvh63.morton_bits = 63;
+
+    auto lbvh_treelets = lbvh30;
+    lbvh_treelets.treelet_size = 7;
+
+    for (const auto& [name, options] : {
+        std::make_pair("binned SAH", sah),
+        std::make_pair("LBVH 30-bit", lbvh30),
+        std::make_pair("LBVH 63-bit", lbvh63),
+        std::make_pair("LBVH + treelets", lbvh_treelets)
+    }) {
+        auto timer = Timer();
+        auto bvh = LinearBVH(scene, options);
+        auto build_time = timer.elapsed();
+
+        std::size_t hits;
+        auto rays_per_second = trace(bvh, rays, hits);
+
+        std::ostringstream details;
+        details << std::fixed << std::setprecision(2) << "SAH cost " << bvh.stats().sah_cost;
+
+        print_row(name, build_time, rays_per_second, details.str());
+    }
+}
+
+void Benchmarks::bench_sbvh() {
+    srand(11);
+
+    auto camera = Camera(Point3D(0, 0, 30), Point3D(0, 0, 0), Vector3(0, 1, 0), 40.0, 16.0 / 9.0, 10.0);
+    auto rays = camera_rays(camera, 320, 180);
+    auto scene = Scene(camera);
+
+    // A cloud of small spheres crossed by large ones, which object splits cannot separate from it
+    auto material = scene.add_material(std::make_shared<Lambertian>(Color(0.3, 0.3, 0.6)));
+
+    for (int i = 0; i < 20000; ++i)
+        scene.add_object(std::make_shared<Sphere>(Vector3::random(-10, 10), random_double(0.05, 0.15), material));
+
+    for (int i = 0; i < 50; ++i)
+        scene.add_object(std::make_shared<Sphere>(Vector3::random(-10, 10), random_double(1, 4), material));
+
+    print_header("Spatial splits, " + std::to_string(scene.objects().size()) + " spheres");
+
+    BVHBuildOptions sah;
+
+    BVHBuildOptions sbvh;
+    sbvh.split_method = BVHSplitMethod::SBVH;
+
+    for (const auto& [name, options] : { std::make_pair("binned SAH", sah), std::make_pair("SBVH", sbvh) }) {
+        auto timer = Timer();
+        auto builder = BVHBuilder(scene.objects(), options);
+        builder.build();
+        auto build_time = timer.elapsed();
+
+        auto bvh = LinearBVH(scene, options);
+
+        std::size_t hits;
+        auto rays_per_second = trace(bvh, rays, hits);
+
+        std::ostringstream details;
+        details << std::fixed << std::setprecision(2) << "SAH cost " << bvh.stats().sah_cost
+                << ", " << builder.stats().duplicated_references << " duplicated references";
+
+        print_row(name, build_time, rays_per_second, details.str());
+    }
+}
+
+void Benchmarks::bench_wide_bvh() {
+    auto camera = default_camera();
+    auto rays = camera_rays(camera, 320, 180);
+
+    for (int half_extent : { 32, 128 }) {
+        auto scene = sphere_field(camera, half_extent);
+
+        print_header("Binary vs wide BVH, " + std::to_string(scene.objects().size()) + " spheres");
+
+        std::size_t hits;
+        auto timer = Timer();
+
+        auto bvh = BVHNode(scene, BVHBuildOptions());
+        auto build_time = timer.elapsed();
+        print_row("BVHNode", build_time, trace(bvh, rays, hits), "");
+
+        timer.reset();
+        auto linear_bvh = LinearBVH(scene);
+        build_time = timer.elapsed();
+        print_row("LinearBVH", build_time, trace(linear_bvh, rays, hits), std::to_string(linear_bvh.nodes().size()) + " nodes");
+
+        timer.reset();
+        auto bvh4 = BVH4(scene);
+        build_time = timer.elapsed();
+        print_row("BVH4", build_time, trace(bvh4, rays, hits), std::to_string(bvh4.node_count()) + " nodes, " + std::to_string(bvh4.memory_usage() / 1024) + " KB");
+
+        timer.reset();
+        auto bvh8 = BVH8(scene);
+        build_time = timer.elapsed();
+        print_row("BVH8", build_time, trace(bvh8, rays, hits), std::to_string(bvh8.node_count()) + " nodes, " + std::to_string(bvh8.memory_usage() / 1024) + " KB");
+    }
+}
+
+void Benchmarks::bench_instancing() {
+    srand(7);
+
+    auto camera = Camera(Point3D(0, 12, 40), Point3D(0, 0, 0), Vector3(0, 1, 0), 40.0, 16.0 / 9.0, 10.0);
+    auto rays = camera_rays(camera, 320, 180);
+    MaterialTable materials;
+    auto material = materials.add(std::make_shared<Lambertian>(Color(0.2, 0.5, 0.1)));
+
+    // One "tree" asset: a cone of small spheres
+    auto asset = Objects();
+    std::vector<std::pair<Point3D, double>> spheres;
+
+    for (int i = 0; i < 200; ++i) {
+        auto height = random_double(0, 3);
+        auto spread = 0.8 * (1 - height / 3);
+        spheres.push_back({ Point3D(random_double(-spread, spread), height, random_double(-spread, spread)), 0.15 });
+        asset.push_back(std::make_shared<Sphere>(spheres.back().first, spheres.back().second, material));
+    }
+
+    for (int side : { 10, 30 }) {
+        std::vector<Transform> transforms;
+
+        for (int x = 0; x < side; ++x) {
+            for (int z = 0; z < side; ++z) {
+                auto position = Vector3(2.0 * (x - side / 2) + random_double(-0.5, 0.5), 0, 2.0 * (z - side / 2) - random_double(0, 0.5));
+                transforms.push_back(Transform::translation(position)
+                    * Transform::rotation(Vector3(0, 1, 0), random_double(0, 360))
+                    * Transform::scaling(random_double(0.7, 1.3)));
+            }
+        }
+
+        print_header("Instancing, " + std::to_string(transforms.size()) + " instances of " + std::to_string(asset.size()) + " spheres");
+
+        std::size_t hits;
+        auto timer = Timer();
+
+        // Every copy baked into one flat BVH
+        auto flat = Objects();
+
+        for (const auto& transform : transforms) {
+            for (const auto& [center, radius] : spheres) {
+                auto scale = transform.vector(Vector3(1, 0, 0)).length();
+                flat.push_back(std::make_shared<Sphere>(transform.point(center), radius * scale, material));
+            }
+        }
+
+        auto flat_bvh = LinearBVH(flat);
+        auto build_time = timer.elapsed();
+        auto flat_memory = flat_bvh.memory_usage() + flat.size() * sizeof(Sphere);
+        print_row("flattened", build_time, trace(flat_bvh, rays, hits), std::to_string(flat_memory / 1024) + " KB");
+
+        // One shared bottom-level BVH under a top-level BVH of instances
+        timer.reset();
+
+        auto blas = std::make_shared<LinearBVH>(asset);
+        auto instances = Objects();
+
+        for (const auto& transform : transforms)
+            instances.push_back(std::make_shared<Instance>(blas, transform));
+
+        auto tlas = LinearBVH(instances);
+        build_time = timer.elapsed();
+        auto instanced_memory = tlas.memory_usage() + instances.size() * sizeof(Instance)
+            + blas->memory_usage() + asset.size() * sizeof(Sphere);
+        print_row("TLAS / BLAS", build_time, trace(tlas, rays, hits), std::to_string(instanced_memory / 1024) + " KB");
+    }
+}
+
+void Benchmarks::bench_refit() {
+    auto camera = default_camera();
+    auto rays = camera_rays(camera, 320, 180);
+    auto scene = sphere_field(camera, 128);
+
+    std::vector<std::shared_ptr<Sphere>> spheres;
+    std::vector<Vector3> velocities;
+
+    // The ground sphere stays still
+    for (std::size_t i = 1; i < scene.objects().size(); ++i) {
+        spheres.push_back(std::static_pointer_cast<Sphere>(scene.objects()[i]));
+        velocities.push_back(Vector3(random_double(-0.2, 0.2), 0, random_double(-0.2, 0.2)));
+    }
+
+    print_info(("BVH refit, " + std::to_string(scene.objects().size()) + " moving spheres").c_str());
+    std::cout << std::left << std::setw(10) << "  frame"
+              << std::right << std::setw(12) << "refit (ms)"
+              << std::setw(14) << "rebuild (ms)"
+              << std::setw(12) << "SAH ratio"
+              << std::setw(18) << "refit Mrays/s"
+              << std::setw(18) << "rebuilt Mrays/s" << "\n";
+
+    auto refitted = LinearBVH(scene);
+
+    for (int frame = 1; frame <= 8; ++frame) {
+        for (std::size_t i = 0; i < spheres.size(); ++i)
+            spheres[i]->set_center(spheres[i]->center() + velocities[i]);
+
+        auto timer = Timer();
+        refitted.refit();
+        auto refit_time = timer.elapsed();
+
+        timer.reset();
+        auto rebuilt = LinearBVH(scene);
+        auto rebuild_time = timer.elapsed();
+
+        std::size_t hits;
+
+        std::cout << std::left << std::setw(10) << ("  " + std::to_string(frame))
+                  << std::right << std::fixed << std::setprecision(2)
+                  << std::setw(12) << refit_time * 1000
+                  << std::setw(14) << rebuild_time * 1000
+                  << std::setw(12) << refitted.sah_ratio()
+                  << std::setw(18) << trace(refitted, rays, hits) / 1e6
+                  << std::setw(18) << trace(rebuilt, rays, hits) / 1e6 << "\n";
+    }
+}
+
+void Benchmarks::bench_dynamic_bvh() {
+    auto camera = default_camera();
+    auto rays = camera_rays(camera, 320, 180);
+
+    for (int half_extent : { 32, 128 }) {
+        auto scene = sphere_field(camera, half_extent);
+        const auto& objects = scene.objects();
+
+        print_header("Dynamic BVH, " + std::to_string(objects.size()) + " spheres");
+
+        std::size_t hits;
+        auto timer = Timer();
+
+        auto linear_bvh = LinearBVH(scene);
+        auto build_time = timer.elapsed();
+
+        std::ostringstream details;
+        details << std::fixed << std::setprecision(2) << "SAH cost " << linear_bvh.stats().sah_cost;
+        print_row("LinearBVH (rebuild)", build_time, trace(linear_bvh, rays, hits), details.str());
+
+        timer.reset();
+
+        auto bvh = DynamicBVH();
+        std::vector<DynamicBVH::Handle> handles;
+
+        for (const auto& object : objects)
+            handles.push_back(bvh.insert(object));
+
+        build_time = timer.elapsed();
+
+        details.str("");
+        details << "SAH cost " << bvh.stats().sah_cost;
+        print_row("DynamicBVH (inserts)", build_time, trace(bvh, rays, hits), details.str());
+
+        // Small edits: a thousand objects taken out and put back one by one
+        bvh.reset_edit_stats();
+
+        for (int i = 0; i < 1000; ++i) {
+            auto index = static_cast<std::size_t>(random_int(1, static_cast<int>(objects.size()) - 1));
+            bvh.remove(handles[index]);
+            handles[index] = bvh.insert(objects[index]);
+        }
+
+        const auto& edits = bvh.edit_stats();
+        auto average_insert = edits.total_insert_time / edits.insert_count;
+        auto average_remove = edits.total_remove_time / edits.remove_count;
+
+        details.str("");
+        details << "insert " << average_insert * 1e6 << " us (max " << edits.max_insert_time * 1e6 << ")"
+                << ", remove " << average_remove * 1e6 << " us (max " << edits.max_remove_time * 1e6 << ")";
+        print_row("DynamicBVH (edits)", average_insert + average_remove, trace(bvh, rays, hits), details.str());
+    }
+}
+
+void Benchmarks::bench_lazy_bvh() {
+    auto camera = default_camera();
+    auto rays = camera_rays(camera, 320, 180);
+    auto scene = sphere_field(camera, 256);
+
+    print_info(("Lazy vs eager BVH, " + std::to_string(scene.objects().size()) + " spheres").c_str());
+    std::cout << std::left << std::setw(22) << "  accelerator"
+              << std::right << std::setw(14) << "startup (ms)"
+              << std::setw(18) << "first pixel (ms)"
+              << std::setw(14) << "frame (ms)"
+              << std::setw(16) << "memory (KB)"
+              << "  details\n";
+
+    auto print_line = [](const std::string& name, double startup, double first_pixel, double frame, std::size_t memory, const std::string& details) {
+        std::cout << std::left << std::setw(22) << ("  " + name)
+                  << std::right << std::fixed << std::setprecision(2)
+                  << std::setw(14) << startup * 1000
+                  << std::setw(18) << first_pixel * 1000
+                  << std::setw(14) << frame * 1000
+                  << std::setw(16) << memory / 1024
+                  << "  " << details << "\n";
+    };
+
+    std::size_t hits;
+    hit_record record;
+
+    // Time to first pixel: startup, then the first primary ray
+    auto timer = Timer();
+    auto eager = LinearBVH(scene);
+    auto startup = timer.elapsed();
+    eager.hit(rays[rays.size() / 2], 0.001, infinity, record);
+    auto first_pixel = timer.elapsed();
+    auto frame = rays.size() / trace(eager, rays, hits);
+    print_line("LinearBVH (eager)", startup, first_pixel, frame, eager.memory_usage(), "");
+
+    for (std::size_t subtree_size : { 1024, 4096, 16384 }) {
+        BVHBuildOptions options;
+        options.lazy_subtree_size = subtree_size;
+
+        timer.reset();
+        auto lazy = LazyBVH(scene, options);
+        startup = timer.elapsed();
+        lazy.hit(rays[rays.size() / 2], 0.001, infinity, record);
+        first_pixel = timer.elapsed();
+        frame = rays.size() / trace(lazy, rays, hits);
+
+        auto details = std::to_string(lazy.built_subtree_count()) + " / " + std::to_string(lazy.subtree_count()) + " subtrees built";
+        print_line("LazyBVH " + std::to_string(subtree_size), startup, first_pixel, frame, lazy.resident_memory(), details);
+    }
+}
+
+void Benchmarks::bench_node_layout() {
+    auto camera = default_camera();
+    auto scene = sphere_field(camera, 256);
+    auto camera_ray_set = camera_rays(camera, 640, 360);
+
+    // Secondary-like rays: random origins above the field, random directions
+    srand(7);
+    std::vector<Ray> random_rays;
+
+    for (std::size_t i = 0; i < camera_ray_set.size(); ++i) {
+        auto origin = Point3D(random_double(-256, 256), random_double(0, 2), random_double(-256, 256));
+        random_rays.push_back(Ray(origin, Vector3::random_in_unit_sphere().unit_vector()));
+    }
+
+    print_header("LinearBVH node layouts, " + std::to_string(scene.objects().size()) + " spheres");
+
+    std::pair<const char*, BVHNodeLayout> layouts[] = {
+        { "depth-first", BVHNodeLayout::DepthFirst },
+        { "treelet", BVHNodeLayout::Treelet },
+        { "van Emde Boas", BVHNodeLayout::VanEmdeBoas }
+    };
+
+    std::size_t hits;
+
+    for (const auto& [name, layout] : layouts) {
+        BVHBuildOptions options;
+        options.node_layout = layout;
+
+        auto timer = Timer();
+        auto bvh = LinearBVH(scene, options);
+        auto build_time = timer.elapsed();
+
+        std::ostringstream details;
+        details << "camera rays " << std::fixed << std::setprecision(2) << trace(bvh, camera_ray_set, hits) / 1e6 << " Mrays/s";
+        print_row(name, build_time, trace(bvh, random_rays, hits), details.str() + " (column: random rays)");
+    }
+}
+
+void Benchmarks::bench_compressed_bvh() {
+    auto camera = default_camera();
+    auto rays = camera_rays(camera, 640, 360);
+    auto scene = sphere_field(camera, 256);
+    auto primitive_count = static_cast<double>(scene.objects().size());
+
+    print_header("Compressed BVH nodes, " + std::to_string(scene.objects().size()) + " spheres");
+
+    std::size_t hits;
+
+    // Node bytes per primitive, then with the primitive references every format holds
+    auto print_memory = [&](const std::string& name, double build_time, double rays_per_second, std::size_t node_bytes, std::size_t total_bytes) {
+        std::ostringstream details;
+        details << std::fixed << std::setprecision(1) << node_bytes / primitive_count << " node B/prim, "
+                << total_bytes / primitive_count << " B/prim";
+        print_row(name, build_time, rays_per_second, details.str());
+    };
+
+    auto timer = Timer();
+    auto linear_bvh = LinearBVH(scene);
+    auto build_time = timer.elapsed();
+    auto node_bytes = linear_bvh.nodes().size() * sizeof(LinearBVHNode);
+    print_memory("LinearBVH (float)", build_time, trace(linear_bvh, rays, hits), node_bytes, linear_bvh.memory_usage());
+
+    timer.reset();
+    auto bvh16 = CompressedBVH16(scene);
+    build_time = timer.elapsed();
+    node_bytes = bvh16.node_count() * sizeof(CompressedBVH16::Node);
+    print_memory("CompressedBVH16", build_time, trace(bvh16, rays, hits), node_bytes, bvh16.memory_usage());
+
+    timer.reset();
+    auto bvh8 = CompressedBVH8(scene);
+    build_time = timer.elapsed();
+    node_bytes = bvh8.node_count() * sizeof(CompressedBVH8::Node);
+    print_memory("CompressedBVH8", build_time, trace(bvh8, rays, hits), node_bytes, bvh8.memory_usage());
+}
+
+void Benchmarks::bench_bvh_cache() {
+    auto camera = default_camera();
+    auto rays = camera_rays(camera, 320, 180);
+    auto scene = sphere_field(camera, 256);
+
+    print_header("BVH disk cache, " + std::to_string(scene.objects().size()) + " spheres");
+
+    auto cache = BVHCache("/tmp/raytracer_bvh_cache_bench");
+    auto file_path = cache.path(BVHCache::key(scene.objects(), BVHBuildOptions()));
+    std::remove(file_path.c_str());
+
+    std::size_t hits;
+
+    // The build column is the time to a usable tree: build and store, or map and check
+    auto timer = Timer();
+    auto built = cache.load_or_build(scene.objects());
+    auto build_time = timer.elapsed();
+    print_row("miss (build + save)", build_time, trace(*built, rays, hits), std::to_string(built->memory_usage() / 1024) + " KB");
+
+    timer.reset();
+    BVHCache::key(scene.objects(), BVHBuildOptions());
+    auto key_time = timer.elapsed();
+
+    timer.reset();
+    auto loaded = cache.load_or_build(scene.objects());
+    build_time = timer.elapsed();
+
+    std::ostringstream details;
+    details << (cache.load_count() == 1 ? "loaded" : "rebuilt") << ", hashing the scene took "
+            << std::fixed << std::setprecision(2) << key_time * 1000 << " ms";
+    print_row("hit (map + check)", build_time, trace(*loaded, rays, hits), details.str());
+}
+
+void Benchmarks::bench_kd_tree() {
+    auto camera = default_camera();
+    auto rays = camera_rays(camera, 640, 360);
+    auto scene = sphere_field(camera, 128);
+
+    print_header("Kd-tree vs BVH, " + std::to_string(scene.objects().size()) + " spheres");
+
+    std::size_t hits;
+
+    // Memory in KB, then the SAH cost from each structure's own cost constants
+    auto details = [](std::size_t memory, double sah_cost, const std::string& extra) {
+        std::ostringstream stream;
+        stream << memory / 1024 << " KB, SAH cost " << std::fixed << std::setprecision(2) << sah_cost << extra;
+        return stream.str();
+    };
+
+    auto timer = Timer();
+    auto bvh_node = BVHNode(scene, BVHBuildOptions());
+    auto build_time = timer.elapsed();
+    auto bvh_stats = bvh_node.stats();
+    // Every node is a shared_ptr allocation with its control block
+    auto bvh_memory = bvh_stats.node_count * (sizeof(BVHNode) + 16);
+    print_row("BVHNode (SAH)", build_time, trace(bvh_node, rays, hits), details(bvh_memory, bvh_stats.sah_cost, ", ~ nodes only"));
+
+    timer.reset();
+    auto linear_bvh = LinearBVH(scene);
+    build_time = timer.elapsed();
+    print_row("LinearBVH (SAH)", build_time, trace(linear_bvh, rays, hits), details(linear_bvh.memory_usage(), linear_bvh.stats().sah_cost, ""));
+
+    for (bool clip : { false, true }) {
+        KdTreeBuildOptions options;
+        options.clip_primitives = clip;
+
+        auto kd_tree = KdTree(scene, options);
+        const auto& stats = kd_tree.stats();
+
+        std::ostringstream extra;
+        extra << ", " << std::fixed << std::setprecision(2) << stats.reference_count / static_cast<double>(scene.objects().size()) << " refs/prim, depth " << stats.max_depth;
+        print_row(clip ? "KdTree (clipped)" : "KdTree", stats.build_time, trace(kd_tree, rays, hits), details(kd_tree.memory_usage(), stats.sah_cost, extra.str()));
+    }
+}
+
+void Benchmarks::bench_grid() {
+    auto camera = default_camera();
+    auto rays = camera_rays(camera, 640, 360);
+    auto scene = sphere_field(camera, 256);
+
+    print_header("Grid vs BVH, " + std::to_string(scene.objects().size()) + " spheres");
+
+    std::size_t hits;
+
+    auto timer = Timer();
+    auto bvh_node = BVHNode(scene, BVHBuildOptions());
+    auto build_time = timer.elapsed();
+    // Every node is a shared_ptr allocation with its control block
+    auto bvh_memory = bvh_node.stats().node_count * (sizeof(BVHNode) + 16);
+    print_row("BVHNode (SAH)", build_time, trace(bvh_node, rays, hits), std::to_string(bvh_memory / 1024) + " KB, ~ nodes only");
+
+    for (bool two_level : { false, true }) {
+        GridBuildOptions options;
+        options.two_level = two_level;
+
+        auto grid = Grid(scene, options);
+        const auto& stats = grid.stats();
+
+        std::ostringstream details;
+        details << grid.memory_usage() / 1024 << " KB, " << stats.resolution[0] << "x" << stats.resolution[1] << "x" << stats.resolution[2]
+                << ", " << std::fixed << std::setprecision(2) << stats.reference_count / static_cast<double>(scene.objects().size()) << " refs/prim";
+
+        if (two_level)
+            details << ", " << stats.subgrid_count << " subgrids";
+
+        print_row(two_level ? "Grid (two-level)" : "Grid", stats.build_time, trace(grid, rays, hits), details.str());
+    }
+}
+
+void Benchmarks::bench_occlusion() {
+    auto camera = default_camera();
+    auto scene = sphere_field(camera, 128);
+    auto bvh_node = BVHNode(scene, BVHBuildOptions());
+    auto linear_bvh = LinearBVH(scene);
+
+    // Shadow rays from the visible points towards a distant light
+    auto light_direction = Vector3(0.5, 1, 0.3).unit_vector();
+    std::vector<Ray> shadow_rays;
+
+    for (const auto& ray : camera_rays(camera, 640, 360)) {
+        hit_record record;
+
+        if (linear_bvh.hit(ray, 0.001, infinity, record))
+            shadow_rays.push_back(Ray(record.point, light_direction));
+    }
+
+    print_header("Occlusion vs closest hit, " + std::to_string(shadow_rays.size()) + " shadow rays");
+
+    auto occluded = [&](const Hittable& accelerator, std::size_t& hits) {
+        hits = 0;
+
+        auto timer = Timer();
+
+        for (const auto& ray : shadow_rays)
+            hits += accelerator.occluded(ray, 0.001, infinity);
+
+        return shadow_rays.size() / timer.elapsed();
+    };
+
+    std::size_t hits;
+
+    for (int linear = 0; linear < 2; ++linear) {
+        const Hittable& accelerator = linear ? static_cast<const Hittable&>(linear_bvh) : bvh_node;
+        std::string name = linear ? "LinearBVH" : "BVHNode";
+
+        auto rays_per_second = trace(accelerator, shadow_rays, hits);
+        print_row(name + " hit", 0, rays_per_second, std::to_string(hits) + " in shadow");
+
+        rays_per_second = occluded(accelerator, hits);
+        print_row(name + " occluded", 0, rays_per_second, std::to_string(hits) + " in shadow");
+    }
+}
+
+void Benchmarks::bench_deferred_attributes() {
+    auto camera = default_camera();
+    auto rays = camera_rays(camera, 640, 360);
+    // The size of the rendered scene, where every ray tests every sphere without an accelerator
+    auto scene = sphere_field(camera, 11);
+
+    print_header("Deferred hit attributes, " + std::to_string(scene.objects().size()) + " spheres");
+
+    // What Scene::hit used to do: full attributes for every candidate, copied when closer
+    auto eager = [&](std::size_t& hits) {
+        hits = 0;
+
+        auto timer = Timer();
+
+        for (const auto& ray : rays) {
+            hit_record record, tmp;
+            auto closest = infinity;
+            bool has_hit = false;
+
+            for (const auto& object : scene.objects()) {
+                if (object->hit(ray, 0.001, closest, tmp)) {
+                    has_hit = true;
+                    closest = tmp.t;
+                    record = tmp;
+                }
+            }
+
+            hits += has_hit;
+        }
+
+        return rays.size() / timer.elapsed();
+    };
+
+    std::size_t hits;
+
+    auto rays_per_second = eager(hits);
+    print_row("Scene (eager)", 0, rays_per_second, std::to_string(hits) + " hits");
+
+    rays_per_second = trace(scene, rays, hits);
+    print_row("Scene (deferred)", 0, rays_per_second, std::to_string(hits) + " hits");
+}
+
+void Benchmarks::bench_material_table() {
+    auto camera = default_camera();
+    auto rays = camera_rays(camera, 640, 360);
+    auto scene = sphere_field(camera, 11);
+    const auto& materials = scene.materials();
+
+    print_info(("Material ids vs shared_ptr, " + std::to_string(scene.objects().size()) + " spheres, hit + scatter").c_str());
+    std::cout << std::left << std::setw(22) << "  materials"
+              << std::right << std::setw(10) << "threads"
+              << std::setw(14) << "Mrays/s"
+              << std::setw(12) << "speedup" << "\n";
+
+    // The same materials behind reference-counted handles, as hit records used to hold them. The
+    // table keeps ownership, the handles only share a control block.
+    std::vector<std::shared_ptr<const Material>> handles;
+
+    for (MaterialId id = 0; id < materials.size(); ++id)
+        handles.push_back(std::shared_ptr<const Material>(&materials[id], [](const Material*) {}));
+
+    // Previous Scene::hit: a handle copied for every candidate hit, then with the record
+    auto shade_shared = [&](const Ray& ray) {
+        hit_record record, tmp;
+        std::shared_ptr<const Material> material, tmp_material;
+        auto closest = infinity;
+
+        for (const auto& object : scene.objects()) {
+            if (object->hit(ray, 0.001, closest, tmp)) {
+                tmp_material = handles[tmp.material];
+                closest = tmp.t;
+                record = tmp;
+                material = tmp_material;
+            }
+        }
+
+        Color attenuation;
+        Ray scattered;
+
+        return material && material->scatter(ray, record, attenuation, scattered);
+    };
+
+    auto shade_ids = [&](const Ray& ray) {
+        hit_record record;
+        Color attenuation;
+        Ray scattered;
+
+        return scene.hit(ray, 0.001, infinity, record) && materials[record.material].scatter(ray, record, attenuation, scattered);
+    };
+
+    std::vector<std::size_t> thread_counts = { 1 };
+
+    if (ThreadPool::hardware_threads() > 1)
+        thread_counts.push_back(ThreadPool::hardware_threads());
+
+    auto run = [&](const std::string& name, const auto& shade) {
+        double serial_rate = 0;
+
+        for (auto threads : thread_counts) {
+            auto pool = ThreadPool(threads);
+            std::atomic<std::size_t> scattered_count = 0;
+
+            auto timer = Timer();
+
+            pool.parallel_for(0, rays.size(), 1024, [&](std::size_t start, std::size_t end) {
+                std::size_t count = 0;
+
+                for (auto i = start; i < end; ++i)
+                    count += shade(rays[i]);
+
+                scattered_count += count;
+            });
+
+            auto rate = rays.size() / timer.elapsed();
+
+            if (threads == 1)
+                serial_rate = rate;
+
+            std::cout << std::left << std::setw(22) << ("  " + name)
+                      << std::right << std::fixed << std::setprecision(2)
+                      << std::setw(10) << threads
+                      << std::setw(14) << rate / 1e6
+                      << std::setw(11) << rate / serial_rate << "x\n";
+        }
+    };
+
+    run("shared_ptr", shade_shared);
+    run("MaterialId", shade_ids);
+}
+
+void Benchmarks::bench_static_dispatch() {
+    auto camera = default_camera();
+    auto rays = camera_rays(camera, 640, 360);
+    auto scene = sphere_field(camera, 128);
+
+    print_header("Variant vs virtual dispatch, " + std::to_string(scene.objects().size()) + " spheres");
+
+    std::size_t hits;
+
+    auto timer = Timer();
+    auto linear_bvh = LinearBVH(scene);
+    auto build_time = timer.elapsed();
+    print_row("LinearBVH (virtual)", build_time, trace(linear_bvh, rays, hits), std::to_string(linear_bvh.memory_usage() / 1024) + " KB");
+
+    timer.reset();
+    auto static_bvh = StaticBVH(scene);
+    build_time = timer.elapsed();
+    print_row("StaticBVH (variant)", build_time, trace(static_bvh, rays, hits), std::to_string(static_bvh.memory_usage() / 1024) + " KB");
+
+    // Shading of the visible points, with the same random numbers for both dispatches
+    std::vector<std::pair<Ray, hit_record>> shading_points;
+
+    for (const auto& ray : rays) {
+        hit_record record;
+
+        if (static_bvh.hit(ray, 0.001, infinity, record))
+            shading_points.push_back({ ray, record });
+    }
+
+    const auto& materials = scene.materials();
+
+    for (bool variant : { false, true }) {
+        srand(5);
+
+        Color attenuation;
+        Ray scattered;
+        std::size_t scatter_count = 0;
+
+        timer.reset();
+
+        for (const auto& [ray, record] : shading_points) {
+            if (variant)
+                scatter_count += materials.scatter(record.material, ray, record, attenuation, scattered);
+            else
+                scatter_count += materials[record.material].scatter(ray, record, attenuation, scattered);
+        }
+
+        auto rate = shading_points.size() / timer.elapsed();
+        print_row(variant ? "scatter (variant)" : "scatter (virtual)", 0, rate, std::to_string(scatter_count) + " scattered");
+    }
+}
+
+void Benchmarks::bench_primitive_intersection() {
+    srand(3);
+
+    // Rays from around the origin towards a shell of primitives of about the same size
+    const int primitive_count = 4096;
+    std::vector<Ray> rays;
+
+    for (int i = 0; i < 256; ++i)
+        rays.push_back(Ray(Vector3::random(-1, 1), Vector3::random_in_unit_sphere().unit_vector()));
+
+    Objects spheres, moller_trumbore, watertight;
+
+    for (int i = 0; i < primitive_count; ++i) {
+        auto center = Vector3::random_in_unit_sphere().unit_vector() * 4;
+        auto a = center + Vector3::random(-0.6, 0.6);
+        auto b = center + Vector3::random(-0.6, 0.6);
+        auto c = center + Vector3::random(-0.6, 0.6);
+
+        spheres.push_back(std::make_shared<Sphere>(center, 0.3, 0));
+        moller_trumbore.push_back(std::make_shared<Triangle>(a, b, c, 0, TriangleTest::MollerTrumbore));
+        watertight.push_back(std::make_shared<Triangle>(a, b, c, 0, TriangleTest::Watertight));
+    }
+
+    print_info(("Ray / primitive intersection, " + std::to_string(rays.size()) + " rays x " + std::to_string(primitive_count) + " primitives").c_str());
+    std::cout << std::left << std::setw(22) << "  primitive"
+              << std::right << std::setw(14) << "Mtests/s"
+              << std::setw(12) << "hits" << "\n";
+
+    for (const auto& [name, primitives] : { std::make_pair("Sphere", &spheres), std::make_pair("Triangle", &moller_trumbore), std::make_pair("Triangle, watertight", &watertight) }) {
+        std::size_t hits = 0;
+        hit_record record;
+
+        auto timer = Timer();
+
+        for (const auto& ray : rays) {
+            for (const auto& primitive : *primitives)
+                hits += primitive->intersect(ray, 0.001, infinity, record);
+        }
+
+        auto tests_per_second = rays.size() * primitives->size() / timer.elapsed();
+
+        std::cout << std::left << std::setw(22) << (std::string("  ") + name)
+                  << std::right << std::fixed << std::setprecision(2)
+                  << std::setw(14) << tests_per_second / 1e6
+                  << std::setw(12) << hits << "\n";
+    }
+}
+
+void Benchmarks::bench_mesh() {
+    // A bumpy sphere of about a million triangles, written as an OBJ of quads with positions,
+    // normals and texture coordinates, so that loading goes through the triangulation and the
+    // vertex deduplication
+    const int rings = 500;
+    const int segments = 1000;
+    const std::string path = "/tmp/raytracer_bench_mesh.obj";
+
+    auto camera = Camera(Point3D(0, 0, 3.5), Point3D(0, 0, 0), Vector3(0, 1, 0), 40.0, 16.0 / 9.0, 10.0);
+    auto rays = camera_rays(camera, 320, 180);
+
+    std::vector<Vector3> normals;
+    auto vertices = bumpy_sphere(rings, segments, &normals);
+
+    {
+        auto file = std::fopen(path.c_str(), "w");
+
+        if (!file) {
+            std::cerr << "Cannot write " << path << ".\n";
+            return;
+        }
+
+        for (std::size_t k = 0; k < vertices.size(); ++k) {
+            const auto& vertex = vertices[k];
+            const auto& normal = normals[k];
+            auto i = static_cast<int>(k) / (segments + 1);
+            auto j = static_cast<int>(k) % (segments + 1);
+
+            std::fprintf(file, "v %.7f %.7f %.7f\nvn %.5f %.5f %.5f\nvt %.6f %.6f\n",
+                         vertex.x(), vertex.y(), vertex.z(), normal.x(), normal.y(), normal.z(), j / double(segments), i / double(rings));
+        }
+
+        for (int i = 0; i < rings; ++i) {
+            for (int j = 0; j < segments; ++j) {
+                // 1-based
+                int v = i * (segments + 1) + j + 1;
+                int u = v + segments + 1;
+
+                std::fprintf(file, "f %d/%d/%d %d/%d/%d %d/%d/%d %d/%d/%d\n", v, v, v, u, u, u, u + 1, u + 1, u + 1, v + 1, v + 1, v + 1);
+            }
+        }
+
+        std::fclose(file);
+    }
+
+    auto mesh = Mesh::load_obj(path, 0);
+    std::remove(path.c_str());
+
+    if (!mesh)
+        return;
+
+    const auto& stats = mesh->stats();
+    auto triangle_count = static_cast<double>(stats.triangle_count);
+
+    print_header("Indexed mesh, " + std::to_string(stats.triangle_count) + " triangles, " + std::to_string(stats.vertex_count) + " vertices");
+
+    std::size_t hits = 0;
+    auto mesh_rate = trace(*mesh, rays, hits);
+    print_row("Mesh", stats.build_time, mesh_rate,
+              std::to_string(static_cast<int>(mesh->memory_usage() / triangle_count)) + " B/triangle, load " + std::to_string(static_cast<int>(stats.load_time * 1000)) + " ms, "
+              + std::to_string(hits) + " hits");
+
+    // The same triangles as separate objects, as Triangle sees them after the same triangulation
+    Objects triangles;
+    triangles.reserve(stats.triangle_count);
+
+    for (int i = 0; i < rings; ++i) {
+        for (int j = 0; j < segments; ++j) {
+            int v = i * (segments + 1) + j;
+            int u = v + segments + 1;
+
+            triangles.push_back(std::make_shared<Triangle>(vertices[v], vertices[u], vertices[u + 1], 0));
+            triangles.push_back(std::make_shared<Triangle>(vertices[v], vertices[u + 1], vertices[v + 1], 0));
+        }
+    }
+
+    auto timer = Timer();
+    auto bvh = LinearBVH(triangles);
+    auto build_time = timer.elapsed();
+
+    // Each object also pays the control block that make_shared allocates with it
+    auto memory = bvh.memory_usage() + triangles.size() * (sizeof(Triangle) + 16);
+    auto objects_rate = trace(bvh, rays, hits);
+    print_row("Triangle objects", build_time, objects_rate,
+              std::to_string(static_cast<int>(memory / triangle_count)) + " B/triangle, " + std::to_string(hits) + " hits");
+}
+
+void Benchmarks::bench_triangle_packets() {
+    const int rings = 250;
+    const int segments = 500;
+
+    auto camera = Camera(Point3D(0, 0, 3.5), Point3D(0, 0, 0), Vector3(0, 1, 0), 40.0, 16.0 / 9.0, 10.0);
+    auto rays = camera_rays(camera, 320, 180);
+    auto vertices = bumpy_sphere(rings, segments);
+
+    std::vector<float> positions;
+    std::vector<uint32_t> indices;
+    Objects triangles;
+
+    for (const auto& vertex : vertices) {
+        for (int a = 0; a < 3; ++a)
+            positions.push_back(static_cast<float>(vertex[a]));
+    }
+
+    for (int i = 0; i < rings; ++i) {
+        for (int j = 0; j < segments; ++j) {
+            uint32_t v = i * (segments + 1) + j;
+            uint32_t u = v + segments + 1;
+
+            for (auto index : { v, u, u + 1, v, u + 1, v + 1 })
+                indices.push_back(index);
+
+            triangles.push_back(std::make_shared<Triangle>(vertices[v], vertices[u], vertices[u + 1], 0));
+            triangles.push_back(std::make_shared<Triangle>(vertices[v], vertices[u + 1], vertices[v + 1], 0));
+        }
+    }
+
+    print_header("Packed triangle leaves, " + std::to_string(triangles.size()) + " triangles");
+
+    std::size_t hits = 0;
+
+    for (std::size_t leaf_size : { std::size_t(4), std::size_t(8) }) {
+        BVHBuildOptions options;
+        options.max_leaf_size = leaf_size;
+
+        auto timer = Timer();
+        auto bvh = LinearBVH(triangles, options);
+        auto build_time = timer.elapsed();
+        auto objects_rate = trace(bvh, rays, hits);
+        print_row("Triangle objects", build_time, objects_rate, "leaves <= " + std::to_string(leaf_size) + ", " + std::to_string(hits) + " hits");
+
+        for (int width : { 0, static_cast<int>(leaf_size) }) {
+            auto mesh = Mesh(positions, {}, {}, indices, 0, TriangleTest::MollerTrumbore, options, width);
+            const auto& stats = mesh.stats();
+            auto rate = trace(mesh, rays, hits);
+
+            std::ostringstream details;
+            details << "leaves <= " << leaf_size << ", " << mesh.memory_usage() / triangles.size() << " B/triangle";
+
+            if (stats.packet_count > 0)
+                details << ", " << std::fixed << std::setprecision(0) << 100.0 * stats.triangle_count / (stats.packet_count * width) << "% lanes used";
+
+            details << ", " << hits << " hits";
+            print_row(width == 0 ? "Mesh" : (width == 4 ? "Mesh, Triangle4" : "Mesh, Triangle8"), stats.build_time, rate, details.str());
+        }
+    }
+
+    // The kernels alone: rays through the middle of a shell of triangles, each ray tested against all of them
+    srand(3);
+
+    std::vector<Ray> kernel_rays;
+    std::vector<Triangle> shell;
+
+    for (int i = 0; i < 256; ++i)
+        kernel_rays.push_back(Ray(Vector3::random(-1, 1), Vector3::random_in_unit_sphere().unit_vector()));
+
+    for (int i = 0; i < 4096; ++i) {
+        auto center = Vector3::random_in_unit_sphere().unit_vector() * 4;
+        shell.push_back(Triangle(center + Vector3::random(-0.6, 0.6), center + Vector3::random(-0.6, 0.6), center + Vector3::random(-0.6, 0.6), 0));
+    }
+
+    std::vector<Triangle4> packets4(shell.size() / 4);
+    std::vector<Triangle8> packets8(shell.size() / 8);
+
+    for (std::size_t i = 0; i < shell.size(); ++i) {
+        packets4[i / 4].set(i % 4, shell[i].vertex(0), shell[i].vertex(1), shell[i].vertex(2), i);
+        packets8[i / 8].set(i % 8, shell[i].vertex(0), shell[i].vertex(1), shell[i].vertex(2), i);
+    }
+
+    print_info(("Ray / triangle kernels, " + std::to_string(kernel_rays.size()) + " rays x " + std::to_string(shell.size()) + " triangles").c_str());
+    std::cout << std::left << std::setw(22) << "  kernel"
+              << std::right << std::setw(14) << "Mtests/s"
+              << std::setw(12) << "hits" << "\n";
+
+    auto print_kernel = [&](const std::string& name, double seconds, std::size_t kernel_hits) {
+        std::cout << std::left << std::setw(22) << ("  " + name)
+                  << std::right << std::fixed << std::setprecision(2)
+                  << std::setw(14) << kernel_rays.size() * shell.size() / seconds / 1e6
+                  << std::setw(12) << kernel_hits << "\n";
+    };
+
+    {
+        std::size_t kernel_hits = 0;
+        hit_record record;
+        auto timer = Timer();
+
+        for (const auto& ray : kernel_rays) {
+            for (const auto& triangle : shell)
+                kernel_hits += triangle.hit(ray, 0.001, infinity, record);
+        }
+
+        print_kernel("Triangle::hit", timer.elapsed(), kernel_hits);
+    }
+
+    {
+        std::size_t kernel_hits = 0;
+        double t, u, v;
+        auto timer = Timer();
+
+        for (const auto& ray : kernel_rays) {
+            for (const auto& packet : packets4)
+                kernel_hits += packet.nearest(ray, 0.001, infinity, t, u, v) >= 0;
+        }
+
+        print_kernel("Triangle4::nearest", timer.elapsed(), kernel_hits);
+    }
+
+    {
+        std::size_t kernel_hits = 0;
+        double t, u, v;
+        auto timer = Timer();
+
+        for (const auto& ray : kernel_rays) {
+            for (const auto& packet : packets8)
+                kernel_hits += packet.nearest(ray, 0.001, infinity, t, u, v) >= 0;
+        }
+
+        print_kernel("Triangle8::nearest", timer.elapsed(), kernel_hits);
+    }
+}
+
+void Benchmarks::bench_sphere_groups() {
+    auto camera = default_camera();
+    auto rays = camera_rays(camera, 320, 180);
+
+    for (int half_extent : { 4, 32, 100 }) {
+        auto scene = sphere_field(camera, half_extent);
+
+        print_header("Sphere groups, " + std::to_string(scene.objects().size()) + " spheres");
+
+        for (int width : { 1, 4, 8 }) {
+            std::size_t hits;
+
+            // A group is already a leaf's worth of spheres
+            BVHBuildOptions options;
+            options.max_leaf_size = width == 1 ? options.max_leaf_size : 1;
+
+            // Grouping counts in the build time
+            auto timer = Timer();
+            auto objects = width == 1 ? scene.objects() : (width == 4 ? group_spheres<4>(scene.objects()) : group_spheres<8>(scene.objects()));
+            auto bvh = BVHNode(objects, options);
+            auto build_time = timer.elapsed();
+            auto rate = trace(bvh, rays, hits);
+            auto name = width == 1 ? std::string("") : ", x" + std::to_string(width) + " groups";
+
+            print_row("BVHNode" + name, build_time, rate, std::to_string(objects.size()) + " leaf objects, " + std::to_string(bvh.stats().node_count) + " nodes");
+
+            timer.reset();
+            objects = width == 1 ? scene.objects() : (width == 4 ? group_spheres<4>(scene.objects()) : group_spheres<8>(scene.objects()));
+            auto linear_bvh = LinearBVH(objects, options);
+            build_time = timer.elapsed();
+            rate = trace(linear_bvh, rays, hits);
+
+            print_row("LinearBVH" + name, build_time, rate, std::to_string(linear_bvh.nodes().size()) + " nodes, " + std::to_string(hits) + " hits");
+        }
+    }
+}
+
+void Benchmarks::bench_particle_cloud() {
+    srand(25);
+
+    // A cube of small particles, as a simulation dump
+    const int particle_count = 1000000;
+
+    auto camera = Camera(Point3D(0, 0, 6), Point3D(0, 0, 0), Vector3(0, 1, 0), 40.0, 16.0 / 9.0, 10.0);
+    auto rays = camera_rays(camera, 320, 180);
+
+    std::vector<Particle> particles;
+    std::vector<MaterialId> materials;
+    Objects spheres;
+
+    for (int i = 0; i < particle_count; ++i) {
+        auto center = Vector3::random(-2, 2);
+        auto particle = Particle { { float(center.x()), float(center.y()), float(center.z()) }, float(random_double(0.004, 0.012)) };
+
+        particles.push_back(particle);
+        materials.push_back(static_cast<MaterialId>(i % 3));
+        spheres.push_back(std::make_shared<Sphere>(Point3D(particle.position[0], particle.position[1], particle.position[2]), particle.radius, materials.back()));
+    }
+
+    print_header("Particle cloud, " + std::to_string(particle_count) + " particles");
+
+    std::size_t hits = 0;
+
+    auto timer = Timer();
+    auto bvh = LinearBVH(spheres);
+    auto build_time = timer.elapsed();
+    auto rate = trace(bvh, rays, hits);
+    // Each object also pays the control block that make_shared allocates with it
+    auto memory = bvh.memory_usage() + spheres.size() * (sizeof(Sphere) + 16);
+    print_row("Sphere objects", build_time, rate, std::to_string(memory / particle_count) + " B/particle, " + std::to_string(hits) + " hits");
+
+    spheres.clear();
+
+    for (bool per_particle : { false, true }) {
+        auto cloud = per_particle ? ParticleCloud(particles, materials) : ParticleCloud(particles, 0);
+        rate = trace(cloud, rays, hits);
+        print_row(per_particle ? "ParticleCloud, ids" : "ParticleCloud", cloud.build_time(), rate,
+                  std::to_string(cloud.memory_usage() / particle_count) + " B/particle (" + std::to_string(sizeof(Particle) + (per_particle ? sizeof(MaterialId) : 0))
+                  + " without the BVH, " + std::to_string(cloud.build_peak_memory() / particle_count) + " at the build peak), " + std::to_string(hits) + " hits");
+    }
+}
+
+void Benchmarks::run_all() {
+    bench_bvh();
+    bench_linear_bvh();
+    bench_bvh_build_scaling();
+    bench_bvh_parallel_build();
+    bench_lbvh();
+    bench_sbvh();
+    bench_wide_bvh();
+    bench_instancing();
+    bench_refit();
+    bench_dynamic_bvh();
+    bench_lazy_bvh();
+    bench_node_layout();
+    bench_compressed_bvh();
+    bench_bvh_cache();
+    bench_kd_tree();
+    bench_grid();
+    bench_occlusion();
+    bench_deferred_attributes();
+    bench_material_table();
+    bench_static_dispatch();
+    bench_primitive_intersection();
+    bench_mesh();
+    bench_triangle_packets();
+    bench_sphere_groups();
+    bench_particle_cloud();
+}
@@ -1,13 +1,15 @@
 #include <iostream>
 #include <memory>
+#include <cstring>
 
 #include "tests.h"
+#include "benchmarks.h"
 
 #include "scene/camera.h"
 #include "scene/scene.h"
 #include "utils/image.h"
 
-#include "object/bvh_node.h"
+#include "object/bvh_cache.h"
 #include "object/sphere.h"
 
 #include "material/material.h"
@@ -15,14 +17,17 @@
 #include "material/metal.h"
 #include "material/dielectric.h"
 
-Scene random_scene(const Camera& camera) {
+Scene random_scene(const Camera& camera, BVHCache& cache) {
+    // Holds the materials of every sub-scene
     auto main_scene = Scene(camera);
+    // One bottom-level BVH per sub-scene, gathered under a top-level BVH
+    auto top_level = Objects();
 
     auto ground_scene = Scene(camera);
-    auto ground_material = std::make_shared<Lambertian>(Color(0.5, 0.5, 0.6));
+    auto ground_material = main_scene.add_material(std::make_shared<Lambertian>(Color(0.5, 0.5, 0.6)));
     ground_scene.add_object(std::make_shared<Sphere>(Point3D(0, -1000, 0), 1000, ground_material));
 
-    main_scene.add_object(std::make_shared<BVHNode>(ground_scene));
+    top_level.push_back(cache.load_or_build(ground_scene.objects()));
 
     auto small_balls_scene = Scene(camera);
     for (int x = -4; x < 4; ++x) {
@@ -30,40 +35,42 @@ Scene random_scene(const Camera& camera) {
             auto random_mat = random_double();
             auto center = Point3D(x + 0.9 * random_double(), 0.2, y + 0.9 * random_double());
 
-            std::shared_ptr<Material> sphere_material;
+            MaterialId sphere_material;
 
             if (random_mat < 0.8) {
                 // Diffuse
                 auto albedo = Color::random() * Color::random();
-                sphere_material = std::make_shared<Lambertian>(albedo);
+                sphere_material = main_scene.add_material(std::make_shared<Lambertian>(albedo));
                 small_balls_scene.add_object(std::make_shared<Sphere>(center, 0.2, sphere_material));
             } else if (random_mat < 0.95) {
                 // Metal
                 auto albedo = Color::random(0.5, 1);
                 auto fuzziness = random_double(0, 0.5);
-                sphere_material = std::make_shared<Metal>(albedo, fuzziness);
+                sphere_material = main_scene.add_material(std::make_shared<Metal>(albedo, fuzziness));
                 small_balls_scene.add_object(std::make_shared<Sphere>(center, 0.2, sphere_material));
             } else {
                 // Glass
-                sphere_material = std::make_shared<Dielectric>(1.5);
+                sphere_material = main_scene.add_material(std::make_shared<Dielectric>(1.5));
                 small_balls_scene.add_object(std::make_shared<Sphere>(center, 0.2, sphere_material));
             }
         }
     }
-    main_scene.add_object(std::make_shared<BVHNode>(small_balls_scene));
+    top_level.push_back(cache.load_or_build(small_balls_scene.objects()));
 
     auto big_balls_scene = Scene(camera);
 
-    auto material1 = std::make_shared<Lambertian>(Color(0.8, 0.2, 0.1));
+    auto material1 = main_scene.add_material(std::make_shared<Lambertian>(Color(0.8, 0.2, 0.1)));
     big_balls_scene.add_object(std::make_shared<Sphere>(Point3D(-4, 1, 0), 1.0, material1));
 
-    auto material2 = std::make_shared<Dielectric>(1.5);
+    auto material2 = main_scene.add_material(std::make_shared<Dielectric>(1.5));
     big_balls_scene.add_object(std::make_shared<Sphere>(Point3D(0, 1, 0), 1.0, material2));
 
-    auto material3 = std::make_shared<Metal>(Color(0.7, 0.6, 0.5), 0.0);
+    auto material3 = main_scene.add_material(std::make_shared<Metal>(Color(0.7, 0.6, 0.5), 0.0));
     big_balls_scene.add_object(std::make_shared<Sphere>(Point3D(4, 1, 0), 1.0, material3));
 
-    main_scene.add_object(std::make_shared<BVHNode>(big_balls_scene));
+    top_level.push_back(cache.load_or_build(big_balls_scene.objects()));
+
+    main_scene.add_object(cache.load_or_build(top_level));
 
     return main_scene;
 }
@@ -76,6 +83,11 @@ int main(int argc, char *argv[]) {
 
     if (strcmp(argv[1], "tests") == 0) {
         Tests::check_vector3();
+        Tests::check_bvh();
+    }
+
+    if (strcmp(argv[1], "bench") == 0) {
+        Benchmarks::run_all();
     }
 
     if (strcmp(argv[1], "image") == 0) {
@@ -102,8 +114,11 @@ int main(int argc, char *argv[]) {
             focus_distance
         );
 
-        // Scene
-        auto scene = random_scene(camera);
+        // Scene, its BVHs are reused from earlier runs when it did not change
+        auto cache = BVHCache(".bvh_cache");
+        auto scene = random_scene(camera, cache);
+        auto cache_info = "BVH cache: " + std::to_string(cache.load_count()) + " loaded, " + std::to_string(cache.build_count()) + " built";
+        print_info(cache_info.c_str());
         // Render
         scene.render(image, samples_per_pixel);
         // Save the rendering as a ppm image
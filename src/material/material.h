@@ -1,9 +1,14 @@
 #pragma once
 
+#include <cstdint>
+
 #include "object/ray.h"
 
 struct hit_record;
 
+// Index of a material in a MaterialTable
+using MaterialId = uint32_t;
+
 class Material {
     public:
         virtual bool scatter(const Ray& ray, const hit_record& record, Color& attenuation, Ray& scattered) const = 0;
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cassert>
+#include <memory>
+#include <type_traits>
+#include <typeinfo>
+#include <variant>
+#include <vector>
+
+#include "object/hittable.h"
+#include "material/material.h"
+#include "material/lambertian.h"
+#include "material/metal.h"
+#include "material/dielectric.h"
+
+// Owns the materials of a scene. Primitives and hit records refer to them by id and the renderer
+// resolves the id once per shaded hit, so tracing never touches shared_ptr reference counts.
+// Materials are added before rendering, lookups from the render threads are read-only.
+class MaterialTable {
+    public:
+        // Built-in materials are copied in by value and scattered without a virtual call. Other
+        // materials stay behind their pointer. Either way the table holds a single copy.
+        using Kernel = std::variant<Lambertian, Metal, Dielectric, std::shared_ptr<Material>>;
+
+        MaterialId add(std::shared_ptr<Material> material);
+
+        inline const Material& operator[](MaterialId id) const;
+        inline std::size_t size() const { return _kernels.size(); }
+
+        // Same as (*this)[id].scatter(...), dispatched on the material type
+        inline bool scatter(MaterialId id, const Ray& ray, const hit_record& record, Color& attenuation, Ray& scattered) const;
+
+    private:
+        std::vector<Kernel> _kernels;
+};
+
+MaterialId MaterialTable::add(std::shared_ptr<Material> material) {
+    // Exact types only, a subclass may override scatter()
+    const auto& type = typeid(*material);
+
+    if (type == typeid(Lambertian))
+        _kernels.push_back(static_cast<const Lambertian&>(*material));
+    else if (type == typeid(Metal))
+        _kernels.push_back(static_cast<const Metal&>(*material));
+    else if (type == typeid(Dielectric))
+        _kernels.push_back(static_cast<const Dielectric&>(*material));
+    else
+        _kernels.push_back(std::move(material));
+
+    return static_cast<MaterialId>(_kernels.size() - 1);
+}
+
+inline const Material& MaterialTable::operator[](MaterialId id) const {
+    assert(id < _kernels.size());
+
+    return std::visit([](const auto& material) -> const Material& {
+        using T = std::decay_t<decltype(material)>;
+
+        if constexpr (std::is_same<T, std::shared_ptr<Material>>::value)
+            return *material;
+        else
+            return material;
+    }, _kernels[id]);
+}
+
+inline bool MaterialTable::scatter(MaterialId id, const Ray& ray, const hit_record& record, Color& attenuation, Ray& scattered) const {
+    assert(id < _kernels.size());
+
+    return std::visit([&](const auto& material) {
+        using T = std::decay_t<decltype(material)>;
+
+        if constexpr (std::is_same<T, std::shared_ptr<Material>>::value)
+            return material->scatter(ray, record, attenuation, scattered);
+        else
+            return material.T::scatter(ray, record, attenuation, scattered);
+    }, _kernels[id]);
+}
@@ -11,13 +11,38 @@ class AABB {
         inline Point3D min() const { return _min; }
         inline Point3D max() const { return _max; }
 
+        inline Point3D centroid() const { return 0.5 * (_min + _max); }
+
+        inline double surface_area() const {
+            auto d = _max - _min;
+
+            if (d.x() < 0 || d.y() < 0 || d.z() < 0)
+                return 0;
+
+            return 2 * (d.x() * d.y() + d.y() * d.z() + d.z() * d.x());
+        }
+
+        // Inverted on at least one axis (flat boxes are not empty)
+        inline bool is_empty() const {
+            return _min.x() > _max.x() || _min.y() > _max.y() || _min.z() > _max.z();
+        }
+
+        inline int longest_axis() const {
+            auto d = _max - _min;
+
+            if (d.x() > d.y() && d.x() > d.z())
+                return 0;
+
+            return d.y() > d.z() ? 1 : 2;
+        }
+
         inline bool hit(const Ray& ray, double t_min, double t_max) const {
             for (int a = 0; a < 3; ++a) {
-                auto invD = 1.0f / ray.direction()[a];
+                auto invD = 1.0 / ray.direction()[a];
                 auto t0 = (min()[a] - ray.origin()[a]) * invD;
                 auto t1 = (max()[a] - ray.origin()[a]) * invD;
 
-                if (invD < 0.0f)
+                if (invD < 0.0)
                     std::swap(t0, t1);
 
                 t_min = t0 > t_min ? t0 : t_min;
@@ -46,6 +71,31 @@ class AABB {
             return AABB(small, big);
         }
 
+        inline static AABB surrounding_box(AABB box, const Point3D& point) {
+            return surrounding_box(box, AABB(point, point));
+        }
+
+        inline static AABB intersection(AABB box0, AABB box1) {
+            Point3D small(
+                fmax(box0.min().x(), box1.min().x()),
+                fmax(box0.min().y(), box1.min().y()),
+                fmax(box0.min().z(), box1.min().z())
+            );
+
+            Point3D big(
+                fmin(box0.max().x(), box1.max().x()),
+                fmin(box0.max().y(), box1.max().y()),
+                fmin(box0.max().z(), box1.max().z())
+            );
+
+            return AABB(small, big);
+        }
+
+        // Inverted box, the identity element of surrounding_box
+        inline static AABB empty() {
+            return AABB(Point3D(infinity, infinity, infinity), Point3D(-infinity, -infinity, -infinity));
+        }
+
     private:
         Point3D _min;
         Point3D _max;
@@ -0,0 +1,692 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <unordered_set>
+#include <vector>
+
+#include "object/aabb.h"
+#include "object/bvh_types.h"
+#include "object/bvh_spatial.h"
+#include "object/bvh_treelet.h"
+#include "object/hittable.h"
+#include "scene/scene.h"
+#include "utils/morton.h"
+#include "utils/thread_pool.h"
+#include "utils/timer.h"
+
+class BVHBuilder {
+    public:
+        BVHBuilder(const Objects& objects, const BVHBuildOptions& options = BVHBuildOptions());
+        // Primitives known only by their bounds. Spatial splits need the primitives to clip them,
+        // SBVH builds fall back to SAH.
+        BVHBuilder(const std::vector<AABB>& bounds, const BVHBuildOptions& options = BVHBuildOptions());
+        // `count` primitives whose bounds are `bounds(index)`, for callers storing them more compactly
+        template <typename Bounds>
+        BVHBuilder(std::size_t count, const Bounds& bounds, const BVHBuildOptions& options = BVHBuildOptions());
+
+        std::unique_ptr<BVHBuildNode> build();
+
+        // Builds the top of the tree only: ranges of at most `subtree_size` primitives are left as
+        // leaves, to be built later on their own
+        std::unique_ptr<BVHBuildNode> build_top_levels(std::size_t subtree_size);
+
+        // Object indices in leaf order, leaves reference contiguous ranges of it
+        const std::vector<std::size_t>& ordered_indices() const { return _ordered_indices; }
+        // Moves them out instead, for callers done with the builder
+        std::vector<std::size_t> take_ordered_indices() { return std::move(_ordered_indices); }
+
+        const BVHBuildStats& stats() const { return _stats; }
+
+    private:
+        // Smaller subtrees are not worth a task
+        static constexpr std::size_t min_task_size = 1024;
+        // Flattened nodes store the primitive count of a leaf on 16 bits
+        static constexpr std::size_t max_leaf_limit = 65535;
+
+        inline static const Objects& no_objects() {
+            static const Objects objects;
+            return objects;
+        }
+
+        struct Bin {
+            AABB bounds = AABB::empty();
+            std::size_t count = 0;
+        };
+
+        // SAH binning buffers, one set per build thread
+        struct Scratch {
+            std::vector<Bin> bins;
+            std::vector<double> right_areas;
+            std::vector<std::size_t> right_counts;
+        };
+
+        // Subtree left to a worker once the top of the tree has been split
+        struct Task {
+            std::unique_ptr<BVHBuildNode>* slot;
+            std::size_t start;
+            std::size_t end;
+            std::size_t depth;
+        };
+
+        std::unique_ptr<BVHBuildNode> build_recursive(std::size_t start, std::size_t end, std::size_t depth, Scratch& scratch);
+
+        // LBVH subtree, bounds are merged bottom-up instead of recomputed from the primitives at every level
+        std::unique_ptr<BVHBuildNode> build_morton(std::size_t start, std::size_t end);
+
+        // Sorts _primitives along the Morton curve of their centroids
+        void sort_morton(ThreadPool* pool);
+        // Split where the highest differing code bit flips, `start` if all the codes are equal
+        std::size_t morton_split(std::size_t start, std::size_t end, int& axis) const;
+
+        // Splits the top of the tree on the calling thread and collects the subtrees small enough to be tasks
+        void build_top(std::unique_ptr<BVHBuildNode>& slot, std::size_t start, std::size_t end, std::size_t depth,
+                       std::size_t task_size, Scratch& scratch, ThreadPool* pool, std::vector<Task>& tasks);
+
+        // Fills ordered_indices() and the stats once the tree is built
+        void finish(const Timer& timer);
+
+        std::unique_ptr<BVHBuildNode> make_leaf(const AABB& bounds, std::size_t start, std::size_t end);
+        std::unique_ptr<BVHBuildNode> make_node();
+        Scratch make_scratch();
+
+        void compute_bounds(std::size_t start, std::size_t end, AABB& bounds, AABB& centroid_bounds, ThreadPool* pool) const;
+
+        // Reorders [start, end) and returns the split index, or `start` if the range should be a leaf
+        std::size_t partition(std::size_t start, std::size_t end, std::size_t depth, const AABB& bounds,
+                              const AABB& centroid_bounds, int& axis, Scratch& scratch, ThreadPool* pool);
+        std::size_t sah_split(std::size_t start, std::size_t end, const AABB& bounds, const AABB& centroid_bounds,
+                              int& axis, Scratch& scratch, ThreadPool* pool);
+        void bin_primitives(std::size_t start, std::size_t end, const AABB& centroid_bounds, std::vector<Bin>& bins, ThreadPool* pool) const;
+
+        inline int bin_index(const Point3D& centroid, int axis, const AABB& centroid_bounds) const {
+            auto lo = centroid_bounds.min()[axis];
+            auto extent = centroid_bounds.max()[axis] - lo;
+            auto b = static_cast<int>((centroid[axis] - lo) * (_options.bin_count / extent));
+
+            return std::min(_options.bin_count - 1, b);
+        }
+
+        // Primitives per parallel chunk, never 0 whatever the threshold
+        inline std::size_t binning_grain() const {
+            return std::max<std::size_t>(1, _options.parallel_binning_threshold / 4);
+        }
+
+        // Intersections the SAH counts for a leaf of `count` primitives
+        inline double leaf_blocks(std::size_t count) const {
+            return static_cast<double>((count + _options.leaf_block_size - 1) / _options.leaf_block_size);
+        }
+
+        inline void allocate(std::size_t bytes) {
+            auto memory = _memory += bytes;
+            auto peak = _peak_memory.load();
+
+            while (memory > peak && !_peak_memory.compare_exchange_weak(peak, memory)) {}
+        }
+
+        // Deterministic per node, whatever thread builds it
+        inline int random_axis(std::size_t start, std::size_t end) const {
+            uint64_t x = _options.seed + 0x9E3779B97F4A7C15ull * (start + 1) + end;
+            x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+            x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+            x = x ^ (x >> 31);
+
+            return static_cast<int>(x % 3);
+        }
+
+        // Empty for builders over bounds
+        const Objects& _objects;
+        BVHBuildOptions _options;
+        std::vector<BVHPrimitive> _primitives;
+        std::vector<std::size_t> _ordered_indices;
+        BVHBuildStats _stats;
+        std::atomic<std::size_t> _memory{0};
+        std::atomic<std::size_t> _peak_memory{0};
+        std::atomic<std::size_t> _node_count{0};
+        std::atomic<std::size_t> _restructured{0};
+        // Sorted Morton codes of _primitives, LBVH only
+        std::vector<uint64_t> _morton_codes;
+};
+
+BVHBuilder::BVHBuilder(const Objects& objects, const BVHBuildOptions& options) : _objects(objects), _options(options) {
+    _options.bin_count = std::max(_options.bin_count, 2);
+    _options.max_leaf_size = std::clamp<std::size_t>(_options.max_leaf_size, 1, max_leaf_limit);
+
+    if (_options.thread_count == 0)
+        _options.thread_count = ThreadPool::hardware_threads();
+
+    auto timer = Timer();
+
+    _primitives.reserve(objects.size());
+    allocate(objects.size() * sizeof(BVHPrimitive));
+
+    for (std::size_t i = 0; i < objects.size(); ++i) {
+        AABB box;
+
+        if (!objects[i]->bounding_box(box))
+            std::cerr << "No bounding box in bvh builder.\n";
+
+        _primitives.push_back({ box, box.centroid(), i });
+    }
+
+    _stats.build_time = timer.elapsed();
+}
+
+BVHBuilder::BVHBuilder(const std::vector<AABB>& bounds, const BVHBuildOptions& options)
+    : BVHBuilder(bounds.size(), [&](std::size_t index) { return bounds[index]; }, options) {}
+
+template <typename Bounds>
+BVHBuilder::BVHBuilder(std::size_t count, const Bounds& bounds, const BVHBuildOptions& options) : _objects(no_objects()), _options(options) {
+    _options.bin_count = std::max(_options.bin_count, 2);
+    _options.max_leaf_size = std::clamp<std::size_t>(_options.max_leaf_size, 1, max_leaf_limit);
+
+    if (_options.thread_count == 0)
+        _options.thread_count = ThreadPool::hardware_threads();
+
+    if (_options.split_method == BVHSplitMethod::SBVH)
+        _options.split_method = BVHSplitMethod::SAH;
+
+    auto timer = Timer();
+
+    _primitives.reserve(count);
+    allocate(count * sizeof(BVHPrimitive));
+
+    for (std::size_t i = 0; i < count; ++i) {
+        auto box = bounds(i);
+        _primitives.push_back({ box, box.centroid(), i });
+    }
+
+    _stats.build_time = timer.elapsed();
+}
+
+std::unique_ptr<BVHBuildNode> BVHBuilder::build() {
+    auto timer = Timer();
+
+    _ordered_indices.clear();
+
+    if (_primitives.empty())
+        return nullptr;
+
+    auto scratch = make_scratch();
+    std::unique_ptr<BVHBuildNode> root;
+
+    bool parallel = _options.thread_count > 1 && _primitives.size() > min_task_size
+        && _options.split_method != BVHSplitMethod::SBVH;
+    auto pool = parallel ? std::make_unique<ThreadPool>(_options.thread_count) : nullptr;
+
+    if (_options.split_method == BVHSplitMethod::LBVH)
+        sort_morton(pool.get());
+
+    if (_options.split_method == BVHSplitMethod::SBVH) {
+        auto builder = SpatialSplitBuilder(_objects, _options);
+        root = builder.build(_primitives);
+
+        _node_count += builder.node_count();
+        allocate(builder.node_count() * sizeof(BVHBuildNode) + builder.duplicated_references() * sizeof(BVHPrimitive));
+        _stats.duplicated_references = builder.duplicated_references();
+
+        if (_options.treelet_size > 0) {
+            auto optimizer = TreeletOptimizer(_options);
+            optimizer.optimize(*root);
+            _restructured += optimizer.restructured();
+        }
+    } else if (!parallel) {
+        root = build_recursive(0, _primitives.size(), 0, scratch);
+
+        if (_options.treelet_size > 0) {
+            auto optimizer = TreeletOptimizer(_options);
+            optimizer.optimize(*root);
+            _restructured += optimizer.restructured();
+        }
+    } else {
+        std::vector<Task> tasks;
+
+        // Enough subtrees for every thread to pick several, which evens out their sizes
+        auto task_size = std::max(min_task_size, _primitives.size() / (8 * _options.thread_count));
+
+        build_top(root, 0, _primitives.size(), 0, task_size, scratch, pool.get(), tasks);
+
+        std::vector<std::future<void>> futures;
+
+        for (const auto& task : tasks) {
+            futures.push_back(pool->submit([this, task]() {
+                auto task_scratch = make_scratch();
+                *task.slot = build_recursive(task.start, task.end, task.depth, task_scratch);
+
+                if (_options.treelet_size > 0) {
+                    auto optimizer = TreeletOptimizer(_options);
+                    optimizer.optimize(**task.slot);
+                    _restructured += optimizer.restructured();
+                }
+            }));
+        }
+
+        for (auto& future : futures)
+            future.get();
+
+        // The subtrees are done, only the nodes above them are left
+        if (_options.treelet_size > 0) {
+            std::unordered_set<const BVHBuildNode*> done;
+
+            for (const auto& task : tasks)
+                done.insert(task.slot->get());
+
+            auto optimizer = TreeletOptimizer(_options);
+            optimizer.optimize(*root, &done);
+            _restructured += optimizer.restructured();
+        }
+    }
+
+    finish(timer);
+
+    return root;
+}
+
+std::unique_ptr<BVHBuildNode> BVHBuilder::build_top_levels(std::size_t subtree_size) {
+    auto timer = Timer();
+
+    _ordered_indices.clear();
+
+    if (_primitives.empty())
+        return nullptr;
+
+    auto scratch = make_scratch();
+    std::unique_ptr<BVHBuildNode> root;
+
+    bool parallel = _options.thread_count > 1 && _primitives.size() > min_task_size;
+    auto pool = parallel ? std::make_unique<ThreadPool>(_options.thread_count) : nullptr;
+
+    if (_options.split_method == BVHSplitMethod::LBVH)
+        sort_morton(pool.get());
+
+    std::vector<Task> tasks;
+    build_top(root, 0, _primitives.size(), 0, std::max<std::size_t>(subtree_size, 1), scratch, pool.get(), tasks);
+
+    for (const auto& task : tasks) {
+        AABB bounds, centroid_bounds;
+        compute_bounds(task.start, task.end, bounds, centroid_bounds, pool.get());
+        *task.slot = make_leaf(bounds, task.start, task.end);
+    }
+
+    finish(timer);
+
+    return root;
+}
+
+void BVHBuilder::finish(const Timer& timer) {
+    _ordered_indices.reserve(_primitives.size());
+    allocate(_primitives.size() * sizeof(std::size_t));
+
+    for (const auto& primitive : _primitives)
+        _ordered_indices.push_back(primitive.index);
+
+    _stats.build_time += timer.elapsed();
+    _stats.peak_memory = _peak_memory;
+    _stats.node_count = _node_count;
+    _stats.restructured_treelets = _restructured;
+}
+
+BVHBuilder::Scratch BVHBuilder::make_scratch() {
+    auto bins = static_cast<std::size_t>(_options.bin_count);
+
+    Scratch scratch;
+    scratch.bins.resize(3 * bins);
+    scratch.right_areas.resize(bins);
+    scratch.right_counts.resize(bins);
+
+    allocate(bins * (3 * sizeof(Bin) + sizeof(double) + sizeof(std::size_t)));
+
+    return scratch;
+}
+
+std::unique_ptr<BVHBuildNode> BVHBuilder::make_node() {
+    _node_count++;
+    allocate(sizeof(BVHBuildNode));
+
+    return std::make_unique<BVHBuildNode>();
+}
+
+std::unique_ptr<BVHBuildNode> BVHBuilder::make_leaf(const AABB& bounds, std::size_t start, std::size_t end) {
+    auto node = make_node();
+    node->bounds = bounds;
+    node->first = start;
+    node->count = end - start;
+
+    return node;
+}
+
+std::unique_ptr<BVHBuildNode> BVHBuilder::build_recursive(std::size_t start, std::size_t end, std::size_t depth, Scratch& scratch) {
+    if (_options.split_method == BVHSplitMethod::LBVH)
+        return build_morton(start, end);
+
+    AABB bounds, centroid_bounds;
+    compute_bounds(start, end, bounds, centroid_bounds, nullptr);
+
+    int axis;
+    auto mid = partition(start, end, depth, bounds, centroid_bounds, axis, scratch, nullptr);
+
+    if (mid == start)
+        return make_leaf(bounds, start, end);
+
+    auto node = make_node();
+    node->bounds = bounds;
+    node->split_axis = axis;
+    node->children[0] = build_recursive(start, mid, depth + 1, scratch);
+    node->children[1] = build_recursive(mid, end, depth + 1, scratch);
+
+    return node;
+}
+
+void BVHBuilder::build_top(std::unique_ptr<BVHBuildNode>& slot, std::size_t start, std::size_t end, std::size_t depth,
+                           std::size_t task_size, Scratch& scratch, ThreadPool* pool, std::vector<Task>& tasks) {
+    if (end - start <= task_size) {
+        tasks.push_back({ &slot, start, end, depth });
+        return;
+    }
+
+    AABB bounds, centroid_bounds;
+    compute_bounds(start, end, bounds, centroid_bounds, pool);
+
+    int axis;
+    auto mid = partition(start, end, depth, bounds, centroid_bounds, axis, scratch, pool);
+
+    if (mid == start) {
+        slot = make_leaf(bounds, start, end);
+        return;
+    }
+
+    slot = make_node();
+    slot->bounds = bounds;
+    slot->split_axis = axis;
+
+    build_top(slot->children[0], start, mid, depth + 1, task_size, scratch, pool, tasks);
+    build_top(slot->children[1], mid, end, depth + 1, task_size, scratch, pool, tasks);
+}
+
+void BVHBuilder::sort_morton(ThreadPool* pool) {
+    AABB bounds, centroid_bounds;
+    compute_bounds(0, _primitives.size(), bounds, centroid_bounds, pool);
+
+    auto lo = centroid_bounds.min();
+    auto extent = centroid_bounds.max() - lo;
+
+    auto size = _primitives.size();
+    std::vector<MortonPrimitive> codes(size);
+    allocate(size * 2 * sizeof(MortonPrimitive));
+
+    auto encode = [&](std::size_t begin, std::size_t end) {
+        for (auto i = begin; i < end; ++i) {
+            auto offset = _primitives[i].centroid - lo;
+            double normalized[3];
+
+            for (int a = 0; a < 3; ++a)
+                normalized[a] = extent[a] > 0 ? offset[a] / extent[a] : 0;
+
+            codes[i] = { morton_code(normalized[0], normalized[1], normalized[2], _options.morton_bits), static_cast<uint32_t>(i) };
+        }
+    };
+
+    if (pool)
+        pool->parallel_for(0, size, 1 << 14, encode);
+    else
+        encode(0, size);
+
+    radix_sort(codes, _options.morton_bits <= 30 ? 30 : 63, pool);
+
+    std::vector<BVHPrimitive> sorted;
+    sorted.reserve(size);
+    _morton_codes.resize(size);
+    allocate(size * (sizeof(BVHPrimitive) + sizeof(uint64_t)));
+
+    for (std::size_t i = 0; i < size; ++i) {
+        sorted.push_back(_primitives[codes[i].index]);
+        _morton_codes[i] = codes[i].code;
+    }
+
+    _primitives.swap(sorted);
+}
+
+std::size_t BVHBuilder::morton_split(std::size_t start, std::size_t end, int& axis) const {
+    auto first = _morton_codes[start];
+    auto last = _morton_codes[end - 1];
+
+    if (first == last)
+        return start;
+
+    // The codes of the range share every bit above `bit`, so it goes from 0 to 1 exactly once
+    int bit = 63 - __builtin_clzll(first ^ last);
+
+    auto split = std::partition_point(
+        _morton_codes.begin() + start,
+        _morton_codes.begin() + end,
+        [bit](uint64_t code) { return ((code >> bit) & 1) == 0; }
+    );
+
+    // x, y and z bits are interleaved from the highest one down
+    axis = 2 - bit % 3;
+
+    return split - _morton_codes.begin();
+}
+
+std::unique_ptr<BVHBuildNode> BVHBuilder::build_morton(std::size_t start, std::size_t end) {
+    auto count = end - start;
+    int axis = 0;
+    auto mid = count <= _options.max_leaf_size ? start : morton_split(start, end, axis);
+
+    // Identical codes: split the range in two halves
+    if (mid == start && count > _options.max_leaf_size)
+        mid = start + count / 2;
+
+    if (mid == start) {
+        auto bounds = AABB::empty();
+
+        for (auto i = start; i < end; ++i)
+            bounds = AABB::surrounding_box(bounds, _primitives[i].bounds);
+
+        return make_leaf(bounds, start, end);
+    }
+
+    auto node = make_node();
+    node->split_axis = axis;
+    node->children[0] = build_morton(start, mid);
+    node->children[1] = build_morton(mid, end);
+    node->bounds = AABB::surrounding_box(node->children[0]->bounds, node->children[1]->bounds);
+
+    return node;
+}
+
+void BVHBuilder::compute_bounds(std::size_t start, std::size_t end, AABB& bounds, AABB& centroid_bounds, ThreadPool* pool) const {
+    bounds = AABB::empty();
+    centroid_bounds = AABB::empty();
+
+    if (!pool || end - start <= _options.parallel_binning_threshold) {
+        for (auto i = start; i < end; ++i) {
+            bounds = AABB::surrounding_box(bounds, _primitives[i].bounds);
+            centroid_bounds = AABB::surrounding_box(centroid_bounds, _primitives[i].centroid);
+        }
+        return;
+    }
+
+    auto grain = binning_grain();
+    auto chunks = (end - start + grain - 1) / grain;
+    std::vector<std::pair<AABB, AABB>> partial(chunks, { AABB::empty(), AABB::empty() });
+
+    pool->parallel_for(start, end, grain, [&](std::size_t chunk_start, std::size_t chunk_end) {
+        auto& [chunk_bounds, chunk_centroids] = partial[(chunk_start - start) / grain];
+
+        for (auto i = chunk_start; i < chunk_end; ++i) {
+            chunk_bounds = AABB::surrounding_box(chunk_bounds, _primitives[i].bounds);
+            chunk_centroids = AABB::surrounding_box(chunk_centroids, _primitives[i].centroid);
+        }
+    });
+
+    for (const auto& [chunk_bounds, chunk_centroids] : partial) {
+        bounds = AABB::surrounding_box(bounds, chunk_bounds);
+        centroid_bounds = AABB::surrounding_box(centroid_bounds, chunk_centroids);
+    }
+}
+
+std::size_t BVHBuilder::partition(std::size_t start, std::size_t end, std::size_t depth, const AABB& bounds,
+                                  const AABB& centroid_bounds, int& axis, Scratch& scratch, ThreadPool* pool) {
+    auto count = end - start;
+
+    if (count == 1)
+        return start;
+
+    axis = centroid_bounds.longest_axis();
+    auto mid = start;
+
+    if (_options.split_method == BVHSplitMethod::LBVH) {
+        if (count <= _options.max_leaf_size)
+            return start;
+
+        mid = morton_split(start, end, axis);
+
+        if (mid != start)
+            return mid;
+    }
+
+    // The top levels of a lazy SBVH only get object splits
+    bool use_sah = (_options.split_method == BVHSplitMethod::SAH || _options.split_method == BVHSplitMethod::SBVH)
+        && depth < _options.max_sah_depth;
+
+    if (use_sah)
+        mid = sah_split(start, end, bounds, centroid_bounds, axis, scratch, pool);
+
+    if (mid != start || (use_sah && count <= _options.max_leaf_size))
+        return mid;
+
+    if (count <= _options.max_leaf_size)
+        return start;
+
+    // Every centroid fell in the same bin (or no SAH): fall back to a median split
+    if (_options.split_method == BVHSplitMethod::RandomMedian)
+        axis = random_axis(start, end);
+
+    mid = start + count / 2;
+
+    std::nth_element(
+        _primitives.begin() + start,
+        _primitives.begin() + mid,
+        _primitives.begin() + end,
+        [axis](const BVHPrimitive& a, const BVHPrimitive& b) { return a.centroid[axis] < b.centroid[axis]; }
+    );
+
+    return mid;
+}
+
+// Fills bins[axis * bin_count + b] for the three axes in one pass over the primitives
+void BVHBuilder::bin_primitives(std::size_t start, std::size_t end, const AABB& centroid_bounds, std::vector<Bin>& bins, ThreadPool* pool) const {
+    const int bin_count = _options.bin_count;
+
+    auto bin_range = [&](std::size_t range_start, std::size_t range_end, std::vector<Bin>& output) {
+        for (int a = 0; a < 3; ++a) {
+            if (centroid_bounds.max()[a] <= centroid_bounds.min()[a])
+                continue;
+
+            for (auto i = range_start; i < range_end; ++i) {
+                auto& bin = output[a * bin_count + bin_index(_primitives[i].centroid, a, centroid_bounds)];
+                bin.bounds = AABB::surrounding_box(bin.bounds, _primitives[i].bounds);
+                bin.count++;
+            }
+        }
+    };
+
+    std::fill(bins.begin(), bins.end(), Bin());
+
+    if (!pool || end - start <= _options.parallel_binning_threshold) {
+        bin_range(start, end, bins);
+        return;
+    }
+
+    // Each chunk bins into its own copy, merged in chunk order
+    auto grain = binning_grain();
+    auto chunks = (end - start + grain - 1) / grain;
+    std::vector<std::vector<Bin>> partial(chunks, std::vector<Bin>(bins.size()));
+
+    pool->parallel_for(start, end, grain, [&](std::size_t chunk_start, std::size_t chunk_end) {
+        bin_range(chunk_start, chunk_end, partial[(chunk_start - start) / grain]);
+    });
+
+    for (const auto& chunk_bins : partial) {
+        for (std::size_t b = 0; b < bins.size(); ++b) {
+            bins[b].bounds = AABB::surrounding_box(bins[b].bounds, chunk_bins[b].bounds);
+            bins[b].count += chunk_bins[b].count;
+        }
+    }
+}
+
+std::size_t BVHBuilder::sah_split(std::size_t start, std::size_t end, const AABB& bounds, const AABB& centroid_bounds,
+                                  int& axis, Scratch& scratch, ThreadPool* pool) {
+    const int bin_count = _options.bin_count;
+    auto count = end - start;
+    auto parent_area = bounds.surface_area();
+
+    auto best_cost = infinity;
+    int best_axis = -1;
+    int best_bin = -1;
+
+    auto& right_area = scratch.right_areas;
+    auto& right_count = scratch.right_counts;
+
+    bin_primitives(start, end, centroid_bounds, scratch.bins, pool);
+
+    for (int a = 0; a < 3; ++a) {
+        if (centroid_bounds.max()[a] <= centroid_bounds.min()[a])
+            continue;
+
+        const auto* bins = &scratch.bins[a * bin_count];
+
+        // Sweep from the right to get the cost of every [b + 1, bin_count) side
+        auto box = AABB::empty();
+        std::size_t n = 0;
+
+        for (int b = bin_count - 1; b > 0; --b) {
+            box = AABB::surrounding_box(box, bins[b].bounds);
+            n += bins[b].count;
+            right_area[b] = box.surface_area();
+            right_count[b] = n;
+        }
+
+        box = AABB::empty();
+        n = 0;
+
+        for (int b = 0; b < bin_count - 1; ++b) {
+            box = AABB::surrounding_box(box, bins[b].bounds);
+            n += bins[b].count;
+
+            if (n == 0 || right_count[b + 1] == 0)
+                continue;
+
+            auto cost = box.surface_area() * leaf_blocks(n) + right_area[b + 1] * leaf_blocks(right_count[b + 1]);
+
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_axis = a;
+                best_bin = b;
+            }
+        }
+    }
+
+    if (best_axis < 0)
+        return start;
+
+    auto inv_parent_area = parent_area > 0 ? 1 / parent_area : 0;
+    best_cost = _options.traversal_cost + _options.intersection_cost * best_cost * inv_parent_area;
+    auto leaf_cost = _options.intersection_cost * leaf_blocks(count);
+
+    if (count <= _options.max_leaf_size && leaf_cost <= best_cost)
+        return start;
+
+    axis = best_axis;
+
+    auto middle = std::partition(
+        _primitives.begin() + start,
+        _primitives.begin() + end,
+        [&](const BVHPrimitive& primitive) { return bin_index(primitive.centroid, best_axis, centroid_bounds) <= best_bin; }
+    );
+
+    return middle - _primitives.begin();
+}
@@ -0,0 +1,248 @@
+#pragma once
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "object/hittable.h"
+#include "object/aabb.h"
+#include "object/bvh_types.h"
+#include "object/linear_bvh.h"
+#include "scene/scene.h"
+#include "utils/hash.h"
+#include "utils/mapped_file.h"
+
+// Start of a BVH cache file. The nodes follow it, then the primitive index of every leaf reference.
+// 64 bytes, so that the mapped nodes stay on cache lines.
+struct alignas(64) BVHCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t node_size;
+    uint64_t key;
+    uint64_t node_count;
+    uint64_t reference_count;
+    uint64_t primitive_count;
+    double built_sah_cost;
+    // Hash of everything after the header
+    uint64_t checksum;
+};
+
+static_assert(sizeof(BVHCacheHeader) == 64, "BVHCacheHeader must stay 64 bytes");
+
+// Stores built LinearBVHs on disk, one file per key. The key hashes the primitive geometry and the
+// options that change the tree, so an edited scene gets a new file. A cached tree is memory-mapped
+// and its nodes used in place: they only hold indices, so nothing needs fixing up. Files that are
+// stale, truncated or corrupt are rebuilt and overwritten.
+class BVHCache {
+    public:
+        // Bump when the file layout or LinearBVHNode changes
+        static constexpr uint32_t version = 1;
+
+        BVHCache(const std::string& directory);
+
+        // The cached tree of `objects`, built and stored when missing or invalid
+        std::shared_ptr<LinearBVH> load_or_build(const Objects& objects, const BVHBuildOptions& options = BVHBuildOptions());
+
+        // Hash of what the tree depends on: the geometry of every primitive (Hittable::hash_geometry,
+        // which covers the clipping of spatial splits) and the build options
+        static uint64_t key(const Objects& objects, const BVHBuildOptions& options);
+
+        std::string path(uint64_t key) const;
+
+        // Trees loaded from disk and trees built since construction
+        std::size_t load_count() const { return _load_count; }
+        std::size_t build_count() const { return _build_count; }
+
+    private:
+        static constexpr char magic[8] = { 'R', 'T', 'B', 'V', 'H', 'C', 0, 0 };
+
+        std::shared_ptr<LinearBVH> load(const std::string& path, uint64_t key, const Objects& objects, const BVHBuildOptions& options) const;
+        bool save(const std::string& path, uint64_t key, const LinearBVH& bvh, const Objects& objects) const;
+
+        std::string _directory;
+        std::size_t _load_count = 0;
+        std::size_t _build_count = 0;
+};
+
+BVHCache::BVHCache(const std::string& directory) : _directory(directory) {
+    if (mkdir(_directory.c_str(), 0755) != 0 && errno != EEXIST)
+        std::cerr << "Cannot create the BVH cache directory " << _directory << ".\n";
+}
+
+uint64_t BVHCache::key(const Objects& objects, const BVHBuildOptions& options) {
+    Hasher hasher;
+    hasher.add(version);
+    hasher.add(objects.size());
+
+    for (const auto& object : objects)
+        object->hash_geometry(hasher);
+
+    // Every option read by the builders except thread_count, which does not change the tree
+    hasher.add(options.split_method);
+    hasher.add(options.bin_count);
+    hasher.add(options.max_leaf_size);
+    hasher.add(options.traversal_cost);
+    hasher.add(options.intersection_cost);
+    hasher.add(options.leaf_block_size);
+    hasher.add(options.max_sah_depth);
+    hasher.add(options.parallel_binning_threshold);
+    hasher.add(options.seed);
+    hasher.add(options.morton_bits);
+    hasher.add(options.spatial_split_alpha);
+    hasher.add(options.spatial_split_budget);
+    hasher.add(options.treelet_size);
+    hasher.add(options.node_layout);
+
+    return hasher.value();
+}
+
+std::string BVHCache::path(uint64_t key) const {
+    std::ostringstream path;
+    path << _directory << "/" << std::hex << std::setw(16) << std::setfill('0') << key << ".bvh";
+
+    return path.str();
+}
+
+std::shared_ptr<LinearBVH> BVHCache::load_or_build(const Objects& objects, const BVHBuildOptions& options) {
+    auto cache_key = key(objects, options);
+    auto file_path = path(cache_key);
+
+    if (auto bvh = load(file_path, cache_key, objects, options)) {
+        _load_count++;
+        return bvh;
+    }
+
+    auto bvh = std::make_shared<LinearBVH>(objects, options);
+    _build_count++;
+
+    if (!save(file_path, cache_key, *bvh, objects))
+        std::cerr << "Cannot write the BVH cache file " << file_path << ".\n";
+
+    return bvh;
+}
+
+std::shared_ptr<LinearBVH> BVHCache::load(const std::string& path, uint64_t key, const Objects& objects, const BVHBuildOptions& options) const {
+    auto mapping = std::make_shared<MappedFile>(path);
+
+    if (!mapping->is_open() || mapping->size() < sizeof(BVHCacheHeader))
+        return nullptr;
+
+    BVHCacheHeader header;
+    std::memcpy(&header, mapping->data(), sizeof(header));
+
+    auto nodes_size = header.node_count * sizeof(LinearBVHNode);
+    auto references_size = header.reference_count * sizeof(uint32_t);
+
+    bool valid = std::memcmp(header.magic, magic, sizeof(magic)) == 0
+        && header.version == version
+        && header.node_size == sizeof(LinearBVHNode)
+        && header.key == key
+        && header.primitive_count == objects.size()
+        && header.node_count < mapping->size() && header.reference_count < mapping->size()
+        && mapping->size() == sizeof(BVHCacheHeader) + nodes_size + references_size;
+
+    if (!valid)
+        return nullptr;
+
+    // Reads the whole file once, the tree is trusted afterwards
+    Hasher hasher;
+    hasher.add(mapping->data() + sizeof(BVHCacheHeader), nodes_size + references_size);
+
+    if (hasher.value() != header.checksum)
+        return nullptr;
+
+    std::vector<uint32_t> references(header.reference_count);
+    std::memcpy(references.data(), mapping->data() + sizeof(BVHCacheHeader) + nodes_size, references_size);
+
+    auto bvh = std::shared_ptr<LinearBVH>(new LinearBVH(options));
+    bvh->_primitives.reserve(references.size());
+
+    for (auto index : references) {
+        if (index >= objects.size())
+            return nullptr;
+
+        bvh->_primitives.push_back(objects[index]);
+    }
+
+    bvh->_nodes = { reinterpret_cast<LinearBVHNode*>(mapping->data() + sizeof(BVHCacheHeader)), header.node_count };
+    bvh->_mapping = mapping;
+    bvh->_built_sah_cost = header.built_sah_cost;
+
+    return bvh;
+}
+
+bool BVHCache::save(const std::string& path, uint64_t key, const LinearBVH& bvh, const Objects& objects) const {
+    std::unordered_map<const Hittable*, uint32_t> indices;
+
+    for (std::size_t i = 0; i < objects.size(); ++i)
+        indices[objects[i].get()] = static_cast<uint32_t>(i);
+
+    std::vector<uint32_t> references;
+    references.reserve(bvh._primitives.size());
+
+    for (const auto& primitive : bvh._primitives)
+        references.push_back(indices.at(primitive.get()));
+
+    const auto& nodes = bvh.nodes();
+    auto nodes_size = nodes.size() * sizeof(LinearBVHNode);
+    auto references_size = references.size() * sizeof(uint32_t);
+
+    BVHCacheHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, magic, sizeof(magic));
+    header.version = version;
+    header.node_size = sizeof(LinearBVHNode);
+    header.key = key;
+    header.node_count = nodes.size();
+    header.reference_count = references.size();
+    header.primitive_count = objects.size();
+    header.built_sah_cost = bvh._built_sah_cost;
+
+    Hasher hasher;
+    hasher.add(nodes.data, nodes_size);
+    hasher.add(references.data(), references_size);
+    header.checksum = hasher.value();
+
+    // Written aside under a name no other run uses, then renamed: a concurrent run never maps or
+    // overwrites a partial file
+    auto temporary_path = path + ".XXXXXX";
+    int descriptor = mkstemp(&temporary_path[0]);
+
+    if (descriptor < 0)
+        return false;
+
+    // mkstemp creates the file readable by its owner only
+    fchmod(descriptor, 0644);
+    close(descriptor);
+
+    {
+        std::ofstream file(temporary_path, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(nodes.data), nodes_size);
+        file.write(reinterpret_cast<const char*>(references.data()), references_size);
+
+        if (!file) {
+            std::remove(temporary_path.c_str());
+            return false;
+        }
+    }
+
+    if (std::rename(temporary_path.c_str(), path.c_str()) != 0) {
+        std::remove(temporary_path.c_str());
+        return false;
+    }
+
+    return true;
+}
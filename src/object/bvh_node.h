@@ -3,6 +3,7 @@
 #include <algorithm>
 
 #include "object/hittable.h"
+#include "object/bvh_build.h"
 #include "utils/utils.h"
 #include "scene/scene.h"
 
@@ -10,88 +11,156 @@ class BVHNode: public Hittable {
     public:
         BVHNode();
 
-        BVHNode(const Scene& scene) : BVHNode(scene.objects(), 0, scene.objects().size()) {}
+        BVHNode(const Scene& scene) : BVHNode(scene.objects(), median_options()) {}
 
-        BVHNode(const Objects& objects, size_t start, size_t end);
+        BVHNode(const Scene& scene, const BVHBuildOptions& options) : BVHNode(scene.objects(), options) {}
 
-        virtual bool hit(const Ray& r, double t_min, double t_max, hit_record& record) const override;
-        virtual bool bounding_box(AABB& output_box) const override;
+        BVHNode(const Objects& objects, const BVHBuildOptions& options);
 
-        inline static bool box_compare(const std::shared_ptr<Hittable> a, const std::shared_ptr<Hittable> b, int axis) {
-            AABB box_a;
-            AABB box_b;
+        BVHNode(const Objects& objects, size_t start, size_t end);
 
-            if (!a->bounding_box(box_a) || !b->bounding_box(box_b))
-                std::cerr << "No bounding box in bvh_node constructor.\n";
+        BVHNode(const BVHBuildNode& node, const Objects& objects, const std::vector<std::size_t>& ordered_indices);
 
-            return box_a.min()[axis] < box_b.min()[axis];
-        }
+        virtual bool hit(const Ray& r, double t_min, double t_max, hit_record& record) const override;
+        virtual bool intersect(const Ray& ray, double t_min, double t_max, hit_record& record) const override;
+        virtual bool occluded(const Ray& ray, double t_min, double t_max) const override;
+        virtual bool bounding_box(AABB& output_box) const override;
 
-        inline static bool box_x_compare (const std::shared_ptr<Hittable> a, const std::shared_ptr<Hittable> b) {
-            return box_compare(a, b, 0);
-        }
+        BVHStats stats(double traversal_cost = 1.0, double intersection_cost = 1.0) const;
 
-        inline static bool box_y_compare (const std::shared_ptr<Hittable> a, const std::shared_ptr<Hittable> b) {
-            return box_compare(a, b, 1);
-        }
+        // The original builder: random axis, median split, at most two objects per leaf
+        inline static BVHBuildOptions median_options() {
+            BVHBuildOptions options;
+            options.split_method = BVHSplitMethod::RandomMedian;
+            options.max_leaf_size = 2;
 
-        inline static bool box_z_compare (const std::shared_ptr<Hittable> a, const std::shared_ptr<Hittable> b) {
-            return box_compare(a, b, 2);
+            return options;
         }
 
     public:
         std::shared_ptr<Hittable> left;
         std::shared_ptr<Hittable> right;
+        // Leaves holding more than two objects keep them here instead of in left/right
+        Objects primitives;
         AABB box;
+
+    private:
+        void build(const BVHBuildNode& node, const Objects& objects, const std::vector<std::size_t>& ordered_indices);
+        void collect_stats(BVHStats& stats, std::size_t depth, double traversal_cost, double intersection_cost) const;
 };
 
-BVHNode::BVHNode(const Objects& objects, size_t start, size_t end) {
-    auto mutable_objects = objects;
+BVHNode::BVHNode(const Objects& objects, const BVHBuildOptions& options) {
+    auto builder = BVHBuilder(objects, options);
+    auto root = builder.build();
+
+    if (root)
+        build(*root, objects, builder.ordered_indices());
+}
 
-    int axis = random_int(0,2);
+BVHNode::BVHNode(const Objects& objects, size_t start, size_t end)
+    : BVHNode(Objects(objects.begin() + start, objects.begin() + end), median_options()) {}
 
-    auto comparator = (axis == 0) ? BVHNode::box_x_compare : (axis == 1) ? BVHNode::box_y_compare : BVHNode::box_z_compare;
+BVHNode::BVHNode(const BVHBuildNode& node, const Objects& objects, const std::vector<std::size_t>& ordered_indices) {
+    build(node, objects, ordered_indices);
+}
 
-    size_t object_span = end - start;
+void BVHNode::build(const BVHBuildNode& node, const Objects& objects, const std::vector<std::size_t>& ordered_indices) {
+    box = node.bounds;
 
-    if (object_span == 1) {
-        left = right = mutable_objects[start];
-    } else if (object_span == 2) {
-        if (comparator(mutable_objects[start], mutable_objects[start + 1])) {
-            left = mutable_objects[start];
-            right = mutable_objects[start + 1];
-        } else {
-            left = mutable_objects[start + 1];
-            right = mutable_objects[start];
-        }
+    if (!node.is_leaf()) {
+        left = std::make_shared<BVHNode>(*node.children[0], objects, ordered_indices);
+        right = std::make_shared<BVHNode>(*node.children[1], objects, ordered_indices);
+    } else if (node.count <= 2) {
+        left = objects[ordered_indices[node.first]];
+        right = objects[ordered_indices[node.first + node.count - 1]];
     } else {
-        std::sort(mutable_objects.begin() + start, mutable_objects.begin() + end, comparator);
-
-        auto mid = start + object_span / 2;
-        left = std::make_shared<BVHNode>(mutable_objects, start, mid);
-        right = std::make_shared<BVHNode>(mutable_objects, mid, end);
+        for (auto i = node.first; i < node.first + node.count; ++i)
+            primitives.push_back(objects[ordered_indices[i]]);
     }
+}
 
-    AABB box_left, box_right;
+bool BVHNode::hit(const Ray& ray, double t_min, double t_max, hit_record& record) const {
+    if (!intersect(ray, t_min, t_max, record))
+        return false;
 
-    if (!left->bounding_box(box_left) || !right->bounding_box(box_right))
-        std::cerr << "No bounding box in bvh_node constructor.\n";
+    record.object->compute_surface(ray, record);
 
-    box = AABB::surrounding_box(box_left, box_right);
+    return true;
 }
 
-bool BVHNode::hit(const Ray& ray, double t_min, double t_max, hit_record& record) const {
+bool BVHNode::intersect(const Ray& ray, double t_min, double t_max, hit_record& record) const {
     if (!box.hit(ray, t_min, t_max))
         return false;
 
-    bool hit_left = left->hit(ray, t_min, t_max, record);
-    bool hit_right = right->hit(ray, t_min, hit_left ? record.t : t_max, record);
+    if (!primitives.empty()) {
+        bool has_hit = false;
+
+        for (const auto& object : primitives) {
+            if (object->intersect(ray, t_min, t_max, record)) {
+                has_hit = true;
+                t_max = record.t;
+            }
+        }
+
+        return has_hit;
+    }
+
+    bool hit_left = left->intersect(ray, t_min, t_max, record);
+    bool hit_right = right->intersect(ray, t_min, hit_left ? record.t : t_max, record);
 
     return hit_left || hit_right;
 }
 
+bool BVHNode::occluded(const Ray& ray, double t_min, double t_max) const {
+    if (!box.hit(ray, t_min, t_max))
+        return false;
+
+    if (!primitives.empty()) {
+        for (const auto& object : primitives) {
+            if (object->occluded(ray, t_min, t_max))
+                return true;
+        }
+
+        return false;
+    }
+
+    return left->occluded(ray, t_min, t_max) || right->occluded(ray, t_min, t_max);
+}
+
 bool BVHNode::bounding_box(AABB& output_box) const {
     output_box = box;
 
     return true;
 }
+
+BVHStats BVHNode::stats(double traversal_cost, double intersection_cost) const {
+    BVHStats stats;
+
+    collect_stats(stats, 1, traversal_cost, intersection_cost);
+
+    auto root_area = box.surface_area();
+    stats.sah_cost = root_area > 0 ? stats.sah_cost / root_area : 0;
+
+    return stats;
+}
+
+// Accumulates the surface-area weighted costs, normalised by the root area in stats()
+void BVHNode::collect_stats(BVHStats& stats, std::size_t depth, double traversal_cost, double intersection_cost) const {
+    stats.node_count++;
+    stats.max_depth = std::max(stats.max_depth, depth);
+
+    auto left_node = std::dynamic_pointer_cast<BVHNode>(left);
+    auto right_node = std::dynamic_pointer_cast<BVHNode>(right);
+
+    if (left_node && right_node && left != right) {
+        stats.sah_cost += box.surface_area() * traversal_cost;
+        left_node->collect_stats(stats, depth + 1, traversal_cost, intersection_cost);
+        right_node->collect_stats(stats, depth + 1, traversal_cost, intersection_cost);
+        return;
+    }
+
+    std::size_t count = !primitives.empty() ? primitives.size() : (left == right ? 1 : 2);
+
+    stats.leaf_count++;
+    stats.sah_cost += box.surface_area() * count * intersection_cost;
+}
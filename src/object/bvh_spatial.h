@@ -0,0 +1,423 @@
+#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "object/aabb.h"
+#include "object/bvh_types.h"
+#include "object/hittable.h"
+#include "scene/scene.h"
+
+// Spatial split BVH builder (Stich et al., "Spatial Splits in Bounding Volume Hierarchies").
+// At every node it compares the best binned object split with the best binned spatial split,
+// which clips the references straddling the plane and keeps them on both sides. Spatial splits
+// are only tried where the object split children overlap, and stop once the budget of duplicated
+// references is spent. Leaves index the reordered references, so a primitive may appear in
+// several leaves.
+class SpatialSplitBuilder {
+    public:
+        SpatialSplitBuilder(const Objects& objects, const BVHBuildOptions& options)
+            : _objects(objects), _options(options) {}
+
+        // Replaces `references` by the references in leaf order, duplicates included
+        std::unique_ptr<BVHBuildNode> build(std::vector<BVHPrimitive>& references);
+
+        std::size_t node_count() const { return _node_count; }
+        std::size_t duplicated_references() const { return _duplicated; }
+
+    private:
+        struct Bin {
+            AABB bounds = AABB::empty();
+            // Object split: primitives in the bin, spatial split: references starting in the bin
+            std::size_t entries = 0;
+            // Spatial split: references ending in the bin
+            std::size_t exits = 0;
+        };
+
+        struct Split {
+            double cost = infinity;
+            int axis = -1;
+            // Object split: last bin on the left, spatial split: position of the plane
+            int bin = -1;
+            double position = 0;
+            AABB left_bounds;
+            AABB right_bounds;
+            std::size_t left_count = 0;
+            std::size_t right_count = 0;
+        };
+
+        std::unique_ptr<BVHBuildNode> build_node(std::vector<BVHPrimitive>& references, std::size_t depth);
+
+        Split find_object_split(const std::vector<BVHPrimitive>& references, const AABB& centroid_bounds) const;
+        Split find_spatial_split(const std::vector<BVHPrimitive>& references, const AABB& bounds) const;
+
+        void split_spatially(std::vector<BVHPrimitive>& references, const Split& split,
+                             std::vector<BVHPrimitive>& left, std::vector<BVHPrimitive>& right);
+
+        // Part of the reference on one side of the plane, false if there is none
+        bool clip(const BVHPrimitive& reference, int axis, double lo, double hi, BVHPrimitive& output) const;
+
+        inline int object_bin(const Point3D& centroid, int axis, const AABB& centroid_bounds) const {
+            auto lo = centroid_bounds.min()[axis];
+            auto extent = centroid_bounds.max()[axis] - lo;
+            auto b = static_cast<int>((centroid[axis] - lo) * (_options.bin_count / extent));
+
+            return std::min(_options.bin_count - 1, std::max(0, b));
+        }
+
+        const Objects& _objects;
+        BVHBuildOptions _options;
+        double _root_area = 0;
+        std::size_t _max_references = 0;
+        std::size_t _reference_count = 0;
+        std::size_t _duplicated = 0;
+        std::size_t _node_count = 0;
+        std::vector<BVHPrimitive> _ordered;
+};
+
+std::unique_ptr<BVHBuildNode> SpatialSplitBuilder::build(std::vector<BVHPrimitive>& references) {
+    if (references.empty())
+        return nullptr;
+
+    auto bounds = AABB::empty();
+
+    for (const auto& reference : references)
+        bounds = AABB::surrounding_box(bounds, reference.bounds);
+
+    _root_area = bounds.surface_area();
+    _reference_count = references.size();
+    _max_references = references.size() + static_cast<std::size_t>(_options.spatial_split_budget * references.size());
+    _ordered.reserve(references.size());
+
+    auto root = build_node(references, 0);
+    references = std::move(_ordered);
+
+    return root;
+}
+
+std::unique_ptr<BVHBuildNode> SpatialSplitBuilder::build_node(std::vector<BVHPrimitive>& references, std::size_t depth) {
+    auto node = std::make_unique<BVHBuildNode>();
+    _node_count++;
+
+    auto count = references.size();
+    auto bounds = AABB::empty();
+    auto centroid_bounds = AABB::empty();
+
+    for (const auto& reference : references) {
+        bounds = AABB::surrounding_box(bounds, reference.bounds);
+        centroid_bounds = AABB::surrounding_box(centroid_bounds, reference.centroid);
+    }
+
+    node->bounds = bounds;
+
+    auto make_leaf = [&]() {
+        node->first = _ordered.size();
+        node->count = count;
+        _ordered.insert(_ordered.end(), references.begin(), references.end());
+
+        return std::move(node);
+    };
+
+    if (count == 1)
+        return make_leaf();
+
+    auto area = bounds.surface_area();
+    auto inv_area = area > 0 ? 1 / area : 0;
+    auto leaf_cost = _options.intersection_cost * count;
+
+    // Deep nodes only get median splits, which bounds the depth of the tree
+    auto object_split = depth < _options.max_sah_depth ? find_object_split(references, centroid_bounds) : Split();
+    auto best_cost = object_split.cost;
+    bool spatial = false;
+    Split spatial_split;
+
+    // Only where the object split children overlap, and while the budget allows it
+    if (object_split.axis >= 0 && _reference_count < _max_references) {
+        auto overlap = AABB::intersection(object_split.left_bounds, object_split.right_bounds);
+
+        if (!overlap.is_empty() && overlap.surface_area() > _options.spatial_split_alpha * _root_area) {
+            spatial_split = find_spatial_split(references, bounds);
+
+            auto duplicates = spatial_split.left_count + spatial_split.right_count - count;
+
+            if (spatial_split.cost < best_cost && _reference_count + duplicates <= _max_references) {
+                best_cost = spatial_split.cost;
+                spatial = true;
+            }
+        }
+    }
+
+    best_cost = _options.traversal_cost + _options.intersection_cost * best_cost * inv_area;
+
+    if (count <= _options.max_leaf_size && (object_split.axis < 0 || leaf_cost <= best_cost))
+        return make_leaf();
+
+    std::vector<BVHPrimitive> left, right;
+
+    if (spatial) {
+        node->split_axis = spatial_split.axis;
+        split_spatially(references, spatial_split, left, right);
+    } else if (object_split.axis >= 0) {
+        node->split_axis = object_split.axis;
+
+        for (const auto& reference : references) {
+            if (object_bin(reference.centroid, object_split.axis, centroid_bounds) <= object_split.bin)
+                left.push_back(reference);
+            else
+                right.push_back(reference);
+        }
+    } else {
+        auto axis = centroid_bounds.longest_axis();
+        node->split_axis = axis;
+
+        std::nth_element(
+            references.begin(),
+            references.begin() + count / 2,
+            references.end(),
+            [axis](const BVHPrimitive& a, const BVHPrimitive& b) { return a.centroid[axis] < b.centroid[axis]; }
+        );
+
+        left.assign(references.begin(), references.begin() + count / 2);
+        right.assign(references.begin() + count / 2, references.end());
+    }
+
+    // The children take over, the parent's references are not needed anymore
+    std::vector<BVHPrimitive>().swap(references);
+
+    node->children[0] = build_node(left, depth + 1);
+    node->children[1] = build_node(right, depth + 1);
+
+    return node;
+}
+
+SpatialSplitBuilder::Split SpatialSplitBuilder::find_object_split(const std::vector<BVHPrimitive>& references, const AABB& centroid_bounds) const {
+    const int bin_count = _options.bin_count;
+    Split best;
+
+    std::vector<Bin> bins(bin_count);
+    std::vector<AABB> right_bounds(bin_count);
+    std::vector<std::size_t> right_counts(bin_count);
+
+    for (int a = 0; a < 3; ++a) {
+        if (centroid_bounds.max()[a] <= centroid_bounds.min()[a])
+            continue;
+
+        std::fill(bins.begin(), bins.end(), Bin());
+
+        for (const auto& reference : references) {
+            auto& bin = bins[object_bin(reference.centroid, a, centroid_bounds)];
+            bin.bounds = AABB::surrounding_box(bin.bounds, reference.bounds);
+            bin.entries++;
+        }
+
+        auto box = AABB::empty();
+        std::size_t n = 0;
+
+        for (int b = bin_count - 1; b > 0; --b) {
+            box = AABB::surrounding_box(box, bins[b].bounds);
+            n += bins[b].entries;
+            right_bounds[b] = box;
+            right_counts[b] = n;
+        }
+
+        box = AABB::empty();
+        n = 0;
+
+        for (int b = 0; b < bin_count - 1; ++b) {
+            box = AABB::surrounding_box(box, bins[b].bounds);
+            n += bins[b].entries;
+
+            if (n == 0 || right_counts[b + 1] == 0)
+                continue;
+
+            auto cost = box.surface_area() * n + right_bounds[b + 1].surface_area() * right_counts[b + 1];
+
+            if (cost < best.cost) {
+                best.cost = cost;
+                best.axis = a;
+                best.bin = b;
+                best.left_bounds = box;
+                best.right_bounds = right_bounds[b + 1];
+                best.left_count = n;
+                best.right_count = right_counts[b + 1];
+            }
+        }
+    }
+
+    return best;
+}
+
+SpatialSplitBuilder::Split SpatialSplitBuilder::find_spatial_split(const std::vector<BVHPrimitive>& references, const AABB& bounds) const {
+    const int bin_count = _options.bin_count;
+    Split best;
+
+    std::vector<Bin> bins(bin_count);
+    std::vector<AABB> right_bounds(bin_count);
+    std::vector<std::size_t> right_counts(bin_count);
+
+    for (int a = 0; a < 3; ++a) {
+        auto lo = bounds.min()[a];
+        auto extent = bounds.max()[a] - lo;
+
+        if (extent <= 0)
+            continue;
+
+        auto bin_size = extent / bin_count;
+        auto bin_of = [&](double x) { return std::min(bin_count - 1, std::max(0, static_cast<int>((x - lo) / bin_size))); };
+
+        std::fill(bins.begin(), bins.end(), Bin());
+
+        // Every reference is clipped to each bin it overlaps
+        for (const auto& reference : references) {
+            auto first = bin_of(reference.bounds.min()[a]);
+            auto last = bin_of(reference.bounds.max()[a]);
+
+            for (int b = first; b <= last; ++b) {
+                BVHPrimitive clipped;
+                auto bin_lo = b == first ? -infinity : lo + b * bin_size;
+                auto bin_hi = b == last ? infinity : lo + (b + 1) * bin_size;
+
+                if (clip(reference, a, bin_lo, bin_hi, clipped))
+                    bins[b].bounds = AABB::surrounding_box(bins[b].bounds, clipped.bounds);
+            }
+
+            bins[first].entries++;
+            bins[last].exits++;
+        }
+
+        auto box = AABB::empty();
+        std::size_t n = 0;
+
+        for (int b = bin_count - 1; b > 0; --b) {
+            box = AABB::surrounding_box(box, bins[b].bounds);
+            n += bins[b].exits;
+            right_bounds[b] = box;
+            right_counts[b] = n;
+        }
+
+        box = AABB::empty();
+        n = 0;
+
+        for (int b = 0; b < bin_count - 1; ++b) {
+            box = AABB::surrounding_box(box, bins[b].bounds);
+            n += bins[b].entries;
+
+            if (n == 0 || right_counts[b + 1] == 0)
+                continue;
+
+            auto cost = box.surface_area() * n + right_bounds[b + 1].surface_area() * right_counts[b + 1];
+
+            if (cost < best.cost) {
+                best.cost = cost;
+                best.axis = a;
+                best.bin = b;
+                best.position = lo + (b + 1) * bin_size;
+                best.left_bounds = box;
+                best.right_bounds = right_bounds[b + 1];
+                best.left_count = n;
+                best.right_count = right_counts[b + 1];
+            }
+        }
+    }
+
+    return best;
+}
+
+void SpatialSplitBuilder::split_spatially(std::vector<BVHPrimitive>& references, const Split& split,
+                                          std::vector<BVHPrimitive>& left, std::vector<BVHPrimitive>& right) {
+    auto axis = split.axis;
+    auto plane = split.position;
+
+    // Bounds and counts of the references lying entirely on one side
+    auto left_bounds = AABB::empty();
+    auto right_bounds = AABB::empty();
+    std::vector<const BVHPrimitive*> straddling;
+    std::size_t duplicated = 0;
+
+    for (const auto& reference : references) {
+        if (reference.bounds.max()[axis] <= plane) {
+            left.push_back(reference);
+            left_bounds = AABB::surrounding_box(left_bounds, reference.bounds);
+        } else if (reference.bounds.min()[axis] >= plane) {
+            right.push_back(reference);
+            right_bounds = AABB::surrounding_box(right_bounds, reference.bounds);
+        } else {
+            straddling.push_back(&reference);
+        }
+    }
+
+    for (const auto* reference : straddling) {
+        BVHPrimitive left_part, right_part;
+        bool has_left = clip(*reference, axis, -infinity, plane, left_part);
+        bool has_right = clip(*reference, axis, plane, infinity, right_part);
+
+        if (has_left && has_right) {
+            // Reference unsplitting: keep the whole reference on one side when it is cheaper than duplicating it
+            auto nl = static_cast<double>(left.size() + 1);
+            auto nr = static_cast<double>(right.size() + 1);
+            auto split_left = AABB::surrounding_box(left_bounds, left_part.bounds);
+            auto split_right = AABB::surrounding_box(right_bounds, right_part.bounds);
+            auto all_left = AABB::surrounding_box(left_bounds, reference->bounds);
+            auto all_right = AABB::surrounding_box(right_bounds, reference->bounds);
+
+            auto split_cost = split_left.surface_area() * nl + split_right.surface_area() * nr;
+            auto left_cost = all_left.surface_area() * nl + right_bounds.surface_area() * (nr - 1);
+            auto right_cost = left_bounds.surface_area() * (nl - 1) + all_right.surface_area() * nr;
+
+            if (split_cost <= left_cost && split_cost <= right_cost) {
+                left.push_back(left_part);
+                right.push_back(right_part);
+                left_bounds = split_left;
+                right_bounds = split_right;
+                duplicated++;
+            } else if (left_cost <= right_cost) {
+                left.push_back(*reference);
+                left_bounds = all_left;
+            } else {
+                right.push_back(*reference);
+                right_bounds = all_right;
+            }
+        } else if (has_left) {
+            left.push_back(left_part);
+            left_bounds = AABB::surrounding_box(left_bounds, left_part.bounds);
+        } else {
+            right.push_back(has_right ? right_part : *reference);
+            right_bounds = AABB::surrounding_box(right_bounds, right.back().bounds);
+        }
+    }
+
+    // Unsplitting can empty a side, fall back to the plain halves then
+    if (left.empty() || right.empty()) {
+        duplicated = 0;
+        left.clear();
+        right.clear();
+
+        for (const auto& reference : references)
+            (reference.centroid[axis] < plane ? left : right).push_back(reference);
+
+        if (left.empty() || right.empty()) {
+            auto middle = references.size() / 2;
+            left.assign(references.begin(), references.begin() + middle);
+            right.assign(references.begin() + middle, references.end());
+        }
+    }
+
+    _reference_count += duplicated;
+    _duplicated += duplicated;
+}
+
+bool SpatialSplitBuilder::clip(const BVHPrimitive& reference, int axis, double lo, double hi, BVHPrimitive& output) const {
+    auto min = reference.bounds.min();
+    auto max = reference.bounds.max();
+    min[axis] = std::max(min[axis], lo);
+    max[axis] = std::min(max[axis], hi);
+
+    if (!_objects[reference.index]->clip_bounds(AABB(min, max), output.bounds))
+        return false;
+
+    output.centroid = output.bounds.centroid();
+    output.index = reference.index;
+
+    return true;
+}
@@ -0,0 +1,186 @@
+#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <unordered_set>
+#include <vector>
+
+#include "object/aabb.h"
+#include "object/bvh_types.h"
+
+// Treelet restructuring (Karras & Aila, "Fast Parallel Construction of High-Quality BVHs").
+// Bottom-up, every internal node grows a treelet of up to `treelet_size` leaves by opening its
+// largest descendants, then replaces the treelet with the topology of minimal SAH cost, found by
+// dynamic programming over the subsets of its leaves. BVH leaves are kept as is.
+class TreeletOptimizer {
+    public:
+        static constexpr int max_treelet_size = 8;
+
+        TreeletOptimizer(const BVHBuildOptions& options)
+            : _treelet_size(std::min(std::max(options.treelet_size, 3), max_treelet_size)),
+              _traversal_cost(options.traversal_cost), _intersection_cost(options.intersection_cost) {}
+
+        // Subtrees rooted at a node of `done` are assumed to be optimized already
+        void optimize(BVHBuildNode& root, const std::unordered_set<const BVHBuildNode*>* done = nullptr);
+
+        // Number of treelets whose topology changed
+        std::size_t restructured() const { return _restructured; }
+
+    private:
+        void update_cost(BVHBuildNode& node) const;
+        void restructure(BVHBuildNode& root);
+
+        int _treelet_size;
+        double _traversal_cost;
+        double _intersection_cost;
+        std::size_t _restructured = 0;
+};
+
+void TreeletOptimizer::update_cost(BVHBuildNode& node) const {
+    if (node.is_leaf()) {
+        node.cost = _intersection_cost * node.count * node.bounds.surface_area();
+        return;
+    }
+
+    node.cost = _traversal_cost * node.bounds.surface_area() + node.children[0]->cost + node.children[1]->cost;
+}
+
+void TreeletOptimizer::optimize(BVHBuildNode& node, const std::unordered_set<const BVHBuildNode*>* done) {
+    if (done && done->count(&node))
+        return;
+
+    if (!node.is_leaf()) {
+        optimize(*node.children[0], done);
+        optimize(*node.children[1], done);
+    }
+
+    update_cost(node);
+
+    if (!node.is_leaf())
+        restructure(node);
+}
+
+void TreeletOptimizer::restructure(BVHBuildNode& root) {
+    if (root.children[0]->is_leaf() && root.children[1]->is_leaf())
+        return;
+
+    std::vector<std::unique_ptr<BVHBuildNode>> leaves;
+
+    leaves.push_back(std::move(root.children[0]));
+    leaves.push_back(std::move(root.children[1]));
+
+    // Opened internal nodes, reused for the new topology
+    std::vector<std::unique_ptr<BVHBuildNode>> owned_internals;
+    // Slot of `leaves` each opened node used to occupy
+    std::vector<std::size_t> opened_slots;
+
+    while (static_cast<int>(leaves.size()) < _treelet_size) {
+        int largest = -1;
+
+        for (std::size_t i = 0; i < leaves.size(); ++i) {
+            if (!leaves[i]->is_leaf() && (largest < 0 || leaves[i]->bounds.surface_area() > leaves[largest]->bounds.surface_area()))
+                largest = static_cast<int>(i);
+        }
+
+        if (largest < 0)
+            break;
+
+        auto opened = std::move(leaves[largest]);
+        leaves[largest] = std::move(opened->children[0]);
+        leaves.push_back(std::move(opened->children[1]));
+        owned_internals.push_back(std::move(opened));
+        opened_slots.push_back(largest);
+    }
+
+    int n = static_cast<int>(leaves.size());
+    int full = (1 << n) - 1;
+
+    double area[1 << max_treelet_size];
+    double cost[1 << max_treelet_size];
+    int split[1 << max_treelet_size];
+    AABB bounds[1 << max_treelet_size];
+
+    for (int set = 1; set <= full; ++set) {
+        int lowest = set & -set;
+
+        if (set == lowest) {
+            int i = __builtin_ctz(set);
+            bounds[set] = leaves[i]->bounds;
+            area[set] = bounds[set].surface_area();
+            cost[set] = leaves[i]->cost;
+            continue;
+        }
+
+        bounds[set] = AABB::surrounding_box(bounds[lowest], bounds[set ^ lowest]);
+        area[set] = bounds[set].surface_area();
+
+        // Only partitions holding the lowest leaf on the left, the others are their mirror
+        auto best = infinity;
+        int best_split = lowest;
+
+        for (int left = (set - 1) & set; left > 0; left = (left - 1) & set) {
+            if (!(left & lowest))
+                continue;
+
+            auto c = cost[left] + cost[set ^ left];
+
+            if (c < best) {
+                best = c;
+                best_split = left;
+            }
+        }
+
+        cost[set] = _traversal_cost * area[set] + best;
+        split[set] = best_split;
+    }
+
+    bool improved = cost[full] < root.cost * (1 - 1e-9);
+
+    std::size_t next_internal = 0;
+
+    auto emit = [&](auto& self, BVHBuildNode& node, int set) -> void {
+        int sides[2] = { split[set], set ^ split[set] };
+
+        for (int k = 0; k < 2; ++k) {
+            if ((sides[k] & (sides[k] - 1)) == 0) {
+                node.children[k] = std::move(leaves[__builtin_ctz(sides[k])]);
+            } else {
+                auto& child = owned_internals[next_internal++];
+                self(self, *child, sides[k]);
+                node.children[k] = std::move(child);
+            }
+        }
+
+        node.bounds = AABB::surrounding_box(node.children[0]->bounds, node.children[1]->bounds);
+
+        // Nearest-first traversal expects the first child on the low side of the split axis
+        auto delta = node.children[1]->bounds.centroid() - node.children[0]->bounds.centroid();
+        auto abs_delta = Vector3(std::fabs(delta.x()), std::fabs(delta.y()), std::fabs(delta.z()));
+        node.split_axis = abs_delta.x() > abs_delta.y() && abs_delta.x() > abs_delta.z() ? 0 : (abs_delta.y() > abs_delta.z() ? 1 : 2);
+
+        if (delta[node.split_axis] < 0)
+            std::swap(node.children[0], node.children[1]);
+
+        update_cost(node);
+    };
+
+    if (!improved) {
+        // Close the opened nodes in reverse order, undoing the loop above
+        for (auto i = owned_internals.size(); i > 0; --i) {
+            auto& node = owned_internals[i - 1];
+            auto slot = opened_slots[i - 1];
+
+            node->children[1] = std::move(leaves.back());
+            leaves.pop_back();
+            node->children[0] = std::move(leaves[slot]);
+            leaves[slot] = std::move(node);
+        }
+
+        root.children[0] = std::move(leaves[0]);
+        root.children[1] = std::move(leaves[1]);
+        return;
+    }
+
+    _restructured++;
+    emit(emit, root, full);
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+
+#include "object/aabb.h"
+
+enum class BVHSplitMethod {
+    // Random axis, split at the median (the original BVHNode builder)
+    RandomMedian,
+    // Binned Surface Area Heuristic
+    SAH,
+    // Linear BVH: centroids sorted along a Morton curve, split where the highest code bit flips
+    LBVH,
+    // Binned SAH that may also split space, clipping the primitives across the plane and referencing
+    // them on both sides (Stich et al., "Spatial Splits in Bounding Volume Hierarchies"). Serial.
+    SBVH
+};
+
+// Order of the nodes of a flattened BVH in memory
+enum class BVHNodeLayout {
+    // Sibling pairs in depth-first order
+    DepthFirst,
+    // Top-down treelets of the most likely visited pairs, each filling a memory page
+    Treelet,
+    // Cache-oblivious van Emde Boas order: the top half of the tree, then each bottom subtree, recursively
+    VanEmdeBoas
+};
+
+struct BVHBuildOptions {
+    BVHSplitMethod split_method = BVHSplitMethod::SAH;
+    // Number of bins the centroid range is divided into when looking for a split
+    int bin_count = 16;
+    // A range is always split while it holds more primitives than this,
+    // the median builder stops there while SAH may keep splitting if it is cheaper. At most 65535.
+    std::size_t max_leaf_size = 4;
+    // SAH costs of visiting a node and of intersecting one primitive
+    double traversal_cost = 1.0;
+    double intersection_cost = 1.0;
+    // SAH: primitives a leaf tests at once (Mesh triangle packets), a leaf of n primitives costs
+    // ceil(n / leaf_block_size) intersections
+    std::size_t leaf_block_size = 1;
+    // Below this depth the builder only does median splits, bounding the depth of the tree
+    // (flattened BVHs traverse with a fixed-size stack)
+    std::size_t max_sah_depth = 64;
+    // Build threads, 0 means one per hardware thread and 1 builds serially.
+    // The tree does not depend on it: only the build time does.
+    std::size_t thread_count = 0;
+    // Ranges larger than this are binned by several threads at once
+    std::size_t parallel_binning_threshold = 1 << 14;
+    // Seeds the axis choice of the median builder
+    uint64_t seed = 0;
+    // Morton code length of the LBVH builder: 30 (10 bits per axis) or 63 (21 bits per axis)
+    int morton_bits = 30;
+    // SBVH: spatial splits are only tried where the children of the best object split overlap by more
+    // than this fraction of the root surface area
+    double spatial_split_alpha = 1e-5;
+    // SBVH: duplicated references allowed, as a fraction of the number of primitives
+    double spatial_split_budget = 0.5;
+    // Leaves per treelet of the restructuring pass run after the build (at most 8), 0 disables it
+    int treelet_size = 0;
+    // Node order of LinearBVH
+    BVHNodeLayout node_layout = BVHNodeLayout::DepthFirst;
+    // LinearBVH::update rebuilds instead of refitting once the SAH cost grew by this factor since the last build
+    double rebuild_sah_ratio = 1.5;
+    // LazyBVH builds the tree down to ranges of this many primitives up front, and the rest on first use
+    std::size_t lazy_subtree_size = 4096;
+};
+
+struct BVHStats {
+    std::size_t node_count = 0;
+    std::size_t leaf_count = 0;
+    std::size_t max_depth = 0;
+    // Expected cost of a ray traversing the tree, in units of one primitive intersection
+    double sah_cost = 0;
+};
+
+struct BVHBuildStats {
+    // Seconds
+    double build_time = 0;
+    // Highest number of bytes held by the builder (primitive references, nodes, scratch)
+    std::size_t peak_memory = 0;
+    std::size_t node_count = 0;
+    std::size_t restructured_treelets = 0;
+    // References added by spatial splits
+    std::size_t duplicated_references = 0;
+};
+
+// Primitive reference with cached bounds, so the build never calls bounding_box twice
+struct BVHPrimitive {
+    AABB bounds;
+    Point3D centroid;
+    std::size_t index;
+};
+
+// Intermediate tree produced by the builders, converted afterwards to the traversal format
+struct BVHBuildNode {
+    AABB bounds;
+    std::unique_ptr<BVHBuildNode> children[2];
+    int split_axis = 0;
+    // Range of the leaf in BVHBuilder::ordered_indices()
+    std::size_t first = 0;
+    std::size_t count = 0;
+    // SAH cost of the subtree, not normalised, only kept up to date by the treelet restructuring
+    double cost = 0;
+
+    inline bool is_leaf() const { return count > 0; }
+};
@@ -0,0 +1,319 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+#include "object/hittable.h"
+#include "object/aabb.h"
+#include "object/bvh_build.h"
+#include "scene/scene.h"
+
+// Binary BVH node holding the bounds of its two children as Q-bit integers within its own box, which
+// is itself decoded from its parent. Coordinate q along an axis decodes to box.min + q * 2^exponent,
+// the product is exact so the decoding is the same wherever it runs.
+template <typename Q>
+struct CompressedBVHNode {
+    // [child][min or max][axis], rounded outwards
+    Q bounds[2][2][3];
+    int8_t exponent[3];
+    uint8_t axis;
+    // Interior child: index of its node, leaf child: index of its first primitive
+    uint32_t children[2];
+    // Number of primitives of a leaf child, 0 for interior children
+    uint16_t count[2];
+};
+
+static_assert(sizeof(CompressedBVHNode<uint8_t>) == 28, "CompressedBVHNode<uint8_t> must stay 28 bytes");
+static_assert(sizeof(CompressedBVHNode<uint16_t>) == 40, "CompressedBVHNode<uint16_t> must stay 40 bytes");
+
+// BVH storing quantized child bounds instead of floats, for scenes where the acceleration structure
+// outgrows the geometry. Boxes are rounded outwards at every level, so traversal stays conservative
+// and only visits a few more nodes than with exact bounds.
+template <typename Q>
+class CompressedBVH: public Hittable {
+    static_assert(std::is_same<Q, uint8_t>::value || std::is_same<Q, uint16_t>::value, "CompressedBVH supports 8 and 16-bit bounds");
+
+    public:
+        using Node = CompressedBVHNode<Q>;
+
+        static constexpr int stack_size = 128;
+        static constexpr int max_q = std::numeric_limits<Q>::max();
+
+        CompressedBVH(const Scene& scene, const BVHBuildOptions& options = BVHBuildOptions());
+        CompressedBVH(const Objects& objects, const BVHBuildOptions& options = BVHBuildOptions());
+
+        virtual bool hit(const Ray& ray, double t_min, double t_max, hit_record& record) const override;
+        virtual bool bounding_box(AABB& output_box) const override;
+
+        std::size_t node_count() const { return _nodes.size(); }
+        std::size_t memory_usage() const;
+
+    private:
+        // Box of a node, as decoded during traversal
+        struct Box {
+            float bounds[2][3];
+        };
+
+        // Children only decode from the min corner of their parent. Leaf entries only need
+        // their range, their box was tested when they were pushed.
+        struct StackEntry {
+            uint32_t index;
+            uint16_t count;
+            float distance;
+            float min[3];
+        };
+
+        uint32_t compress(const BVHBuildNode& node, const Box& box);
+
+        inline static float scale(int8_t exponent) {
+            // 2^exponent, built from its bits
+            uint32_t bits = static_cast<uint32_t>(exponent + 127) << 23;
+            float value;
+            std::memcpy(&value, &bits, sizeof(value));
+
+            return value;
+        }
+
+        inline static float decode(float min, float scale, int q) { return min + static_cast<float>(q) * scale; }
+
+        // Children of `node`, whose box starts at `min`
+        inline static void decode_children(const Node& node, const float* min, Box* children);
+
+        std::vector<Node> _nodes;
+        Objects _primitives;
+        Box _root_box;
+        AABB _bounds;
+};
+
+using CompressedBVH8 = CompressedBVH<uint8_t>;
+using CompressedBVH16 = CompressedBVH<uint16_t>;
+
+template <typename Q>
+CompressedBVH<Q>::CompressedBVH(const Scene& scene, const BVHBuildOptions& options) : CompressedBVH(scene.objects(), options) {}
+
+template <typename Q>
+CompressedBVH<Q>::CompressedBVH(const Objects& objects, const BVHBuildOptions& options) {
+    auto builder = BVHBuilder(objects, options);
+    auto root = builder.build();
+
+    if (!root)
+        return;
+
+    for (auto index : builder.ordered_indices())
+        _primitives.push_back(objects[index]);
+
+    _bounds = root->bounds;
+
+    for (int a = 0; a < 3; ++a) {
+        auto lo = static_cast<float>(_bounds.min()[a]);
+        auto hi = static_cast<float>(_bounds.max()[a]);
+        _root_box.bounds[0][a] = lo > _bounds.min()[a] ? std::nextafter(lo, -INFINITY) : lo;
+        _root_box.bounds[1][a] = hi < _bounds.max()[a] ? std::nextafter(hi, INFINITY) : hi;
+    }
+
+    // A single leaf still needs a node to live in, as both of its children
+    if (root->is_leaf()) {
+        auto wrapper = BVHBuildNode();
+        wrapper.bounds = root->bounds;
+        wrapper.children[1] = std::make_unique<BVHBuildNode>();
+        wrapper.children[1]->bounds = root->bounds;
+        wrapper.children[1]->first = root->first;
+        wrapper.children[1]->count = root->count;
+        wrapper.children[0] = std::move(root);
+        compress(wrapper, _root_box);
+    } else {
+        compress(*root, _root_box);
+    }
+
+    _nodes.shrink_to_fit();
+}
+
+template <typename Q>
+uint32_t CompressedBVH<Q>::compress(const BVHBuildNode& build_node, const Box& box) {
+    auto index = static_cast<uint32_t>(_nodes.size());
+    _nodes.emplace_back();
+
+    // Reference through the index, `_nodes` grows while the children are compressed
+    auto& node = _nodes[index];
+    node.axis = static_cast<uint8_t>(build_node.split_axis);
+
+    for (int a = 0; a < 3; ++a) {
+        // Smallest power of two step whose max_q steps cover the box
+        auto extent = static_cast<double>(box.bounds[1][a]) - box.bounds[0][a];
+        int exponent = -126;
+
+        if (extent > 0) {
+            std::frexp(extent / max_q, &exponent);
+            exponent = std::max(exponent, -126);
+        }
+
+        node.exponent[a] = static_cast<int8_t>(exponent);
+    }
+
+    Box child_boxes[2];
+
+    for (int c = 0; c < 2; ++c) {
+        const auto& child = *build_node.children[c];
+
+        for (int a = 0; a < 3; ++a) {
+            auto min = box.bounds[0][a];
+            auto step = scale(node.exponent[a]);
+
+            auto lo = static_cast<float>(child.bounds.min()[a]);
+            auto hi = static_cast<float>(child.bounds.max()[a]);
+            lo = lo > child.bounds.min()[a] ? std::nextafter(lo, -INFINITY) : lo;
+            hi = hi < child.bounds.max()[a] ? std::nextafter(hi, INFINITY) : hi;
+
+            // Estimate, then move outwards until the decoded value is conservative
+            auto q_lo = static_cast<int>(std::clamp(std::floor((static_cast<double>(lo) - min) / step), 0.0, double(max_q)));
+            auto q_hi = static_cast<int>(std::clamp(std::ceil((static_cast<double>(hi) - min) / step), 0.0, double(max_q)));
+
+            while (q_lo > 0 && decode(min, step, q_lo) > lo)
+                q_lo--;
+
+            while (q_hi < max_q && decode(min, step, q_hi) < hi)
+                q_hi++;
+
+            node.bounds[c][0][a] = static_cast<Q>(q_lo);
+            node.bounds[c][1][a] = static_cast<Q>(q_hi);
+            child_boxes[c].bounds[0][a] = decode(min, step, q_lo);
+            child_boxes[c].bounds[1][a] = decode(min, step, q_hi);
+        }
+
+        if (child.is_leaf()) {
+            node.children[c] = static_cast<uint32_t>(child.first);
+            node.count[c] = static_cast<uint16_t>(child.count);
+        } else {
+            node.count[c] = 0;
+        }
+    }
+
+    for (int c = 0; c < 2; ++c) {
+        const auto& child = *build_node.children[c];
+
+        if (!child.is_leaf()) {
+            auto child_index = compress(child, child_boxes[c]);
+            _nodes[index].children[c] = child_index;
+        }
+    }
+
+    return index;
+}
+
+template <typename Q>
+inline void CompressedBVH<Q>::decode_children(const Node& node, const float* min, Box* children) {
+    for (int a = 0; a < 3; ++a) {
+        auto step = scale(node.exponent[a]);
+
+        for (int c = 0; c < 2; ++c) {
+            children[c].bounds[0][a] = decode(min[a], step, node.bounds[c][0][a]);
+            children[c].bounds[1][a] = decode(min[a], step, node.bounds[c][1][a]);
+        }
+    }
+}
+
+template <typename Q>
+bool CompressedBVH<Q>::hit(const Ray& ray, double t_min, double t_max, hit_record& record) const {
+    if (_nodes.empty())
+        return false;
+
+    float origin[3];
+    float inv_direction[3];
+    int direction_is_negative[3];
+
+    for (int a = 0; a < 3; ++a) {
+        origin[a] = static_cast<float>(ray.origin()[a]);
+        inv_direction[a] = static_cast<float>(1.0 / ray.direction()[a]);
+        direction_is_negative[a] = inv_direction[a] < 0;
+    }
+
+    // Slabs are computed in single precision, pad the far distance to stay conservative
+    const float padding = 1 + 4 * std::numeric_limits<float>::epsilon();
+
+    StackEntry stack[stack_size];
+    int stack_top = 0;
+    auto current = StackEntry { 0, 0, static_cast<float>(t_min), { _root_box.bounds[0][0], _root_box.bounds[0][1], _root_box.bounds[0][2] } };
+
+    bool has_hit = false;
+    Box children[2];
+
+    while (true) {
+        if (current.count > 0) {
+            for (uint32_t i = current.index; i < current.index + current.count; ++i) {
+                if (_primitives[i]->hit(ray, t_min, t_max, record)) {
+                    has_hit = true;
+                    t_max = record.t;
+                }
+            }
+        } else {
+            const auto& node = _nodes[current.index];
+            decode_children(node, current.min, children);
+
+            float distances[2];
+            bool hits[2];
+
+            for (int c = 0; c < 2; ++c) {
+                auto near = static_cast<float>(t_min);
+                auto far = static_cast<float>(t_max);
+
+                for (int a = 0; a < 3; ++a) {
+                    auto t_lo = (children[c].bounds[0][a] - origin[a]) * inv_direction[a];
+                    auto t_hi = (children[c].bounds[1][a] - origin[a]) * inv_direction[a];
+                    auto t0 = direction_is_negative[a] ? t_hi : t_lo;
+                    auto t1 = (direction_is_negative[a] ? t_lo : t_hi) * padding;
+
+                    near = t0 > near ? t0 : near;
+                    far = t1 < far ? t1 : far;
+                }
+
+                distances[c] = near;
+                hits[c] = near <= far;
+            }
+
+            // Visit the child on the ray's side of the split plane first
+            int first = direction_is_negative[node.axis];
+            int second = 1 - first;
+
+            if (hits[first] || hits[second]) {
+                if (hits[first] && hits[second]) {
+                    const auto& min = children[second].bounds[0];
+                    stack[stack_top++] = { node.children[second], node.count[second], distances[second], { min[0], min[1], min[2] } };
+                }
+
+                int next = hits[first] ? first : second;
+                const auto& min = children[next].bounds[0];
+                current = { node.children[next], node.count[next], distances[next], { min[0], min[1], min[2] } };
+                continue;
+            }
+        }
+
+        // Skip the entries entered farther than the closest hit found since they were pushed
+        do {
+            if (stack_top == 0)
+                return has_hit;
+
+            current = stack[--stack_top];
+        } while (current.distance > t_max * padding);
+    }
+}
+
+template <typename Q>
+bool CompressedBVH<Q>::bounding_box(AABB& output_box) const {
+    if (_nodes.empty())
+        return false;
+
+    output_box = _bounds;
+
+    return true;
+}
+
+template <typename Q>
+std::size_t CompressedBVH<Q>::memory_usage() const {
+    return _nodes.size() * sizeof(Node) + _primitives.size() * sizeof(std::shared_ptr<Hittable>);
+}
@@ -0,0 +1,399 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <queue>
+#include <vector>
+
+#include "object/hittable.h"
+#include "object/aabb.h"
+#include "object/bvh_types.h"
+#include "scene/scene.h"
+#include "utils/timer.h"
+
+struct DynamicBVHNode {
+    static constexpr uint32_t null = std::numeric_limits<uint32_t>::max();
+
+    AABB bounds;
+    uint32_t parent = null;
+    uint32_t children[2] = { null, null };
+    // Leaves hold one object, interior and free nodes none
+    std::shared_ptr<Hittable> object;
+    // 0 for leaves
+    uint32_t height = 0;
+    // Free nodes only: the next one of the free list
+    uint32_t next_free = null;
+
+    inline bool is_leaf() const { return children[0] == null; }
+    inline bool is_free() const { return children[0] == null && !object; }
+};
+
+// Latency of the edits applied since construction, in seconds
+struct DynamicBVHEditStats {
+    std::size_t insert_count = 0;
+    std::size_t remove_count = 0;
+    std::size_t rotation_count = 0;
+    double total_insert_time = 0;
+    double total_remove_time = 0;
+    double max_insert_time = 0;
+    double max_remove_time = 0;
+    double last_edit_time = 0;
+};
+
+// BVH edited in place, one object per leaf. Inserting searches the sibling of least SAH cost
+// (branch and bound, Bittner et al. "Fast Insertion-Based Optimization of Bounding Volume
+// Hierarchies") and removing replaces the parent by the sibling. Both then refit the ancestors
+// and rotate them (Kopta et al. "Fast, Effective BVH Updates for Animated Scenes") to keep the
+// tree close to a SAH build, so an edit costs about the depth of the tree.
+// Edits are not thread-safe and must not run concurrently with hit().
+class DynamicBVH: public Hittable {
+    public:
+        using Handle = uint32_t;
+
+        static constexpr int stack_size = 64;
+
+        DynamicBVH() {}
+        DynamicBVH(const Scene& scene) : DynamicBVH(scene.objects()) {}
+        DynamicBVH(const Objects& objects);
+
+        // Returns the handle to remove the object with
+        Handle insert(std::shared_ptr<Hittable> object);
+        // Returns false, leaving the tree as it is, when the handle is not a leaf in the tree (already
+        // removed, or never returned by insert). A handle removed then reused by a later insert
+        // refers to the new object.
+        bool remove(Handle handle);
+
+        std::size_t size() const { return _size; }
+
+        virtual bool hit(const Ray& ray, double t_min, double t_max, hit_record& record) const override;
+        virtual bool bounding_box(AABB& output_box) const override;
+
+        BVHStats stats(double traversal_cost = 1.0, double intersection_cost = 1.0) const;
+        const DynamicBVHEditStats& edit_stats() const { return _edit_stats; }
+        void reset_edit_stats() { _edit_stats = DynamicBVHEditStats(); }
+
+    private:
+        uint32_t allocate_node();
+        void free_node(uint32_t index);
+
+        uint32_t find_best_sibling(const AABB& bounds) const;
+        // Refits and rotates every node from `index` up to the root
+        void refit_ancestors(uint32_t index);
+        void rotate(uint32_t index);
+        void replace_child(uint32_t parent, uint32_t old_child, uint32_t new_child);
+
+        std::vector<DynamicBVHNode> _nodes;
+        uint32_t _root = DynamicBVHNode::null;
+        uint32_t _free_list = DynamicBVHNode::null;
+        std::size_t _size = 0;
+        DynamicBVHEditStats _edit_stats;
+};
+
+DynamicBVH::DynamicBVH(const Objects& objects) {
+    _nodes.reserve(2 * objects.size());
+
+    for (const auto& object : objects)
+        insert(object);
+}
+
+uint32_t DynamicBVH::allocate_node() {
+    if (_free_list == DynamicBVHNode::null) {
+        _nodes.emplace_back();
+        return static_cast<uint32_t>(_nodes.size() - 1);
+    }
+
+    auto index = _free_list;
+    _free_list = _nodes[index].next_free;
+    _nodes[index] = DynamicBVHNode();
+
+    return index;
+}
+
+void DynamicBVH::free_node(uint32_t index) {
+    _nodes[index] = DynamicBVHNode();
+    _nodes[index].next_free = _free_list;
+    _free_list = index;
+}
+
+DynamicBVH::Handle DynamicBVH::insert(std::shared_ptr<Hittable> object) {
+    auto timer = Timer();
+
+    AABB bounds;
+
+    if (!object->bounding_box(bounds))
+        std::cerr << "No bounding box in dynamic bvh insert.\n";
+
+    auto leaf = allocate_node();
+    _nodes[leaf].bounds = bounds;
+    _nodes[leaf].object = object;
+    _size++;
+
+    if (_root == DynamicBVHNode::null) {
+        _root = leaf;
+    } else {
+        auto sibling = find_best_sibling(bounds);
+        auto old_parent = _nodes[sibling].parent;
+        auto parent = allocate_node();
+
+        _nodes[parent].parent = old_parent;
+        _nodes[parent].children[0] = sibling;
+        _nodes[parent].children[1] = leaf;
+        _nodes[sibling].parent = parent;
+        _nodes[leaf].parent = parent;
+
+        if (old_parent == DynamicBVHNode::null)
+            _root = parent;
+        else
+            replace_child(old_parent, sibling, parent);
+
+        refit_ancestors(parent);
+    }
+
+    auto time = timer.elapsed();
+    _edit_stats.insert_count++;
+    _edit_stats.total_insert_time += time;
+    _edit_stats.max_insert_time = std::max(_edit_stats.max_insert_time, time);
+    _edit_stats.last_edit_time = time;
+
+    return leaf;
+}
+
+bool DynamicBVH::remove(Handle leaf) {
+    if (leaf >= _nodes.size() || !_nodes[leaf].is_leaf() || _nodes[leaf].is_free()) {
+        std::cerr << "Invalid handle in dynamic bvh remove.\n";
+        return false;
+    }
+
+    auto timer = Timer();
+
+    auto parent = _nodes[leaf].parent;
+    free_node(leaf);
+    _size--;
+
+    if (parent == DynamicBVHNode::null) {
+        _root = DynamicBVHNode::null;
+    } else {
+        // The sibling takes the place of the parent
+        auto sibling = _nodes[parent].children[_nodes[parent].children[0] == leaf ? 1 : 0];
+        auto grand_parent = _nodes[parent].parent;
+
+        _nodes[sibling].parent = grand_parent;
+        free_node(parent);
+
+        if (grand_parent == DynamicBVHNode::null) {
+            _root = sibling;
+        } else {
+            replace_child(grand_parent, parent, sibling);
+            refit_ancestors(grand_parent);
+        }
+    }
+
+    auto time = timer.elapsed();
+    _edit_stats.remove_count++;
+    _edit_stats.total_remove_time += time;
+    _edit_stats.max_remove_time = std::max(_edit_stats.max_remove_time, time);
+    _edit_stats.last_edit_time = time;
+
+    return true;
+}
+
+void DynamicBVH::replace_child(uint32_t parent, uint32_t old_child, uint32_t new_child) {
+    auto& node = _nodes[parent];
+    node.children[node.children[0] == old_child ? 0 : 1] = new_child;
+}
+
+uint32_t DynamicBVH::find_best_sibling(const AABB& bounds) const {
+    auto area = bounds.surface_area();
+
+    // Making a node the sibling costs the area of the new parent, plus the area every ancestor grows by
+    struct Candidate {
+        uint32_t index;
+        double inherited_cost;
+
+        bool operator<(const Candidate& other) const { return inherited_cost > other.inherited_cost; }
+    };
+
+    std::priority_queue<Candidate> queue;
+    queue.push({ _root, 0 });
+
+    auto best = _root;
+    auto best_cost = infinity;
+
+    while (!queue.empty()) {
+        auto candidate = queue.top();
+        queue.pop();
+
+        // Every candidate left costs at least the new leaf area on top of its inherited cost
+        if (candidate.inherited_cost + area >= best_cost)
+            break;
+
+        const auto& node = _nodes[candidate.index];
+        auto union_area = AABB::surrounding_box(node.bounds, bounds).surface_area();
+        auto cost = union_area + candidate.inherited_cost;
+
+        if (cost < best_cost) {
+            best_cost = cost;
+            best = candidate.index;
+        }
+
+        if (!node.is_leaf()) {
+            auto inherited_cost = candidate.inherited_cost + union_area - node.bounds.surface_area();
+
+            if (inherited_cost + area < best_cost) {
+                queue.push({ node.children[0], inherited_cost });
+                queue.push({ node.children[1], inherited_cost });
+            }
+        }
+    }
+
+    return best;
+}
+
+void DynamicBVH::refit_ancestors(uint32_t index) {
+    while (index != DynamicBVHNode::null) {
+        rotate(index);
+
+        auto& node = _nodes[index];
+        const auto& left = _nodes[node.children[0]];
+        const auto& right = _nodes[node.children[1]];
+
+        node.bounds = AABB::surrounding_box(left.bounds, right.bounds);
+        node.height = 1 + std::max(left.height, right.height);
+
+        index = node.parent;
+    }
+}
+
+// Swaps a child of the node with a grandchild on the other side when it shrinks the child it moves into
+void DynamicBVH::rotate(uint32_t index) {
+    auto& node = _nodes[index];
+
+    uint32_t best_child = DynamicBVHNode::null;
+    uint32_t best_grandchild = DynamicBVHNode::null;
+    double best_gain = 0;
+
+    for (int side = 0; side < 2; ++side) {
+        auto child = node.children[side];
+        auto other = node.children[1 - side];
+        const auto& other_node = _nodes[other];
+
+        if (other_node.is_leaf())
+            continue;
+
+        auto other_area = other_node.bounds.surface_area();
+
+        for (int k = 0; k < 2; ++k) {
+            // `child` takes the place of the grandchild under `other`, next to the remaining grandchild
+            auto kept = other_node.children[1 - k];
+            auto gain = other_area - AABB::surrounding_box(_nodes[child].bounds, _nodes[kept].bounds).surface_area();
+
+            if (gain > best_gain) {
+                best_gain = gain;
+                best_child = child;
+                best_grandchild = other_node.children[k];
+            }
+        }
+    }
+
+    if (best_child == DynamicBVHNode::null)
+        return;
+
+    auto other = _nodes[best_grandchild].parent;
+
+    replace_child(index, best_child, best_grandchild);
+    replace_child(other, best_grandchild, best_child);
+    _nodes[best_grandchild].parent = index;
+    _nodes[best_child].parent = other;
+
+    auto& other_node = _nodes[other];
+    const auto& left = _nodes[other_node.children[0]];
+    const auto& right = _nodes[other_node.children[1]];
+    other_node.bounds = AABB::surrounding_box(left.bounds, right.bounds);
+    other_node.height = 1 + std::max(left.height, right.height);
+
+    _edit_stats.rotation_count++;
+}
+
+bool DynamicBVH::hit(const Ray& ray, double t_min, double t_max, hit_record& record) const {
+    if (_root == DynamicBVHNode::null)
+        return false;
+
+    // The stack never holds more than height + 1 nodes, edits keep the tree shallow but do not bound its height
+    uint32_t fixed_stack[stack_size];
+    std::vector<uint32_t> large_stack;
+    auto stack = fixed_stack;
+
+    if (_nodes[_root].height >= stack_size) {
+        large_stack.resize(_nodes[_root].height + 1);
+        stack = large_stack.data();
+    }
+
+    int stack_top = 0;
+    stack[stack_top++] = _root;
+
+    bool has_hit = false;
+
+    while (stack_top > 0) {
+        const auto& node = _nodes[stack[--stack_top]];
+
+        if (!node.bounds.hit(ray, t_min, t_max))
+            continue;
+
+        if (node.is_leaf()) {
+            if (node.object->hit(ray, t_min, t_max, record)) {
+                has_hit = true;
+                t_max = record.t;
+            }
+        } else {
+            stack[stack_top++] = node.children[1];
+            stack[stack_top++] = node.children[0];
+        }
+    }
+
+    return has_hit;
+}
+
+bool DynamicBVH::bounding_box(AABB& output_box) const {
+    if (_root == DynamicBVHNode::null)
+        return false;
+
+    output_box = _nodes[_root].bounds;
+
+    return true;
+}
+
+BVHStats DynamicBVH::stats(double traversal_cost, double intersection_cost) const {
+    BVHStats stats;
+
+    if (_root == DynamicBVHNode::null)
+        return stats;
+
+    std::vector<std::pair<uint32_t, std::size_t>> stack = { { _root, 1 } };
+
+    while (!stack.empty()) {
+        auto [index, depth] = stack.back();
+        stack.pop_back();
+
+        const auto& node = _nodes[index];
+
+        stats.node_count++;
+        stats.max_depth = std::max(stats.max_depth, depth);
+
+        if (node.is_leaf()) {
+            stats.leaf_count++;
+            stats.sah_cost += node.bounds.surface_area() * intersection_cost;
+        } else {
+            stats.sah_cost += node.bounds.surface_area() * traversal_cost;
+            stack.push_back({ node.children[0], depth + 1 });
+            stack.push_back({ node.children[1], depth + 1 });
+        }
+    }
+
+    auto root_area = _nodes[_root].bounds.surface_area();
+    stats.sah_cost = root_area > 0 ? stats.sah_cost / root_area : 0;
+
+    return stats;
+}
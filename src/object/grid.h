@@ -0,0 +1,416 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "object/hittable.h"
+#include "object/aabb.h"
+#include "scene/scene.h"
+#include "utils/thread_pool.h"
+#include "utils/timer.h"
+
+struct GridBuildOptions {
+    // Cells per primitive, the resolution follows the primitive density
+    double density = 1.0;
+    int max_resolution = 512;
+    // Primitives wider than this fraction of the scene along an axis (a ground sphere) would fill
+    // most cells, they are tested on their own instead
+    double large_primitive_fraction = 0.25;
+    // Two-level grid: cells holding more than `subgrid_threshold` primitives get a grid of their own
+    bool two_level = false;
+    std::size_t subgrid_threshold = 16;
+    int max_subgrid_resolution = 16;
+    // Build threads, 0 means one per hardware thread. The grid does not depend on it.
+    std::size_t thread_count = 0;
+};
+
+struct GridStats {
+    int resolution[3] = { 0, 0, 0 };
+    std::size_t cell_count = 0;
+    std::size_t empty_cell_count = 0;
+    // Primitive references held by the cells, subgrids included
+    std::size_t reference_count = 0;
+    std::size_t max_cell_size = 0;
+    std::size_t subgrid_count = 0;
+    std::size_t large_primitive_count = 0;
+    // Seconds
+    double build_time = 0;
+};
+
+// Uniform grid over the primitives, with an optional second level for the crowded cells. The build
+// is two linear passes (count the references of each cell, then place them) run over all threads,
+// traversal walks the cells along the ray with a 3D-DDA (Amanatides and Woo, "A Fast Voxel
+// Traversal Algorithm for Ray Tracing") and stops at the first cell holding a hit.
+class Grid: public Hittable {
+    public:
+        Grid(const Scene& scene, const GridBuildOptions& options = GridBuildOptions());
+        Grid(const Objects& objects, const GridBuildOptions& options = GridBuildOptions());
+
+        virtual bool hit(const Ray& ray, double t_min, double t_max, hit_record& record) const override;
+        virtual bool bounding_box(AABB& output_box) const override;
+
+        const GridStats& stats() const { return _stats; }
+        std::size_t memory_usage() const;
+
+    private:
+        struct Level {
+            AABB bounds;
+            int resolution[3];
+            double cell_size[3];
+            double inv_cell_size[3];
+            // References of cell c are [offsets[c], offsets[c + 1])
+            std::vector<uint32_t> offsets;
+            std::vector<uint32_t> references;
+            // Top level only: subgrid of each cell, -1 if none
+            std::vector<int32_t> subgrids;
+
+            inline std::size_t cell_count() const { return static_cast<std::size_t>(resolution[0]) * resolution[1] * resolution[2]; }
+            inline std::size_t cell_index(int x, int y, int z) const { return (static_cast<std::size_t>(z) * resolution[1] + y) * resolution[0] + x; }
+        };
+
+        void build_level(Level& level, const AABB& bounds, const std::vector<uint32_t>& primitives, int max_resolution, ThreadPool* pool) const;
+        // Cells overlapped by the box, clamped to the level
+        void cell_range(const Level& level, const AABB& box, int* first, int* last) const;
+        // Walks the cells of `level` the ray crosses between `t_enter` and `t_exit`
+        bool traverse(const Level& level, const Ray& ray, double t_min, double t_enter, double t_exit, double& closest, hit_record& record) const;
+
+        Objects _primitives;
+        std::vector<AABB> _primitive_bounds;
+        std::vector<uint32_t> _large_primitives;
+        Level _top;
+        std::vector<Level> _subgrids;
+        AABB _bounds;
+        bool _has_bounds = false;
+        GridBuildOptions _options;
+        GridStats _stats;
+};
+
+Grid::Grid(const Scene& scene, const GridBuildOptions& options) : Grid(scene.objects(), options) {}
+
+Grid::Grid(const Objects& objects, const GridBuildOptions& options) : _primitives(objects), _options(options) {
+    auto timer = Timer();
+
+    _primitive_bounds.resize(objects.size());
+    _bounds = AABB::empty();
+
+    std::vector<uint32_t> bounded;
+
+    for (std::size_t i = 0; i < objects.size(); ++i) {
+        if (!objects[i]->bounding_box(_primitive_bounds[i])) {
+            std::cerr << "No bounding box in grid constructor.\n";
+            continue;
+        }
+
+        bounded.push_back(static_cast<uint32_t>(i));
+        _bounds = AABB::surrounding_box(_bounds, _primitive_bounds[i]);
+    }
+
+    _has_bounds = !bounded.empty();
+
+    if (!_has_bounds)
+        return;
+
+    // The grid only covers the primitives of ordinary size
+    auto extent = _bounds.max() - _bounds.min();
+    auto grid_bounds = AABB::empty();
+    std::vector<uint32_t> gridded;
+
+    for (auto index : bounded) {
+        auto size = _primitive_bounds[index].max() - _primitive_bounds[index].min();
+        bool large = false;
+
+        for (int a = 0; a < 3; ++a)
+            large = large || (bounded.size() > 1 && size[a] > _options.large_primitive_fraction * extent[a]);
+
+        if (large) {
+            _large_primitives.push_back(index);
+        } else {
+            gridded.push_back(index);
+            grid_bounds = AABB::surrounding_box(grid_bounds, _primitive_bounds[index]);
+        }
+    }
+
+    auto thread_count = _options.thread_count == 0 ? ThreadPool::hardware_threads() : _options.thread_count;
+    auto pool = thread_count > 1 ? std::make_unique<ThreadPool>(thread_count) : nullptr;
+
+    if (!gridded.empty())
+        build_level(_top, grid_bounds, gridded, _options.max_resolution, pool.get());
+
+    // Second level for the crowded cells
+    if (_options.two_level && !gridded.empty()) {
+        std::vector<std::size_t> crowded;
+        _top.subgrids.assign(_top.cell_count(), -1);
+
+        for (std::size_t cell = 0; cell < _top.cell_count(); ++cell) {
+            if (_top.offsets[cell + 1] - _top.offsets[cell] > _options.subgrid_threshold) {
+                _top.subgrids[cell] = static_cast<int32_t>(crowded.size());
+                crowded.push_back(cell);
+            }
+        }
+
+        _subgrids.resize(crowded.size());
+
+        auto build_subgrid = [&](std::size_t k) {
+            auto cell = crowded[k];
+            int x = static_cast<int>(cell % _top.resolution[0]);
+            int y = static_cast<int>(cell / _top.resolution[0] % _top.resolution[1]);
+            int z = static_cast<int>(cell / _top.resolution[0] / _top.resolution[1]);
+
+            auto min = _top.bounds.min() + Vector3(x * _top.cell_size[0], y * _top.cell_size[1], z * _top.cell_size[2]);
+            auto max = min + Vector3(_top.cell_size[0], _top.cell_size[1], _top.cell_size[2]);
+
+            auto primitives = std::vector<uint32_t>(_top.references.begin() + _top.offsets[cell], _top.references.begin() + _top.offsets[cell + 1]);
+            build_level(_subgrids[k], AABB(min, max), primitives, _options.max_subgrid_resolution, nullptr);
+        };
+
+        if (pool) {
+            pool->parallel_for(0, crowded.size(), 64, [&](std::size_t start, std::size_t end) {
+                for (auto k = start; k < end; ++k)
+                    build_subgrid(k);
+            });
+        } else {
+            for (std::size_t k = 0; k < crowded.size(); ++k)
+                build_subgrid(k);
+        }
+    }
+
+    for (int a = 0; a < 3; ++a)
+        _stats.resolution[a] = _top.resolution[a];
+
+    _stats.large_primitive_count = _large_primitives.size();
+    _stats.subgrid_count = _subgrids.size();
+
+    auto count_cells = [this](const Level& level) {
+        _stats.cell_count += level.cell_count();
+        _stats.reference_count += level.references.size();
+
+        for (std::size_t cell = 0; cell < level.cell_count(); ++cell) {
+            std::size_t size = level.offsets[cell + 1] - level.offsets[cell];
+            _stats.empty_cell_count += size == 0;
+            _stats.max_cell_size = std::max(_stats.max_cell_size, size);
+        }
+    };
+
+    if (!gridded.empty())
+        count_cells(_top);
+
+    for (const auto& level : _subgrids)
+        count_cells(level);
+
+    _stats.build_time = timer.elapsed();
+}
+
+void Grid::cell_range(const Level& level, const AABB& box, int* first, int* last) const {
+    for (int a = 0; a < 3; ++a) {
+        auto lo = static_cast<int>(std::floor((box.min()[a] - level.bounds.min()[a]) * level.inv_cell_size[a]));
+        auto hi = static_cast<int>(std::floor((box.max()[a] - level.bounds.min()[a]) * level.inv_cell_size[a]));
+        first[a] = std::clamp(lo, 0, level.resolution[a] - 1);
+        last[a] = std::clamp(hi, 0, level.resolution[a] - 1);
+    }
+}
+
+void Grid::build_level(Level& level, const AABB& bounds, const std::vector<uint32_t>& primitives, int max_resolution, ThreadPool* pool) const {
+    level.bounds = bounds;
+
+    // About `density` cells per primitive, cubic when the bounds allow it. Flat axes count as a
+    // thousandth of the largest one so that the volume stays positive.
+    auto extent = bounds.max() - bounds.min();
+    auto largest = std::max({ extent.x(), extent.y(), extent.z() });
+    auto volume = 1.0;
+
+    for (int a = 0; a < 3; ++a)
+        volume *= std::max(extent[a], 1e-3 * largest);
+
+    auto cells_per_unit = volume > 0 ? std::cbrt(_options.density * primitives.size() / volume) : 0;
+
+    for (int a = 0; a < 3; ++a) {
+        level.resolution[a] = std::clamp(static_cast<int>(std::round(extent[a] * cells_per_unit)), 1, max_resolution);
+        level.cell_size[a] = extent[a] / level.resolution[a];
+        level.inv_cell_size[a] = level.cell_size[a] > 0 ? 1 / level.cell_size[a] : 0;
+    }
+
+    auto cell_count = level.cell_count();
+    auto counts = std::unique_ptr<std::atomic<uint32_t>[]>(new std::atomic<uint32_t>[cell_count]());
+    const std::size_t grain = 4096;
+
+    auto run = [pool, grain](std::size_t end, const std::function<void(std::size_t, std::size_t)>& fn) {
+        if (pool)
+            pool->parallel_for(0, end, grain, fn);
+        else
+            fn(0, end);
+    };
+
+    // Pass 1: references per cell
+    run(primitives.size(), [&](std::size_t start, std::size_t end) {
+        int first[3], last[3];
+
+        for (auto i = start; i < end; ++i) {
+            cell_range(level, _primitive_bounds[primitives[i]], first, last);
+
+            for (int z = first[2]; z <= last[2]; ++z)
+                for (int y = first[1]; y <= last[1]; ++y)
+                    for (int x = first[0]; x <= last[0]; ++x)
+                        counts[level.cell_index(x, y, z)].fetch_add(1, std::memory_order_relaxed);
+        }
+    });
+
+    level.offsets.resize(cell_count + 1);
+    level.offsets[0] = 0;
+
+    for (std::size_t cell = 0; cell < cell_count; ++cell) {
+        level.offsets[cell + 1] = level.offsets[cell] + counts[cell].load(std::memory_order_relaxed);
+        // Reused as the insertion cursor of the cell
+        counts[cell].store(level.offsets[cell], std::memory_order_relaxed);
+    }
+
+    // Pass 2: place the references
+    level.references.resize(level.offsets[cell_count]);
+
+    run(primitives.size(), [&](std::size_t start, std::size_t end) {
+        int first[3], last[3];
+
+        for (auto i = start; i < end; ++i) {
+            cell_range(level, _primitive_bounds[primitives[i]], first, last);
+
+            for (int z = first[2]; z <= last[2]; ++z)
+                for (int y = first[1]; y <= last[1]; ++y)
+                    for (int x = first[0]; x <= last[0]; ++x)
+                        level.references[counts[level.cell_index(x, y, z)].fetch_add(1, std::memory_order_relaxed)] = primitives[i];
+        }
+    });
+
+    // Threads placed the references in any order, sorting keeps the grid deterministic
+    run(cell_count, [&](std::size_t start, std::size_t end) {
+        for (auto cell = start; cell < end; ++cell)
+            std::sort(level.references.begin() + level.offsets[cell], level.references.begin() + level.offsets[cell + 1]);
+    });
+}
+
+bool Grid::traverse(const Level& level, const Ray& ray, double t_min, double t_enter, double t_exit, double& closest, hit_record& record) const {
+    const auto& origin = ray.origin();
+    const auto& direction = ray.direction();
+
+    // Cell holding the entry point, then the distance to its next boundary along each axis
+    auto entry = ray.position(t_enter);
+    int cell[3], step[3], out[3];
+    double next[3], delta[3];
+
+    for (int a = 0; a < 3; ++a) {
+        cell[a] = std::clamp(static_cast<int>(std::floor((entry[a] - level.bounds.min()[a]) * level.inv_cell_size[a])), 0, level.resolution[a] - 1);
+
+        if (direction[a] > 0) {
+            step[a] = 1;
+            out[a] = level.resolution[a];
+            next[a] = (level.bounds.min()[a] + (cell[a] + 1) * level.cell_size[a] - origin[a]) / direction[a];
+            delta[a] = level.cell_size[a] / direction[a];
+        } else if (direction[a] < 0) {
+            step[a] = -1;
+            out[a] = -1;
+            next[a] = (level.bounds.min()[a] + cell[a] * level.cell_size[a] - origin[a]) / direction[a];
+            delta[a] = -level.cell_size[a] / direction[a];
+        } else {
+            step[a] = 0;
+            out[a] = -1;
+            next[a] = infinity;
+            delta[a] = infinity;
+        }
+    }
+
+    bool has_hit = false;
+    auto t = t_enter;
+
+    while (t <= t_exit && t <= closest) {
+        int axis = next[0] < next[1] ? (next[0] < next[2] ? 0 : 2) : (next[1] < next[2] ? 1 : 2);
+        auto cell_exit = std::min(next[axis], t_exit);
+        auto index = level.cell_index(cell[0], cell[1], cell[2]);
+
+        if (!level.subgrids.empty() && level.subgrids[index] >= 0) {
+            has_hit = traverse(_subgrids[level.subgrids[index]], ray, t_min, t, cell_exit, closest, record) || has_hit;
+        } else {
+            for (auto i = level.offsets[index]; i < level.offsets[index + 1]; ++i) {
+                if (_primitives[level.references[i]]->hit(ray, t_min, closest, record)) {
+                    has_hit = true;
+                    closest = record.t;
+                }
+            }
+        }
+
+        // Later cells are all farther than a hit inside this one
+        if (has_hit && closest <= cell_exit)
+            break;
+
+        cell[axis] += step[axis];
+
+        if (cell[axis] == out[axis])
+            break;
+
+        t = next[axis];
+        next[axis] += delta[axis];
+    }
+
+    return has_hit;
+}
+
+bool Grid::hit(const Ray& ray, double t_min, double t_max, hit_record& record) const {
+    if (!_has_bounds)
+        return false;
+
+    bool has_hit = false;
+    auto closest = t_max;
+
+    for (auto index : _large_primitives) {
+        if (_primitives[index]->hit(ray, t_min, closest, record)) {
+            has_hit = true;
+            closest = record.t;
+        }
+    }
+
+    if (_top.offsets.empty())
+        return has_hit;
+
+    // Interval of the ray inside the grid
+    auto t_enter = t_min;
+    auto t_exit = closest;
+
+    for (int a = 0; a < 3; ++a) {
+        auto inv_direction = 1.0 / ray.direction()[a];
+        auto t0 = (_top.bounds.min()[a] - ray.origin()[a]) * inv_direction;
+        auto t1 = (_top.bounds.max()[a] - ray.origin()[a]) * inv_direction;
+
+        if (inv_direction < 0)
+            std::swap(t0, t1);
+
+        t_enter = t0 > t_enter ? t0 : t_enter;
+        t_exit = t1 < t_exit ? t1 : t_exit;
+
+        if (t_exit < t_enter)
+            return has_hit;
+    }
+
+    return traverse(_top, ray, t_min, t_enter, t_exit, closest, record) || has_hit;
+}
+
+bool Grid::bounding_box(AABB& output_box) const {
+    output_box = _bounds;
+
+    return _has_bounds;
+}
+
+std::size_t Grid::memory_usage() const {
+    auto level_memory = [](const Level& level) {
+        return (level.offsets.size() + level.references.size()) * sizeof(uint32_t) + level.subgrids.size() * sizeof(int32_t);
+    };
+
+    auto memory = level_memory(_top) + _primitive_bounds.size() * sizeof(AABB) + _large_primitives.size() * sizeof(uint32_t)
+        + _primitives.size() * sizeof(std::shared_ptr<Hittable>);
+
+    for (const auto& level : _subgrids)
+        memory += sizeof(Level) + level_memory(level);
+
+    return memory;
+}
@@ -1,18 +1,27 @@
 #pragma once
 
+#include <cstdint>
 #include <memory>
 
 #include "object/ray.h"
 #include "object/aabb.h"
 #include "utils/vector3.h"
 #include "material/material.h"
+#include "utils/hash.h"
+
+class Hittable;
 
 struct hit_record {
     Point3D point;
     Vector3 normal;
     double t;
     bool front_face;
-    std::shared_ptr<Material> material;
+    MaterialId material;
+    // Set by intersect(): the object to compute the surface with, and the primitive hit within it for
+    // objects holding several. Objects whose surface needs them also store parametric coordinates
+    const Hittable* object = nullptr;
+    uint32_t primitive = 0;
+    double u = 0, v = 0;
 
     inline void set_face_normal(const Ray& ray, const Vector3& outward_normal) {
         front_face = Vector3::dot_product(ray.direction(), outward_normal) < 0;
@@ -24,4 +33,52 @@ class Hittable {
     public:
         virtual bool hit(const Ray& ray, double t_min, double t_max, hit_record& record) const = 0;
         virtual bool bounding_box(AABB& output_box) const = 0;
+
+        // Closest hit without the surface attributes: only t and object are always filled, along with
+        // whatever compute_surface() reads back, such as a triangle's u and v. Accelerators
+        // traverse with it and call compute_surface() once, on the final hit. The default runs the
+        // full hit(), there is nothing left to compute afterwards.
+        virtual bool intersect(const Ray& ray, double t_min, double t_max, hit_record& record) const {
+            if (!hit(ray, t_min, t_max, record))
+                return false;
+
+            record.object = this;
+
+            return true;
+        }
+
+        // Fills the point, normal and material of a hit found by intersect()
+        virtual void compute_surface(const Ray& ray, hit_record& record) const {}
+
+        // Whether anything is hit between t_min and t_max, for shadow and visibility rays. Overrides
+        // stop at the first hit found and skip the surface attributes.
+        virtual bool occluded(const Ray& ray, double t_min, double t_max) const {
+            hit_record record;
+
+            return hit(ray, t_min, t_max, record);
+        }
+
+        // Bounds of the part of the object inside `box`, false if there is none. Used by the
+        // spatial split builder; the default clips the bounding box, primitives can do better.
+        virtual bool clip_bounds(const AABB& box, AABB& output_box) const {
+            if (!bounding_box(output_box))
+                return false;
+
+            output_box = AABB::intersection(output_box, box);
+
+            return !output_box.is_empty();
+        }
+
+        // Adds what the builders see of the object to a BVHCache key: its bounding box by default.
+        // Objects whose clip_bounds() depends on more than their box add that too.
+        virtual void hash_geometry(Hasher& hasher) const {
+            AABB box;
+            bool has_box = bounding_box(box);
+            hasher.add(has_box);
+
+            for (int a = 0; a < 3; ++a) {
+                hasher.add(has_box ? box.min()[a] : 0.0);
+                hasher.add(has_box ? box.max()[a] : 0.0);
+            }
+        }
 };
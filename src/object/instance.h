@@ -0,0 +1,83 @@
+#pragma once
+
+#include <memory>
+
+#include "object/hittable.h"
+#include "object/aabb.h"
+#include "utils/transform.h"
+
+// Places a shared object (usually a bottom-level BVH) in the world with an affine transform.
+// Instances only own their transforms, the geometry is shared, so a top-level BVH built over
+// instances costs memory per unique object rather than per copy.
+class Instance: public Hittable {
+    public:
+        Instance(std::shared_ptr<Hittable> object, const Transform& object_to_world);
+
+        virtual bool hit(const Ray& ray, double t_min, double t_max, hit_record& record) const override;
+        virtual bool occluded(const Ray& ray, double t_min, double t_max) const override;
+        virtual bool bounding_box(AABB& output_box) const override;
+
+        const std::shared_ptr<Hittable>& object() const { return _object; }
+        const Transform& object_to_world() const { return _object_to_world; }
+
+    private:
+        std::shared_ptr<Hittable> _object;
+        Transform _object_to_world;
+        Transform _world_to_object;
+        AABB _bounds;
+        bool _has_bounds;
+};
+
+Instance::Instance(std::shared_ptr<Hittable> object, const Transform& object_to_world)
+    : _object(object), _object_to_world(object_to_world), _world_to_object(object_to_world.inverse()) {
+    AABB box;
+    _has_bounds = _object->bounding_box(box);
+
+    if (!_has_bounds)
+        return;
+
+    // Bounds of the 8 transformed corners
+    _bounds = AABB::empty();
+
+    for (int corner = 0; corner < 8; ++corner) {
+        auto p = Point3D(
+            (corner & 1 ? box.max() : box.min()).x(),
+            (corner & 2 ? box.max() : box.min()).y(),
+            (corner & 4 ? box.max() : box.min()).z()
+        );
+
+        _bounds = AABB::surrounding_box(_bounds, _object_to_world.point(p));
+    }
+}
+
+bool Instance::hit(const Ray& ray, double t_min, double t_max, hit_record& record) const {
+    auto direction = _world_to_object.vector(ray.direction());
+    auto scale = direction.length();
+
+    // Objects expect unit directions, distances along the object ray are `scale` times longer
+    auto object_ray = Ray(_world_to_object.point(ray.origin()), direction / scale);
+
+    if (!_object->hit(object_ray, t_min * scale, t_max * scale, record))
+        return false;
+
+    record.t /= scale;
+    record.point = ray.position(record.t);
+    // The inverse transpose keeps the side of the surface, so front_face stays valid
+    record.normal = _world_to_object.normal(record.normal).unit_vector();
+
+    return true;
+}
+
+bool Instance::occluded(const Ray& ray, double t_min, double t_max) const {
+    auto direction = _world_to_object.vector(ray.direction());
+    auto scale = direction.length();
+    auto object_ray = Ray(_world_to_object.point(ray.origin()), direction / scale);
+
+    return _object->occluded(object_ray, t_min * scale, t_max * scale);
+}
+
+bool Instance::bounding_box(AABB& output_box) const {
+    output_box = _bounds;
+
+    return _has_bounds;
+}
@@ -0,0 +1,405 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "object/hittable.h"
+#include "object/aabb.h"
+#include "scene/scene.h"
+#include "utils/timer.h"
+
+struct KdTreeBuildOptions {
+    // SAH costs of visiting a node and of intersecting one primitive
+    double traversal_cost = 1.0;
+    double intersection_cost = 1.5;
+    // Fraction of the cost saved when one side of a split is empty
+    double empty_bonus = 0.5;
+    // A node is always split while it holds more references than this
+    std::size_t max_leaf_size = 1;
+    // 0 picks 8 + 1.3 log2(primitive count), at most stack_size - 1
+    int max_depth = 0;
+    // Clips the primitives to each node (perfect splits), otherwise their whole bounds are used
+    bool clip_primitives = true;
+};
+
+struct KdTreeStats {
+    std::size_t node_count = 0;
+    std::size_t leaf_count = 0;
+    std::size_t empty_leaf_count = 0;
+    std::size_t max_depth = 0;
+    // Primitive references held by the leaves, a primitive straddling a split is in both children
+    std::size_t reference_count = 0;
+    // Expected cost of a ray traversing the tree, in units of one primitive intersection
+    double sah_cost = 0;
+    // Seconds
+    double build_time = 0;
+};
+
+// 8 bytes: a split plane, or a range of the primitive references
+struct KdTreeNode {
+    static constexpr uint32_t leaf_flag = 3;
+
+    union {
+        // Interior node
+        float split;
+        // Leaf: index of the first reference
+        uint32_t first;
+    };
+    // Low 2 bits: split axis, or leaf_flag. Other bits: index of the child above the split (the
+    // child below follows its parent) or number of references of the leaf.
+    uint32_t flags;
+
+    inline bool is_leaf() const { return (flags & 3) == leaf_flag; }
+    inline int axis() const { return flags & 3; }
+    inline uint32_t above_child() const { return flags >> 2; }
+    inline uint32_t count() const { return flags >> 2; }
+};
+
+static_assert(sizeof(KdTreeNode) == 8, "KdTreeNode must stay 8 bytes");
+
+// Kd-tree over the scene primitives, built with the SAH by sweeping the sorted primitive edges of
+// every node (Wald and Havran, "On building fast kd-trees for ray tracing"), and traversed front to
+// back with a short stack. Unlike a BVH, cells do not overlap, so traversal stops at the first cell
+// holding a hit.
+class KdTree: public Hittable {
+    public:
+        static constexpr int stack_size = 64;
+
+        KdTree(const Scene& scene, const KdTreeBuildOptions& options = KdTreeBuildOptions());
+        KdTree(const Objects& objects, const KdTreeBuildOptions& options = KdTreeBuildOptions());
+
+        virtual bool hit(const Ray& ray, double t_min, double t_max, hit_record& record) const override;
+        virtual bool bounding_box(AABB& output_box) const override;
+
+        const KdTreeStats& stats() const { return _stats; }
+        std::size_t memory_usage() const;
+
+    private:
+        struct Reference {
+            AABB bounds;
+            uint32_t index;
+        };
+
+        struct Edge {
+            float position;
+            // Starting edges sort before ending ones at the same position
+            bool is_end;
+            uint32_t reference;
+
+            bool operator<(const Edge& other) const {
+                return position == other.position ? is_end < other.is_end : position < other.position;
+            }
+        };
+
+        void build(const AABB& bounds, std::vector<Reference>& references, int depth, int bad_refines);
+        void make_leaf(const std::vector<Reference>& references);
+        // Bounds of the primitive within `box`, false if it does not reach into it
+        bool clip(uint32_t index, const AABB& box, const AABB& bounds, AABB& output_box) const;
+        void collect_stats(uint32_t index, const AABB& bounds, std::size_t depth);
+
+        std::vector<KdTreeNode> _nodes;
+        std::vector<uint32_t> _references;
+        Objects _primitives;
+        KdTreeBuildOptions _options;
+        KdTreeStats _stats;
+        AABB _bounds;
+        std::vector<Edge> _edges;
+};
+
+KdTree::KdTree(const Scene& scene, const KdTreeBuildOptions& options) : KdTree(scene.objects(), options) {}
+
+KdTree::KdTree(const Objects& objects, const KdTreeBuildOptions& options) : _primitives(objects), _options(options) {
+    auto timer = Timer();
+
+    std::vector<Reference> references;
+    _bounds = AABB::empty();
+
+    for (std::size_t i = 0; i < objects.size(); ++i) {
+        AABB box;
+
+        if (!objects[i]->bounding_box(box)) {
+            std::cerr << "No bounding box in kd-tree constructor.\n";
+            continue;
+        }
+
+        references.push_back({ box, static_cast<uint32_t>(i) });
+        _bounds = AABB::surrounding_box(_bounds, box);
+    }
+
+    if (references.empty())
+        return;
+
+    if (_options.max_depth <= 0)
+        _options.max_depth = static_cast<int>(std::round(8 + 1.3 * std::log2(references.size())));
+
+    _options.max_depth = std::min(_options.max_depth, stack_size - 1);
+
+    build(_bounds, references, _options.max_depth, 0);
+
+    _edges = std::vector<Edge>();
+    _nodes.shrink_to_fit();
+    _references.shrink_to_fit();
+
+    collect_stats(0, _bounds, 1);
+
+    auto root_area = _bounds.surface_area();
+    _stats.sah_cost = root_area > 0 ? _stats.sah_cost / root_area : 0;
+    _stats.build_time = timer.elapsed();
+}
+
+bool KdTree::clip(uint32_t index, const AABB& box, const AABB& bounds, AABB& output_box) const {
+    if (_options.clip_primitives)
+        return _primitives[index]->clip_bounds(box, output_box);
+
+    output_box = AABB::intersection(bounds, box);
+
+    return !output_box.is_empty();
+}
+
+void KdTree::make_leaf(const std::vector<Reference>& references) {
+    KdTreeNode node;
+    node.first = static_cast<uint32_t>(_references.size());
+    node.flags = static_cast<uint32_t>(references.size()) << 2 | KdTreeNode::leaf_flag;
+    _nodes.push_back(node);
+
+    for (const auto& reference : references)
+        _references.push_back(reference.index);
+}
+
+void KdTree::build(const AABB& bounds, std::vector<Reference>& references, int depth, int bad_refines) {
+    auto count = references.size();
+
+    if (count <= _options.max_leaf_size || depth == 0) {
+        make_leaf(references);
+        return;
+    }
+
+    auto leaf_cost = _options.intersection_cost * count;
+    auto inv_area = 1 / bounds.surface_area();
+    auto extent = bounds.max() - bounds.min();
+
+    double best_cost = infinity;
+    int best_axis = -1;
+    float best_split = 0;
+
+    for (int axis = 0; axis < 3; ++axis) {
+        _edges.clear();
+
+        for (uint32_t i = 0; i < count; ++i) {
+            _edges.push_back({ static_cast<float>(references[i].bounds.min()[axis]), false, i });
+            _edges.push_back({ static_cast<float>(references[i].bounds.max()[axis]), true, i });
+        }
+
+        std::sort(_edges.begin(), _edges.end());
+
+        // Sweep the candidate planes, counting the references on each side
+        std::size_t below = 0;
+        std::size_t above = count;
+
+        auto other0 = (axis + 1) % 3;
+        auto other1 = (axis + 2) % 3;
+        auto cap_area = 2 * extent[other0] * extent[other1];
+        auto side_length = 2 * (extent[other0] + extent[other1]);
+
+        for (const auto& edge : _edges) {
+            if (edge.is_end)
+                above--;
+
+            double position = edge.position;
+
+            if (position > bounds.min()[axis] && position < bounds.max()[axis]) {
+                auto below_area = cap_area + side_length * (position - bounds.min()[axis]);
+                auto above_area = cap_area + side_length * (bounds.max()[axis] - position);
+                auto bonus = (below == 0 || above == 0) ? _options.empty_bonus : 0;
+
+                auto cost = _options.traversal_cost + _options.intersection_cost * (1 - bonus)
+                    * (below_area * inv_area * below + above_area * inv_area * above);
+
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_split = edge.position;
+                }
+            }
+
+            if (!edge.is_end)
+                below++;
+        }
+    }
+
+    if (best_cost > leaf_cost)
+        bad_refines++;
+
+    // Give up on nodes that a split would not help, allowing a few bad splits on the way down in
+    // case better ones come after them
+    if ((best_cost > 4 * leaf_cost && count < 16) || best_axis < 0 || bad_refines == 3) {
+        make_leaf(references);
+        return;
+    }
+
+    auto below_max = bounds.max();
+    auto above_min = bounds.min();
+    below_max[best_axis] = best_split;
+    above_min[best_axis] = best_split;
+
+    auto below_bounds = AABB(bounds.min(), below_max);
+    auto above_bounds = AABB(above_min, bounds.max());
+
+    std::vector<Reference> below_references;
+    std::vector<Reference> above_references;
+
+    for (const auto& reference : references) {
+        const auto& box = reference.bounds;
+        // Flat on the split plane: below
+        bool below = box.min()[best_axis] < best_split || box.max()[best_axis] <= best_split;
+        bool above = box.max()[best_axis] > best_split;
+        AABB clipped;
+
+        if (below && clip(reference.index, below_bounds, box, clipped))
+            below_references.push_back({ clipped, reference.index });
+
+        if (above && clip(reference.index, above_bounds, box, clipped))
+            above_references.push_back({ clipped, reference.index });
+    }
+
+    // Only the children's references are needed further down
+    references = std::vector<Reference>();
+
+    auto index = _nodes.size();
+    KdTreeNode node;
+    node.split = best_split;
+    node.flags = static_cast<uint32_t>(best_axis);
+    _nodes.push_back(node);
+
+    build(below_bounds, below_references, depth - 1, bad_refines);
+
+    _nodes[index].flags |= static_cast<uint32_t>(_nodes.size()) << 2;
+    build(above_bounds, above_references, depth - 1, bad_refines);
+}
+
+void KdTree::collect_stats(uint32_t index, const AABB& bounds, std::size_t depth) {
+    const auto& node = _nodes[index];
+
+    _stats.node_count++;
+    _stats.max_depth = std::max(_stats.max_depth, depth);
+
+    if (node.is_leaf()) {
+        _stats.leaf_count++;
+        _stats.empty_leaf_count += node.count() == 0;
+        _stats.reference_count += node.count();
+        _stats.sah_cost += bounds.surface_area() * node.count() * _options.intersection_cost;
+        return;
+    }
+
+    auto axis = node.axis();
+    auto below_max = bounds.max();
+    auto above_min = bounds.min();
+    below_max[axis] = node.split;
+    above_min[axis] = node.split;
+
+    _stats.sah_cost += bounds.surface_area() * _options.traversal_cost;
+    collect_stats(index + 1, AABB(bounds.min(), below_max), depth + 1);
+    collect_stats(node.above_child(), AABB(above_min, bounds.max()), depth + 1);
+}
+
+bool KdTree::hit(const Ray& ray, double t_min, double t_max, hit_record& record) const {
+    if (_nodes.empty())
+        return false;
+
+    double inv_direction[3];
+    double near = t_min;
+    double far = t_max;
+
+    // Interval of the ray inside the tree bounds
+    for (int a = 0; a < 3; ++a) {
+        inv_direction[a] = 1.0 / ray.direction()[a];
+
+        auto t0 = (_bounds.min()[a] - ray.origin()[a]) * inv_direction[a];
+        auto t1 = (_bounds.max()[a] - ray.origin()[a]) * inv_direction[a];
+
+        if (inv_direction[a] < 0)
+            std::swap(t0, t1);
+
+        near = t0 > near ? t0 : near;
+        far = t1 < far ? t1 : far;
+
+        if (far < near)
+            return false;
+    }
+
+    struct StackEntry {
+        uint32_t index;
+        double near;
+        double far;
+    };
+
+    StackEntry stack[stack_size];
+    int stack_top = 0;
+    uint32_t current = 0;
+    bool has_hit = false;
+
+    while (true) {
+        // The closest hit so far is before this cell
+        if (t_max < near)
+            break;
+
+        const auto& node = _nodes[current];
+
+        if (!node.is_leaf()) {
+            auto axis = node.axis();
+            auto origin = ray.origin()[axis];
+            auto t_plane = (node.split - origin) * inv_direction[axis];
+
+            // The child on the origin's side of the plane comes first
+            bool below_first = origin < node.split || (origin == node.split && ray.direction()[axis] <= 0);
+            auto first = below_first ? current + 1 : node.above_child();
+            auto second = below_first ? node.above_child() : current + 1;
+
+            if (t_plane > far || t_plane <= 0) {
+                current = first;
+            } else if (t_plane < near) {
+                current = second;
+            } else {
+                stack[stack_top++] = { second, t_plane, far };
+                current = first;
+                far = t_plane;
+            }
+
+            continue;
+        }
+
+        for (uint32_t i = node.first; i < node.first + node.count(); ++i) {
+            if (_primitives[_references[i]]->hit(ray, t_min, t_max, record)) {
+                has_hit = true;
+                t_max = record.t;
+            }
+        }
+
+        if (stack_top == 0)
+            break;
+
+        --stack_top;
+        current = stack[stack_top].index;
+        near = stack[stack_top].near;
+        far = stack[stack_top].far;
+    }
+
+    return has_hit;
+}
+
+bool KdTree::bounding_box(AABB& output_box) const {
+    if (_nodes.empty())
+        return false;
+
+    output_box = _bounds;
+
+    return true;
+}
+
+std::size_t KdTree::memory_usage() const {
+    return _nodes.size() * sizeof(KdTreeNode) + _references.size() * sizeof(uint32_t)
+        + _primitives.size() * sizeof(std::shared_ptr<Hittable>);
+}
@@ -0,0 +1,188 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "object/hittable.h"
+#include "object/aabb.h"
+#include "object/bvh_build.h"
+#include "object/linear_bvh.h"
+#include "scene/scene.h"
+
+// BVH whose subtrees are built the first time a ray reaches them. Only the top levels are built
+// up front, down to ranges of `lazy_subtree_size` primitives, each of which becomes a LinearBVH
+// on first touch. Render threads reaching the same subtree together wait for a single build.
+class LazyBVH: public Hittable {
+    public:
+        static constexpr int stack_size = 128;
+
+        LazyBVH(const Scene& scene, const BVHBuildOptions& options = BVHBuildOptions());
+        LazyBVH(const Objects& objects, const BVHBuildOptions& options = BVHBuildOptions());
+
+        virtual bool hit(const Ray& ray, double t_min, double t_max, hit_record& record) const override;
+        virtual bool bounding_box(AABB& output_box) const override;
+
+        // Builds every subtree not built yet
+        void build_all() const;
+
+        std::size_t subtree_count() const { return _subtrees.size(); }
+        std::size_t built_subtree_count() const;
+        // Bytes held by the top levels and the subtrees built so far
+        std::size_t resident_memory() const;
+
+    private:
+        struct Node {
+            AABB bounds;
+            // Interior node: index of the first child, the second one follows it
+            // Leaf: index of its subtree
+            uint32_t offset;
+            bool is_leaf;
+            uint8_t axis;
+        };
+
+        struct Subtree {
+            std::once_flag once;
+            std::atomic<bool> built{false};
+            std::unique_ptr<LinearBVH> bvh;
+            // Range of `_primitives`
+            std::size_t first;
+            std::size_t count;
+        };
+
+        void flatten(const BVHBuildNode& node, uint32_t index);
+        const LinearBVH& subtree(uint32_t index) const;
+
+        std::vector<Node> _nodes;
+        std::vector<std::unique_ptr<Subtree>> _subtrees;
+        Objects _primitives;
+        BVHBuildOptions _subtree_options;
+};
+
+LazyBVH::LazyBVH(const Scene& scene, const BVHBuildOptions& options) : LazyBVH(scene.objects(), options) {}
+
+LazyBVH::LazyBVH(const Objects& objects, const BVHBuildOptions& options) : _subtree_options(options) {
+    // Subtrees are built by render threads, which are already busy
+    _subtree_options.thread_count = 1;
+
+    auto builder = BVHBuilder(objects, options);
+    auto root = builder.build_top_levels(options.lazy_subtree_size);
+
+    if (!root)
+        return;
+
+    for (auto index : builder.ordered_indices())
+        _primitives.push_back(objects[index]);
+
+    _nodes.resize(1);
+    flatten(*root, 0);
+}
+
+void LazyBVH::flatten(const BVHBuildNode& build_node, uint32_t index) {
+    _nodes[index].bounds = build_node.bounds;
+    _nodes[index].axis = static_cast<uint8_t>(build_node.split_axis);
+    _nodes[index].is_leaf = build_node.is_leaf();
+
+    if (build_node.is_leaf()) {
+        _nodes[index].offset = static_cast<uint32_t>(_subtrees.size());
+
+        auto subtree = std::make_unique<Subtree>();
+        subtree->first = build_node.first;
+        subtree->count = build_node.count;
+        _subtrees.push_back(std::move(subtree));
+        return;
+    }
+
+    auto first_child = static_cast<uint32_t>(_nodes.size());
+    _nodes[index].offset = first_child;
+    _nodes.resize(_nodes.size() + 2);
+
+    flatten(*build_node.children[0], first_child);
+    flatten(*build_node.children[1], first_child + 1);
+}
+
+const LinearBVH& LazyBVH::subtree(uint32_t index) const {
+    auto& subtree = *_subtrees[index];
+
+    std::call_once(subtree.once, [this, &subtree]() {
+        auto objects = Objects(_primitives.begin() + subtree.first, _primitives.begin() + subtree.first + subtree.count);
+        subtree.bvh = std::make_unique<LinearBVH>(objects, _subtree_options);
+        subtree.built = true;
+    });
+
+    return *subtree.bvh;
+}
+
+bool LazyBVH::hit(const Ray& ray, double t_min, double t_max, hit_record& record) const {
+    if (_nodes.empty())
+        return false;
+
+    uint32_t stack[stack_size];
+    int stack_top = 0;
+    uint32_t current = 0;
+    bool has_hit = false;
+
+    while (true) {
+        const auto& node = _nodes[current];
+
+        if (node.bounds.hit(ray, t_min, t_max)) {
+            if (node.is_leaf) {
+                if (subtree(node.offset).hit(ray, t_min, t_max, record)) {
+                    has_hit = true;
+                    t_max = record.t;
+                }
+            } else {
+                // Visit the child on the ray's side of the split plane first
+                int direction_is_negative = ray.direction()[node.axis] < 0;
+
+                stack[stack_top++] = node.offset + 1 - direction_is_negative;
+                current = node.offset + direction_is_negative;
+                continue;
+            }
+        }
+
+        if (stack_top == 0)
+            break;
+
+        current = stack[--stack_top];
+    }
+
+    return has_hit;
+}
+
+bool LazyBVH::bounding_box(AABB& output_box) const {
+    if (_nodes.empty())
+        return false;
+
+    output_box = _nodes[0].bounds;
+
+    return true;
+}
+
+void LazyBVH::build_all() const {
+    for (uint32_t i = 0; i < _subtrees.size(); ++i)
+        subtree(i);
+}
+
+std::size_t LazyBVH::built_subtree_count() const {
+    std::size_t count = 0;
+
+    for (const auto& subtree : _subtrees)
+        count += subtree->built;
+
+    return count;
+}
+
+std::size_t LazyBVH::resident_memory() const {
+    auto memory = _nodes.size() * sizeof(Node) + _subtrees.size() * sizeof(Subtree)
+        + _primitives.size() * sizeof(std::shared_ptr<Hittable>);
+
+    for (const auto& subtree : _subtrees) {
+        if (subtree->built)
+            memory += subtree->bvh->memory_usage();
+    }
+
+    return memory;
+}
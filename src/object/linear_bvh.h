@@ -0,0 +1,667 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <queue>
+#include <vector>
+
+#include "object/hittable.h"
+#include "object/aabb.h"
+#include "object/bvh_build.h"
+#include "scene/scene.h"
+#include "utils/aligned_allocator.h"
+#include "utils/mapped_file.h"
+#include "utils/thread_pool.h"
+
+// 32 bytes, so two siblings share one 64-byte cache line
+struct alignas(32) LinearBVHNode {
+    // bounds[0] is the min corner, bounds[1] the max corner, rounded outwards to float
+    float bounds[2][3];
+    // Interior node: index of the first child, the second child is stored right after it
+    // Leaf: index of the first primitive
+    uint32_t offset;
+    // Number of primitives, 0 for interior nodes
+    uint16_t count;
+    uint8_t axis;
+    uint8_t padding;
+
+    inline bool is_leaf() const { return count > 0; }
+};
+
+static_assert(sizeof(LinearBVHNode) == 32, "LinearBVHNode must stay 32 bytes");
+
+// Nodes start on a cache line, so that every sibling pair fills exactly one line
+using LinearBVHNodes = std::vector<LinearBVHNode, AlignedAllocator<LinearBVHNode, 64>>;
+
+// Nodes of a LinearBVH, wherever they are stored
+struct LinearBVHNodeSpan {
+    LinearBVHNode* data = nullptr;
+    std::size_t count = 0;
+
+    inline const LinearBVHNode& operator[](std::size_t index) const { return data[index]; }
+    inline std::size_t size() const { return count; }
+    inline bool empty() const { return count == 0; }
+};
+
+// BVH flattened in a single array, so traversal follows indices instead of pointers and needs no
+// recursion. The root is followed by an unused slot, then come the sibling pairs, stored next to
+// each other in the order picked by BVHBuildOptions::node_layout.
+class LinearBVH: public Hittable {
+    public:
+        // Traversal stack depth, the builder keeps the tree shallower than this
+        static constexpr int stack_size = 128;
+        // Treelet layout: bytes of one treelet
+        static constexpr std::size_t page_size = 4096;
+
+        LinearBVH(const Scene& scene, const BVHBuildOptions& options = BVHBuildOptions());
+        LinearBVH(const Objects& objects, const BVHBuildOptions& options = BVHBuildOptions());
+        // Nodes only, over primitives known by their bounds and stored by the caller (Mesh). Leaf
+        // ranges index `ordered_indices`, the primitive indices in leaf order. The caller tests the
+        // leaves through traverse(): hit(), occluded() and refit() see no primitives.
+        LinearBVH(const std::vector<AABB>& bounds, std::vector<std::size_t>& ordered_indices, const BVHBuildOptions& options = BVHBuildOptions());
+        // The same over `count` primitives whose bounds are `bounds(index)` (ParticleCloud)
+        template <typename Bounds>
+        LinearBVH(std::size_t count, const Bounds& bounds, std::vector<std::size_t>& ordered_indices, const BVHBuildOptions& options = BVHBuildOptions());
+
+        // `nodes()` may point into the node storage
+        LinearBVH(const LinearBVH&) = delete;
+        LinearBVH& operator=(const LinearBVH&) = delete;
+
+        virtual bool hit(const Ray& ray, double t_min, double t_max, hit_record& record) const override;
+        virtual bool intersect(const Ray& ray, double t_min, double t_max, hit_record& record) const override;
+        virtual bool occluded(const Ray& ray, double t_min, double t_max) const override;
+        virtual bool bounding_box(AABB& output_box) const override;
+
+        BVHStats stats(double traversal_cost = 1.0, double intersection_cost = 1.0) const;
+        std::size_t memory_usage() const;
+
+        const LinearBVHNodeSpan& nodes() const { return _nodes; }
+        // Primitives in leaf order, a leaf holds [offset, offset + count)
+        const Objects& primitives() const { return _primitives; }
+
+        // Closest-hit walk of the nodes. `leaf(first, count, t_max)` tests the primitives of a leaf,
+        // lowers t_max to any closer hit and returns whether there was one.
+        template <typename Leaf>
+        inline bool traverse(const Ray& ray, double t_min, double t_max, Leaf&& leaf) const;
+        // Any-hit walk of the nodes, returns as soon as `leaf(first, count)` reports a hit
+        template <typename Leaf>
+        inline bool traverse_any(const Ray& ray, double t_min, double t_max, Leaf&& leaf) const;
+
+        // Recomputes every node bounds from the current primitive bounds, keeping the topology
+        void refit();
+        // Builds the tree again from the current primitives
+        void rebuild();
+        // Refits after primitives moved, or rebuilds when the refitted tree is too degraded.
+        // Returns true when the tree was rebuilt.
+        bool update();
+
+        // SAH cost of the tree over its cost right after the last build, as of the last refit
+        double sah_ratio() const { return _sah_ratio; }
+        // Of the last build, empty for trees loaded from a BVHCache
+        const BVHBuildStats& build_stats() const { return _build_stats; }
+
+    private:
+        friend class BVHCache;
+
+        // Subtrees refitted by one task hold at least this many nodes
+        static constexpr std::size_t min_refit_task_size = 4096;
+
+        // Empty tree, filled by BVHCache
+        LinearBVH(const BVHBuildOptions& options) : _options(options) {}
+
+        void build(const Objects& objects);
+        void flatten(const BVHBuildNode& root);
+        void flatten(const BVHBuildNode& node, uint32_t index);
+
+        // Moves the sibling pairs to the order of `layout`, the root stays first
+        void apply_layout(BVHNodeLayout layout);
+        // Pairs below the interior nodes of a pair (the root counts as a pair)
+        void child_pairs(uint32_t pair, std::vector<uint32_t>& children) const;
+        void layout_treelets(std::vector<uint32_t>& order) const;
+        void layout_van_emde_boas(uint32_t pair, std::size_t levels, std::vector<uint32_t>& order, std::vector<uint32_t>& frontier) const;
+        std::size_t pair_height(uint32_t pair) const;
+        AABB refit_subtree(uint32_t index);
+        AABB refit_top(uint32_t index, std::size_t depth, std::size_t task_depth, std::vector<uint32_t>* task_roots);
+        static void store_bounds(LinearBVHNode& node, const AABB& bounds);
+        AABB node_bounds(uint32_t index) const;
+
+        inline static float round_down(double value) {
+            auto f = static_cast<float>(value);
+            return f > value ? std::nextafter(f, -INFINITY) : f;
+        }
+
+        inline static float round_up(double value) {
+            auto f = static_cast<float>(value);
+            return f < value ? std::nextafter(f, INFINITY) : f;
+        }
+
+        // Nodes of the last build, unused when the tree comes from a mapped cache file
+        LinearBVHNodes _node_storage;
+        std::shared_ptr<MappedFile> _mapping;
+        LinearBVHNodeSpan _nodes;
+        Objects _primitives;
+        BVHBuildOptions _options;
+        double _built_sah_cost = 0;
+        double _sah_ratio = 1;
+        BVHBuildStats _build_stats;
+};
+
+LinearBVH::LinearBVH(const Scene& scene, const BVHBuildOptions& options) : LinearBVH(scene.objects(), options) {}
+
+LinearBVH::LinearBVH(const Objects& objects, const BVHBuildOptions& options) : _options(options) {
+    build(objects);
+}
+
+LinearBVH::LinearBVH(const std::vector<AABB>& bounds, std::vector<std::size_t>& ordered_indices, const BVHBuildOptions& options)
+    : LinearBVH(bounds.size(), [&](std::size_t index) { return bounds[index]; }, ordered_indices, options) {}
+
+template <typename Bounds>
+LinearBVH::LinearBVH(std::size_t count, const Bounds& bounds, std::vector<std::size_t>& ordered_indices, const BVHBuildOptions& options) : _options(options) {
+    std::unique_ptr<BVHBuildNode> root;
+
+    // The primitive references of the builder are freed before the nodes are flattened
+    {
+        auto builder = BVHBuilder(count, bounds, _options);
+        root = builder.build();
+        ordered_indices = builder.take_ordered_indices();
+        _build_stats = builder.stats();
+    }
+
+    if (root)
+        flatten(*root);
+}
+
+void LinearBVH::build(const Objects& objects) {
+    _node_storage.clear();
+    _mapping.reset();
+    _nodes = LinearBVHNodeSpan();
+    _primitives.clear();
+    _sah_ratio = 1;
+
+    auto builder = BVHBuilder(objects, _options);
+    auto root = builder.build();
+    _build_stats = builder.stats();
+
+    if (!root)
+        return;
+
+    for (auto index : builder.ordered_indices())
+        _primitives.push_back(objects[index]);
+
+    flatten(*root);
+}
+
+void LinearBVH::flatten(const BVHBuildNode& root) {
+    // Root and padding, pairs then start on even indices
+    _node_storage.resize(2);
+    flatten(root, 0);
+    _nodes = { _node_storage.data(), _node_storage.size() };
+
+    apply_layout(_options.node_layout);
+    _node_storage.shrink_to_fit();
+    _nodes = { _node_storage.data(), _node_storage.size() };
+
+    _built_sah_cost = stats(_options.traversal_cost, _options.intersection_cost).sah_cost;
+}
+
+void LinearBVH::flatten(const BVHBuildNode& build_node, uint32_t index) {
+    auto& node = _node_storage[index];
+    store_bounds(node, build_node.bounds);
+
+    node.axis = static_cast<uint8_t>(build_node.split_axis);
+    node.padding = 0;
+
+    if (build_node.is_leaf()) {
+        node.offset = static_cast<uint32_t>(build_node.first);
+        node.count = static_cast<uint16_t>(build_node.count);
+        return;
+    }
+
+    auto first_child = static_cast<uint32_t>(_node_storage.size());
+    node.offset = first_child;
+    node.count = 0;
+
+    // `node` is invalidated by the resize
+    _node_storage.resize(_node_storage.size() + 2);
+
+    flatten(*build_node.children[0], first_child);
+    flatten(*build_node.children[1], first_child + 1);
+}
+
+void LinearBVH::child_pairs(uint32_t pair, std::vector<uint32_t>& children) const {
+    children.clear();
+
+    for (uint32_t i = pair; i < (pair == 0 ? 1u : pair + 2); ++i) {
+        if (!_nodes[i].is_leaf())
+            children.push_back(_nodes[i].offset);
+    }
+}
+
+std::size_t LinearBVH::pair_height(uint32_t pair) const {
+    std::vector<uint32_t> children;
+    child_pairs(pair, children);
+
+    std::size_t height = 0;
+
+    for (auto child : children)
+        height = std::max(height, pair_height(child));
+
+    return height + 1;
+}
+
+void LinearBVH::apply_layout(BVHNodeLayout layout) {
+    if (layout == BVHNodeLayout::DepthFirst || _nodes[0].is_leaf())
+        return;
+
+    // Pairs in their new order, the root pair (index 0) first
+    std::vector<uint32_t> order;
+    order.reserve(_nodes.size() / 2);
+
+    if (layout == BVHNodeLayout::Treelet) {
+        layout_treelets(order);
+    } else {
+        std::vector<uint32_t> frontier;
+        layout_van_emde_boas(0, pair_height(0), order, frontier);
+    }
+
+    std::vector<uint32_t> new_index(_nodes.size());
+    auto nodes = LinearBVHNodes(_nodes.size());
+
+    nodes[0] = _nodes[0];
+    nodes[1] = _nodes[1];
+
+    for (std::size_t k = 1; k < order.size(); ++k) {
+        auto index = static_cast<uint32_t>(2 * k);
+        new_index[order[k]] = index;
+        nodes[index] = _nodes[order[k]];
+        nodes[index + 1] = _nodes[order[k] + 1];
+    }
+
+    for (auto& node : nodes) {
+        if (!node.is_leaf() && &node != &nodes[1])
+            node.offset = new_index[node.offset];
+    }
+
+    _node_storage = std::move(nodes);
+}
+
+// Grows a treelet from each root by adding the pair of largest parent area, i.e. the most likely to
+// be visited, until it fills a page. The pairs left at its border root the next treelets.
+void LinearBVH::layout_treelets(std::vector<uint32_t>& order) const {
+    const std::size_t pairs_per_treelet = page_size / (2 * sizeof(LinearBVHNode));
+
+    auto area = [this](uint32_t pair) {
+        return AABB::surrounding_box(node_bounds(pair), node_bounds(pair + 1)).surface_area();
+    };
+
+    auto by_area = [&area](uint32_t a, uint32_t b) { return area(a) < area(b); };
+
+    std::vector<uint32_t> roots = { 0 };
+    std::vector<uint32_t> children;
+
+    while (!roots.empty()) {
+        auto root = roots.back();
+        roots.pop_back();
+
+        std::priority_queue<uint32_t, std::vector<uint32_t>, decltype(by_area)> candidates(by_area);
+        candidates.push(root);
+
+        for (std::size_t size = 0; size < pairs_per_treelet && !candidates.empty(); ++size) {
+            auto pair = candidates.top();
+            candidates.pop();
+            order.push_back(pair);
+
+            child_pairs(pair, children);
+
+            for (auto child : children)
+                candidates.push(child);
+        }
+
+        // Smallest first on the stack, so the largest border treelet follows this one
+        std::vector<uint32_t> border;
+
+        while (!candidates.empty()) {
+            border.push_back(candidates.top());
+            candidates.pop();
+        }
+
+        roots.insert(roots.end(), border.rbegin(), border.rend());
+    }
+}
+
+// Lays out the `levels` top levels of the pair subtree: first its top half, then each subtree
+// below it. The pairs right under these levels are added to `frontier`.
+void LinearBVH::layout_van_emde_boas(uint32_t pair, std::size_t levels, std::vector<uint32_t>& order, std::vector<uint32_t>& frontier) const {
+    if (levels == 1) {
+        order.push_back(pair);
+
+        std::vector<uint32_t> children;
+        child_pairs(pair, children);
+        frontier.insert(frontier.end(), children.begin(), children.end());
+        return;
+    }
+
+    auto top = levels / 2;
+    std::vector<uint32_t> middle;
+    layout_van_emde_boas(pair, top, order, middle);
+
+    for (auto child : middle)
+        layout_van_emde_boas(child, levels - top, order, frontier);
+}
+
+void LinearBVH::store_bounds(LinearBVHNode& node, const AABB& bounds) {
+    for (int a = 0; a < 3; ++a) {
+        node.bounds[0][a] = round_down(bounds.min()[a]);
+        node.bounds[1][a] = round_up(bounds.max()[a]);
+    }
+}
+
+AABB LinearBVH::node_bounds(uint32_t index) const {
+    const auto& node = _nodes[index];
+
+    return AABB(
+        Point3D(node.bounds[0][0], node.bounds[0][1], node.bounds[0][2]),
+        Point3D(node.bounds[1][0], node.bounds[1][1], node.bounds[1][2])
+    );
+}
+
+AABB LinearBVH::refit_subtree(uint32_t index) {
+    const auto& node = _nodes[index];
+    auto bounds = AABB::empty();
+
+    if (node.is_leaf()) {
+        for (uint32_t i = node.offset; i < node.offset + node.count; ++i) {
+            AABB box;
+
+            if (_primitives[i]->bounding_box(box))
+                bounds = AABB::surrounding_box(bounds, box);
+        }
+    } else {
+        bounds = AABB::surrounding_box(refit_subtree(node.offset), refit_subtree(node.offset + 1));
+    }
+
+    store_bounds(_nodes.data[index], bounds);
+
+    return bounds;
+}
+
+// Refits the nodes above `task_depth`. Without `task_roots` the nodes at `task_depth` are already
+// refitted, otherwise they are only collected.
+AABB LinearBVH::refit_top(uint32_t index, std::size_t depth, std::size_t task_depth, std::vector<uint32_t>* task_roots) {
+    const auto& node = _nodes[index];
+
+    if (depth == task_depth || node.is_leaf()) {
+        if (task_roots) {
+            task_roots->push_back(index);
+            return AABB();
+        }
+
+        return node_bounds(index);
+    }
+
+    auto bounds = AABB::surrounding_box(
+        refit_top(node.offset, depth + 1, task_depth, task_roots),
+        refit_top(node.offset + 1, depth + 1, task_depth, task_roots)
+    );
+
+    if (!task_roots)
+        store_bounds(_nodes.data[index], bounds);
+
+    return bounds;
+}
+
+void LinearBVH::refit() {
+    if (_nodes.empty() || _primitives.empty())
+        return;
+
+    auto thread_count = _options.thread_count == 0 ? ThreadPool::hardware_threads() : _options.thread_count;
+
+    if (thread_count <= 1 || _nodes.size() < 2 * min_refit_task_size) {
+        refit_subtree(0);
+    } else {
+        // Several subtrees per thread, so that unbalanced ones even out
+        std::size_t task_depth = 0;
+
+        while ((std::size_t(1) << task_depth) < 8 * thread_count && (_nodes.size() >> task_depth) > min_refit_task_size)
+            task_depth++;
+
+        std::vector<uint32_t> task_roots;
+        refit_top(0, 0, task_depth, &task_roots);
+
+        auto pool = ThreadPool(thread_count);
+        pool.parallel_for(0, task_roots.size(), 1, [&](std::size_t start, std::size_t end) {
+            for (auto i = start; i < end; ++i)
+                refit_subtree(task_roots[i]);
+        });
+
+        refit_top(0, 0, task_depth, nullptr);
+    }
+
+    auto cost = stats(_options.traversal_cost, _options.intersection_cost).sah_cost;
+    _sah_ratio = _built_sah_cost > 0 ? cost / _built_sah_cost : 1;
+}
+
+void LinearBVH::rebuild() {
+    if (_primitives.empty())
+        return;
+
+    // `build` reorders the primitives it reads from
+    auto objects = _primitives;
+    build(objects);
+}
+
+bool LinearBVH::update() {
+    refit();
+
+    if (_sah_ratio <= _options.rebuild_sah_ratio)
+        return false;
+
+    rebuild();
+
+    return true;
+}
+
+bool LinearBVH::hit(const Ray& ray, double t_min, double t_max, hit_record& record) const {
+    if (!intersect(ray, t_min, t_max, record))
+        return false;
+
+    record.object->compute_surface(ray, record);
+
+    return true;
+}
+
+bool LinearBVH::intersect(const Ray& ray, double t_min, double t_max, hit_record& record) const {
+    if (_primitives.empty())
+        return false;
+
+    return traverse(ray, t_min, t_max, [&](uint32_t first, uint32_t count, double& t_max) {
+        bool has_hit = false;
+
+        for (uint32_t i = first; i < first + count; ++i) {
+            if (_primitives[i]->intersect(ray, t_min, t_max, record)) {
+                has_hit = true;
+                t_max = record.t;
+            }
+        }
+
+        return has_hit;
+    });
+}
+
+template <typename Leaf>
+inline bool LinearBVH::traverse(const Ray& ray, double t_min, double t_max, Leaf&& leaf) const {
+    if (_nodes.empty())
+        return false;
+
+    float origin[3];
+    float inv_direction[3];
+    int direction_is_negative[3];
+
+    for (int a = 0; a < 3; ++a) {
+        origin[a] = static_cast<float>(ray.origin()[a]);
+        inv_direction[a] = static_cast<float>(1.0 / ray.direction()[a]);
+        direction_is_negative[a] = inv_direction[a] < 0;
+    }
+
+    // Slabs are computed in single precision, pad the far distance to stay conservative
+    const float padding = 1 + 4 * std::numeric_limits<float>::epsilon();
+
+    uint32_t stack[stack_size];
+    int stack_top = 0;
+    uint32_t current = 0;
+    bool has_hit = false;
+
+    while (true) {
+        const auto& node = _nodes[current];
+
+        auto near = static_cast<float>(t_min);
+        auto far = static_cast<float>(t_max);
+
+        for (int a = 0; a < 3; ++a) {
+            auto t0 = (node.bounds[direction_is_negative[a]][a] - origin[a]) * inv_direction[a];
+            auto t1 = (node.bounds[1 - direction_is_negative[a]][a] - origin[a]) * inv_direction[a] * padding;
+
+            near = t0 > near ? t0 : near;
+            far = t1 < far ? t1 : far;
+        }
+
+        if (near <= far) {
+            if (node.is_leaf()) {
+                has_hit = leaf(node.offset, node.count, t_max) || has_hit;
+            } else {
+                // Visit the child on the ray's side of the split plane first
+                auto first = node.offset + direction_is_negative[node.axis];
+                auto second = node.offset + 1 - direction_is_negative[node.axis];
+
+                stack[stack_top++] = second;
+                current = first;
+                continue;
+            }
+        }
+
+        if (stack_top == 0)
+            break;
+
+        current = stack[--stack_top];
+    }
+
+    return has_hit;
+}
+
+template <typename Leaf>
+inline bool LinearBVH::traverse_any(const Ray& ray, double t_min, double t_max, Leaf&& leaf) const {
+    if (_nodes.empty())
+        return false;
+
+    float origin[3];
+    float inv_direction[3];
+    int direction_is_negative[3];
+
+    for (int a = 0; a < 3; ++a) {
+        origin[a] = static_cast<float>(ray.origin()[a]);
+        inv_direction[a] = static_cast<float>(1.0 / ray.direction()[a]);
+        direction_is_negative[a] = inv_direction[a] < 0;
+    }
+
+    const float padding = 1 + 4 * std::numeric_limits<float>::epsilon();
+
+    uint32_t stack[stack_size];
+    int stack_top = 0;
+    uint32_t current = 0;
+
+    // Same walk as traverse(), without a closest hit to shrink the interval: the first one ends it
+    while (true) {
+        const auto& node = _nodes[current];
+
+        auto near = static_cast<float>(t_min);
+        auto far = static_cast<float>(t_max);
+
+        for (int a = 0; a < 3; ++a) {
+            auto t0 = (node.bounds[direction_is_negative[a]][a] - origin[a]) * inv_direction[a];
+            auto t1 = (node.bounds[1 - direction_is_negative[a]][a] - origin[a]) * inv_direction[a] * padding;
+
+            near = t0 > near ? t0 : near;
+            far = t1 < far ? t1 : far;
+        }
+
+        if (near <= far) {
+            if (node.is_leaf()) {
+                if (leaf(node.offset, node.count))
+                    return true;
+            } else {
+                stack[stack_top++] = node.offset + 1;
+                current = node.offset;
+                continue;
+            }
+        }
+
+        if (stack_top == 0)
+            return false;
+
+        current = stack[--stack_top];
+    }
+}
+
+bool LinearBVH::occluded(const Ray& ray, double t_min, double t_max) const {
+    if (_primitives.empty())
+        return false;
+
+    return traverse_any(ray, t_min, t_max, [&](uint32_t first, uint32_t count) {
+        for (uint32_t i = first; i < first + count; ++i) {
+            if (_primitives[i]->occluded(ray, t_min, t_max))
+                return true;
+        }
+
+        return false;
+    });
+}
+
+bool LinearBVH::bounding_box(AABB& output_box) const {
+    if (_nodes.empty())
+        return false;
+
+    output_box = node_bounds(0);
+
+    return true;
+}
+
+BVHStats LinearBVH::stats(double traversal_cost, double intersection_cost) const {
+    BVHStats stats;
+
+    if (_nodes.empty())
+        return stats;
+
+    auto area = [this](uint32_t index) { return node_bounds(index).surface_area(); };
+
+    std::vector<std::pair<uint32_t, std::size_t>> stack = { { 0, 1 } };
+
+    while (!stack.empty()) {
+        auto [index, depth] = stack.back();
+        stack.pop_back();
+
+        const auto& node = _nodes[index];
+
+        stats.node_count++;
+        stats.max_depth = std::max(stats.max_depth, depth);
+
+        if (node.is_leaf()) {
+            stats.leaf_count++;
+            stats.sah_cost += area(index) * node.count * intersection_cost;
+        } else {
+            stats.sah_cost += area(index) * traversal_cost;
+            stack.push_back({ node.offset, depth + 1 });
+            stack.push_back({ node.offset + 1, depth + 1 });
+        }
+    }
+
+    auto root_area = area(0);
+    stats.sah_cost = root_area > 0 ? stats.sah_cost / root_area : 0;
+
+    return stats;
+}
+
+std::size_t LinearBVH::memory_usage() const {
+    return _nodes.size() * sizeof(LinearBVHNode) + _primitives.size() * sizeof(std::shared_ptr<Hittable>);
+}
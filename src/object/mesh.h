@@ -0,0 +1,396 @@
+#pragma once
+
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "lib/tiny_obj_loader.h"
+
+#include "object/hittable.h"
+#include "object/aabb.h"
+#include "object/bvh_types.h"
+#include "object/linear_bvh.h"
+#include "object/triangle.h"
+#include "object/triangle_packet.h"
+#include "material/material.h"
+#include "utils/timer.h"
+
+struct MeshStats {
+    std::size_t vertex_count = 0;
+    std::size_t triangle_count = 0;
+    // Triangle4 / Triangle8 leaves, 0 when the leaves are tested triangle by triangle
+    std::size_t packet_count = 0;
+    // Seconds. Loading covers parsing and building the shared vertices, 0 for meshes built in memory.
+    double load_time = 0;
+    double build_time = 0;
+};
+
+// Triangle mesh with one shared buffer per vertex attribute and three 32-bit vertex indices per
+// triangle, intersected through its own BVH over the triangle indices. A triangle costs its indices,
+// its share of the vertices and of the BVH nodes, rather than a Triangle object and two pointers.
+// With a packet width of 4 or 8, the triangles of every leaf are also packed into Triangle4 /
+// Triangle8 at build time and each leaf is tested with one SIMD kernel per packet. Leaves are best
+// kept to one packet (BVHBuildOptions::max_leaf_size equal to the width), the SAH then counts
+// packets rather than triangles. Packets use Möller-Trumbore, watertight meshes ignore the width.
+class Mesh: public Hittable {
+    public:
+        // Every shape of an OBJ file in one mesh, polygons are triangulated. OBJ materials are
+        // ignored, the whole mesh uses `material`. Returns nullptr when the file cannot be read.
+        static std::shared_ptr<Mesh> load_obj(const std::string& path, MaterialId material, TriangleTest test = TriangleTest::MollerTrumbore,
+                                              const BVHBuildOptions& options = BVHBuildOptions(), int packet_width = 0);
+
+        // xyz positions, then optional xyz normals and uv texture coordinates (empty, or one per vertex)
+        Mesh(std::vector<float> positions, std::vector<float> normals, std::vector<float> texcoords, std::vector<uint32_t> indices,
+             MaterialId material, TriangleTest test = TriangleTest::MollerTrumbore, const BVHBuildOptions& options = BVHBuildOptions(),
+             int packet_width = 0);
+
+        virtual bool hit(const Ray& ray, double t_min, double t_max, hit_record& record) const override;
+        virtual bool intersect(const Ray& ray, double t_min, double t_max, hit_record& record) const override;
+        // Interpolated normal when the mesh has normals, and record.u / v become the texture
+        // coordinates when it has some
+        virtual void compute_surface(const Ray& ray, hit_record& record) const override;
+        virtual bool occluded(const Ray& ray, double t_min, double t_max) const override;
+        virtual bool bounding_box(AABB& output_box) const override;
+
+        std::size_t vertex_count() const { return _positions.size() / 3; }
+        std::size_t triangle_count() const { return _indices.size() / 3; }
+        const MeshStats& stats() const { return _stats; }
+        std::size_t memory_usage() const;
+
+    private:
+        inline Point3D position(uint32_t vertex) const {
+            return Point3D(_positions[3 * vertex], _positions[3 * vertex + 1], _positions[3 * vertex + 2]);
+        }
+
+        inline bool intersect_triangle(uint32_t triangle, const Ray& ray, double& t, double& u, double& v) const;
+
+        // Packs the triangles of every leaf, in leaf order
+        template <int Width>
+        void build_packets(std::vector<TrianglePacket<Width>>& packets);
+        template <int Width>
+        bool intersect_packets(const std::vector<TrianglePacket<Width>>& packets, const Ray& ray, double t_min, double t_max, hit_record& record) const;
+        template <int Width>
+        bool occluded_packets(const std::vector<TrianglePacket<Width>>& packets, const Ray& ray, double t_min, double t_max) const;
+
+        std::vector<float> _positions;
+        std::vector<float> _normals;
+        std::vector<float> _texcoords;
+        // Triangles in BVH leaf order
+        std::vector<uint32_t> _indices;
+        std::unique_ptr<LinearBVH> _bvh;
+        // The packets of a leaf follow each other, starting at _leaf_packets[first triangle of the leaf]
+        std::vector<Triangle4> _packets4;
+        std::vector<Triangle8> _packets8;
+        std::vector<uint32_t> _leaf_packets;
+        MaterialId _material;
+        TriangleTest _test;
+        MeshStats _stats;
+};
+
+std::shared_ptr<Mesh> Mesh::load_obj(const std::string& path, MaterialId material, TriangleTest test, const BVHBuildOptions& options, int packet_width) {
+    auto timer = Timer();
+
+    tinyobj::attrib_t attrib;
+    std::vector<tinyobj::shape_t> shapes;
+    std::vector<tinyobj::material_t> materials;
+    std::string warning, error;
+
+    if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warning, &error, path.c_str())) {
+        std::cerr << "Cannot load the mesh " << path << ": " << error << "\n";
+        return nullptr;
+    }
+
+    // OBJ faces index positions, normals and texture coordinates separately. Every distinct triplet
+    // becomes one shared vertex.
+    struct Key {
+        int position, normal, texcoord;
+
+        bool operator==(const Key& other) const { return position == other.position && normal == other.normal && texcoord == other.texcoord; }
+    };
+
+    struct KeyHash {
+        std::size_t operator()(const Key& key) const {
+            uint64_t h = static_cast<uint32_t>(key.position);
+            h = h * 0x9E3779B97F4A7C15ull + static_cast<uint32_t>(key.normal);
+            h = h * 0x9E3779B97F4A7C15ull + static_cast<uint32_t>(key.texcoord);
+
+            return static_cast<std::size_t>(h ^ (h >> 29));
+        }
+    };
+
+    bool has_normals = !attrib.normals.empty();
+    bool has_texcoords = !attrib.texcoords.empty();
+
+    std::vector<float> positions, normals, texcoords;
+    std::vector<uint32_t> indices;
+    std::unordered_map<Key, uint32_t, KeyHash> vertices;
+    vertices.reserve(attrib.vertices.size() / 3);
+
+    for (const auto& shape : shapes) {
+        for (const auto& index : shape.mesh.indices) {
+            // Faces missing an attribute the others have get a default one
+            auto key = Key { index.vertex_index, has_normals ? index.normal_index : -1, has_texcoords ? index.texcoord_index : -1 };
+            auto [it, inserted] = vertices.emplace(key, static_cast<uint32_t>(positions.size() / 3));
+
+            if (inserted) {
+                for (int a = 0; a < 3; ++a)
+                    positions.push_back(attrib.vertices[3 * key.position + a]);
+
+                for (int a = 0; a < 3 && has_normals; ++a)
+                    normals.push_back(key.normal >= 0 ? attrib.normals[3 * key.normal + a] : 0.0f);
+
+                for (int a = 0; a < 2 && has_texcoords; ++a)
+                    texcoords.push_back(key.texcoord >= 0 ? attrib.texcoords[2 * key.texcoord + a] : 0.0f);
+            }
+
+            indices.push_back(it->second);
+        }
+    }
+
+    auto load_time = timer.elapsed();
+
+    auto mesh = std::make_shared<Mesh>(std::move(positions), std::move(normals), std::move(texcoords), std::move(indices), material, test, options, packet_width);
+    mesh->_stats.load_time = load_time;
+
+    return mesh;
+}
+
+Mesh::Mesh(std::vector<float> positions, std::vector<float> normals, std::vector<float> texcoords, std::vector<uint32_t> indices,
+           MaterialId material, TriangleTest test, const BVHBuildOptions& options, int packet_width)
+    : _positions(std::move(positions)), _normals(std::move(normals)), _texcoords(std::move(texcoords)), _material(material), _test(test) {
+    auto timer = Timer();
+
+    std::vector<AABB> bounds(indices.size() / 3);
+
+    for (std::size_t i = 0; i < bounds.size(); ++i) {
+        auto box = AABB::empty();
+
+        for (int k = 0; k < 3; ++k)
+            box = AABB::surrounding_box(box, position(indices[3 * i + k]));
+
+        bounds[i] = Triangle::pad_flat_axes(box);
+    }
+
+    // Packed leaves cost the SAH one intersection per packet
+    auto build_options = options;
+
+    if (test == TriangleTest::MollerTrumbore && (packet_width == 4 || packet_width == 8))
+        build_options.leaf_block_size = packet_width;
+
+    std::vector<std::size_t> order;
+    _bvh = std::make_unique<LinearBVH>(bounds, order, build_options);
+
+    // Triangles in leaf order, leaves then index them directly
+    _indices.reserve(3 * order.size());
+
+    for (auto triangle : order) {
+        for (int k = 0; k < 3; ++k)
+            _indices.push_back(indices[3 * triangle + k]);
+    }
+
+    if (test == TriangleTest::MollerTrumbore && packet_width == 4)
+        build_packets(_packets4);
+    else if (test == TriangleTest::MollerTrumbore && packet_width == 8)
+        build_packets(_packets8);
+
+    _stats.packet_count = _packets4.size() + _packets8.size();
+    _stats.vertex_count = vertex_count();
+    _stats.triangle_count = triangle_count();
+    _stats.build_time = timer.elapsed();
+}
+
+template <int Width>
+void Mesh::build_packets(std::vector<TrianglePacket<Width>>& packets) {
+    const auto& nodes = _bvh->nodes();
+
+    if (nodes.empty())
+        return;
+
+    _leaf_packets.assign(triangle_count(), 0);
+
+    std::vector<uint32_t> stack = { 0 };
+
+    while (!stack.empty()) {
+        const auto& node = nodes[stack.back()];
+        stack.pop_back();
+
+        if (!node.is_leaf()) {
+            stack.push_back(node.offset);
+            stack.push_back(node.offset + 1);
+            continue;
+        }
+
+        _leaf_packets[node.offset] = static_cast<uint32_t>(packets.size());
+
+        for (uint32_t i = 0; i < node.count; ++i) {
+            if (i % Width == 0)
+                packets.emplace_back();
+
+            const auto* vertices = &_indices[3 * (node.offset + i)];
+            packets.back().set(i % Width, position(vertices[0]), position(vertices[1]), position(vertices[2]), node.offset + i);
+        }
+    }
+}
+
+inline bool Mesh::intersect_triangle(uint32_t triangle, const Ray& ray, double& t, double& u, double& v) const {
+    auto a = position(_indices[3 * triangle]);
+    auto b = position(_indices[3 * triangle + 1]);
+    auto c = position(_indices[3 * triangle + 2]);
+
+    if (_test == TriangleTest::Watertight)
+        return Triangle::watertight(ray, a, b, c, t, u, v);
+
+    return Triangle::moller_trumbore(ray, a, b - a, c - a, t, u, v);
+}
+
+bool Mesh::hit(const Ray& ray, double t_min, double t_max, hit_record& record) const {
+    if (!intersect(ray, t_min, t_max, record))
+        return false;
+
+    compute_surface(ray, record);
+
+    return true;
+}
+
+template <int Width>
+bool Mesh::intersect_packets(const std::vector<TrianglePacket<Width>>& packets, const Ray& ray, double t_min, double t_max, hit_record& record) const {
+    return _bvh->traverse(ray, t_min, t_max, [&](uint32_t first, uint32_t count, double& t_max) {
+        bool has_hit = false;
+        auto begin = _leaf_packets[first];
+
+        for (auto p = begin; p < begin + (count + Width - 1) / Width; ++p) {
+            double t, u, v;
+            int lane = packets[p].nearest(ray, t_min, t_max, t, u, v);
+
+            if (lane >= 0) {
+                has_hit = true;
+                t_max = t;
+
+                record.t = t;
+                record.u = u;
+                record.v = v;
+                record.primitive = packets[p].primitive[lane];
+                record.object = this;
+            }
+        }
+
+        return has_hit;
+    });
+}
+
+template <int Width>
+bool Mesh::occluded_packets(const std::vector<TrianglePacket<Width>>& packets, const Ray& ray, double t_min, double t_max) const {
+    return _bvh->traverse_any(ray, t_min, t_max, [&](uint32_t first, uint32_t count) {
+        auto begin = _leaf_packets[first];
+
+        for (auto p = begin; p < begin + (count + Width - 1) / Width; ++p) {
+            double t[Width], u[Width], v[Width];
+
+            if (packets[p].intersect(ray, t_min, t_max, t, u, v))
+                return true;
+        }
+
+        return false;
+    });
+}
+
+bool Mesh::intersect(const Ray& ray, double t_min, double t_max, hit_record& record) const {
+    if (!_packets4.empty())
+        return intersect_packets(_packets4, ray, t_min, t_max, record);
+
+    if (!_packets8.empty())
+        return intersect_packets(_packets8, ray, t_min, t_max, record);
+
+    return _bvh->traverse(ray, t_min, t_max, [&](uint32_t first, uint32_t count, double& t_max) {
+        bool has_hit = false;
+
+        for (uint32_t i = first; i < first + count; ++i) {
+            double t, u, v;
+
+            if (intersect_triangle(i, ray, t, u, v) && t_min <= t && t <= t_max) {
+                has_hit = true;
+                t_max = t;
+
+                record.t = t;
+                record.u = u;
+                record.v = v;
+                record.primitive = i;
+                record.object = this;
+            }
+        }
+
+        return has_hit;
+    });
+}
+
+void Mesh::compute_surface(const Ray& ray, hit_record& record) const {
+    const auto* vertices = &_indices[3 * record.primitive];
+    auto a = position(vertices[0]);
+    auto geometric_normal = Vector3::cross_product(position(vertices[1]) - a, position(vertices[2]) - a).unit_vector();
+
+    // Barycentrics of the three vertices
+    double weights[3] = { 1 - record.u - record.v, record.u, record.v };
+
+    record.point = ray.position(record.t);
+    record.set_face_normal(ray, geometric_normal);
+
+    if (!_normals.empty()) {
+        auto normal = Vector3(0, 0, 0);
+
+        for (int k = 0; k < 3; ++k)
+            normal += weights[k] * Vector3(_normals[3 * vertices[k]], _normals[3 * vertices[k] + 1], _normals[3 * vertices[k] + 2]);
+
+        // Degenerate normals (missing in the file) keep the geometric one. The side of the surface
+        // stays the geometric one, the shading normal is only turned towards it.
+        if (!normal.near_zero()) {
+            normal = normal.unit_vector();
+            record.normal = Vector3::dot_product(normal, record.normal) < 0 ? -normal : normal;
+        }
+    }
+
+    if (!_texcoords.empty()) {
+        double u = 0, v = 0;
+
+        for (int k = 0; k < 3; ++k) {
+            u += weights[k] * _texcoords[2 * vertices[k]];
+            v += weights[k] * _texcoords[2 * vertices[k] + 1];
+        }
+
+        record.u = u;
+        record.v = v;
+    }
+
+    record.material = _material;
+}
+
+bool Mesh::occluded(const Ray& ray, double t_min, double t_max) const {
+    if (!_packets4.empty())
+        return occluded_packets(_packets4, ray, t_min, t_max);
+
+    if (!_packets8.empty())
+        return occluded_packets(_packets8, ray, t_min, t_max);
+
+    return _bvh->traverse_any(ray, t_min, t_max, [&](uint32_t first, uint32_t count) {
+        for (uint32_t i = first; i < first + count; ++i) {
+            double t, u, v;
+
+            if (intersect_triangle(i, ray, t, u, v) && t_min <= t && t <= t_max)
+                return true;
+        }
+
+        return false;
+    });
+}
+
+bool Mesh::bounding_box(AABB& output_box) const {
+    return _bvh->bounding_box(output_box);
+}
+
+std::size_t Mesh::memory_usage() const {
+    return (_positions.size() + _normals.size() + _texcoords.size()) * sizeof(float) + _indices.size() * sizeof(uint32_t) + _bvh->memory_usage()
+        + _packets4.size() * sizeof(Triangle4) + _packets8.size() * sizeof(Triangle8) + _leaf_packets.size() * sizeof(uint32_t);
+}
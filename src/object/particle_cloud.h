@@ -0,0 +1,230 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "object/hittable.h"
+#include "object/aabb.h"
+#include "object/bvh_types.h"
+#include "object/linear_bvh.h"
+#include "object/sphere.h"
+#include "material/material.h"
+#include "utils/timer.h"
+
+// Center and radius of a particle, in single precision
+struct alignas(16) Particle {
+    float position[3];
+    float radius;
+};
+
+static_assert(sizeof(Particle) == 16, "Particle must stay 16 bytes");
+
+// Millions of spheres in one object: 16 bytes per particle, an optional 32-bit material id per
+// particle, and a LinearBVH over the particles, which are stored in leaf order so that a leaf is a
+// range of them. Intersections are computed in double precision, as Sphere computes them.
+// The particles of a full leaf (BVHBuildOptions::max_leaf_size) share about one cache line, so the
+// SAH costs such a leaf as a single intersection: the tree gets fewer, fuller leaves.
+class ParticleCloud: public Hittable {
+    public:
+        // Every particle uses `material`
+        ParticleCloud(std::vector<Particle> particles, MaterialId material, const BVHBuildOptions& options = BVHBuildOptions());
+        // One material per particle
+        ParticleCloud(std::vector<Particle> particles, std::vector<MaterialId> materials, const BVHBuildOptions& options = BVHBuildOptions());
+
+        // Raw dump of consecutive x, y, z, radius float32 records, in the host byte order. Returns
+        // nullptr when the file cannot be read or is not a whole number of records.
+        static std::shared_ptr<ParticleCloud> load_raw(const std::string& path, MaterialId material, const BVHBuildOptions& options = BVHBuildOptions());
+
+        virtual bool hit(const Ray& ray, double t_min, double t_max, hit_record& record) const override;
+        virtual bool intersect(const Ray& ray, double t_min, double t_max, hit_record& record) const override;
+        virtual void compute_surface(const Ray& ray, hit_record& record) const override;
+        virtual bool occluded(const Ray& ray, double t_min, double t_max) const override;
+        virtual bool bounding_box(AABB& output_box) const override;
+
+        std::size_t size() const { return _particles.size(); }
+        // Particles in leaf order
+        const std::vector<Particle>& particles() const { return _particles; }
+        double build_time() const { return _build_time; }
+        std::size_t memory_usage() const;
+        // Bytes held at the peak of the build: the particles, their materials and the BVH builder
+        std::size_t build_peak_memory() const { return _build_peak_memory; }
+
+    private:
+        void build(const BVHBuildOptions& options);
+
+        inline bool intersect_particle(uint32_t index, const Ray& ray, double t_min, double t_max, double& t) const;
+
+        std::vector<Particle> _particles;
+        // Empty when every particle uses _material
+        std::vector<MaterialId> _materials;
+        MaterialId _material = 0;
+        std::unique_ptr<LinearBVH> _bvh;
+        double _build_time = 0;
+        std::size_t _build_peak_memory = 0;
+};
+
+ParticleCloud::ParticleCloud(std::vector<Particle> particles, MaterialId material, const BVHBuildOptions& options)
+    : _particles(std::move(particles)), _material(material) {
+    build(options);
+}
+
+ParticleCloud::ParticleCloud(std::vector<Particle> particles, std::vector<MaterialId> materials, const BVHBuildOptions& options)
+    : _particles(std::move(particles)), _materials(std::move(materials)) {
+    if (_materials.size() != _particles.size()) {
+        std::cerr << "A particle cloud needs one material per particle, the first one is used for every particle.\n";
+        _material = _materials.empty() ? 0 : _materials[0];
+        _materials.clear();
+    }
+
+    build(options);
+}
+
+std::shared_ptr<ParticleCloud> ParticleCloud::load_raw(const std::string& path, MaterialId material, const BVHBuildOptions& options) {
+    // Read straight into the particles, the file is never held in memory a second time
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    std::streamoff size = file ? static_cast<std::streamoff>(file.tellg()) : -1;
+
+    if (size < 0 || size % sizeof(Particle) != 0) {
+        std::cerr << "Cannot load the particles " << path << ".\n";
+        return nullptr;
+    }
+
+    std::vector<Particle> particles(size / sizeof(Particle));
+    file.seekg(0);
+
+    if (!file.read(reinterpret_cast<char*>(particles.data()), size)) {
+        std::cerr << "Cannot load the particles " << path << ".\n";
+        return nullptr;
+    }
+
+    return std::make_shared<ParticleCloud>(std::move(particles), material, options);
+}
+
+void ParticleCloud::build(const BVHBuildOptions& options) {
+    auto timer = Timer();
+
+    std::vector<std::size_t> order;
+
+    auto build_options = options;
+    build_options.leaf_block_size = std::max(options.leaf_block_size, options.max_leaf_size);
+
+    // Bounds straight from the particles, without a copy of them in double precision
+    _bvh = std::make_unique<LinearBVH>(_particles.size(), [this](std::size_t index) {
+        const auto& particle = _particles[index];
+        auto center = Point3D(particle.position[0], particle.position[1], particle.position[2]);
+        auto extent = Vector3(particle.radius, particle.radius, particle.radius);
+
+        return AABB(center - extent, center + extent);
+    }, order, build_options);
+
+    // Leaf order, then leaves index the particles directly. Permuted in place one cycle at a time,
+    // placed entries are marked by order[i] == i.
+    for (std::size_t start = 0; start < order.size(); ++start) {
+        if (order[start] == start)
+            continue;
+
+        auto particle = _particles[start];
+        auto material = _materials.empty() ? 0 : _materials[start];
+        auto i = start;
+
+        while (order[i] != start) {
+            auto next = order[i];
+            _particles[i] = _particles[next];
+
+            if (!_materials.empty())
+                _materials[i] = _materials[next];
+
+            order[i] = i;
+            i = next;
+        }
+
+        _particles[i] = particle;
+
+        if (!_materials.empty())
+            _materials[i] = material;
+
+        order[i] = i;
+    }
+
+    _build_time = timer.elapsed();
+    _build_peak_memory = _particles.size() * sizeof(Particle) + _materials.size() * sizeof(MaterialId) + _bvh->build_stats().peak_memory;
+}
+
+inline bool ParticleCloud::intersect_particle(uint32_t index, const Ray& ray, double t_min, double t_max, double& t) const {
+    const auto& particle = _particles[index];
+    auto center = Point3D(particle.position[0], particle.position[1], particle.position[2]);
+    double t0, t1;
+
+    if (!Sphere::algebric_roots(ray, center, particle.radius, t0, t1))
+        return false;
+
+    // The nearest root in range
+    t = t_min <= t0 && t0 <= t_max ? t0 : t1;
+
+    return t_min <= t && t <= t_max;
+}
+
+bool ParticleCloud::hit(const Ray& ray, double t_min, double t_max, hit_record& record) const {
+    if (!intersect(ray, t_min, t_max, record))
+        return false;
+
+    compute_surface(ray, record);
+
+    return true;
+}
+
+bool ParticleCloud::intersect(const Ray& ray, double t_min, double t_max, hit_record& record) const {
+    return _bvh->traverse(ray, t_min, t_max, [&](uint32_t first, uint32_t count, double& t_max) {
+        bool has_hit = false;
+
+        for (uint32_t i = first; i < first + count; ++i) {
+            double t;
+
+            if (intersect_particle(i, ray, t_min, t_max, t)) {
+                has_hit = true;
+                t_max = t;
+
+                record.t = t;
+                record.primitive = i;
+                record.object = this;
+            }
+        }
+
+        return has_hit;
+    });
+}
+
+void ParticleCloud::compute_surface(const Ray& ray, hit_record& record) const {
+    const auto& particle = _particles[record.primitive];
+    auto center = Point3D(particle.position[0], particle.position[1], particle.position[2]);
+
+    record.point = ray.position(record.t);
+    record.set_face_normal(ray, (record.point - center).unit_vector());
+    record.material = _materials.empty() ? _material : _materials[record.primitive];
+}
+
+bool ParticleCloud::occluded(const Ray& ray, double t_min, double t_max) const {
+    return _bvh->traverse_any(ray, t_min, t_max, [&](uint32_t first, uint32_t count) {
+        for (uint32_t i = first; i < first + count; ++i) {
+            double t;
+
+            if (intersect_particle(i, ray, t_min, t_max, t))
+                return true;
+        }
+
+        return false;
+    });
+}
+
+bool ParticleCloud::bounding_box(AABB& output_box) const {
+    return _bvh->bounding_box(output_box);
+}
+
+std::size_t ParticleCloud::memory_usage() const {
+    return _particles.size() * sizeof(Particle) + _materials.size() * sizeof(MaterialId) + _bvh->memory_usage();
+}
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <algorithm>
 #include <iostream>
 #include <cmath>
 #include <memory>
@@ -13,11 +14,24 @@
 class Sphere: public Hittable {
     public:
         Sphere() {}
-        Sphere(Point3D center, double radius, std::shared_ptr<Material> material)
+        Sphere(Point3D center, double radius, MaterialId material)
             : _center(center), _radius(radius), _material(material) {};
 
         virtual bool hit(const Ray& ray, double t_min, double t_max, hit_record& record) const override;
+        virtual bool intersect(const Ray& ray, double t_min, double t_max, hit_record& record) const override;
+        virtual void compute_surface(const Ray& ray, hit_record& record) const override;
+        virtual bool occluded(const Ray& ray, double t_min, double t_max) const override;
         virtual bool bounding_box(AABB& output_box) const override;
+        virtual bool clip_bounds(const AABB& box, AABB& output_box) const override;
+
+        inline Point3D center() const { return _center; }
+        inline double radius() const { return _radius; }
+        inline MaterialId material() const { return _material; }
+
+        // Roots of the ray against any sphere, also used by ParticleCloud
+        inline static bool algebric_roots(const Ray& ray, const Point3D& center, double radius, double& t0, double& t1);
+        // Moving a sphere stored in a BVH requires a refit (or a rebuild) of that BVH
+        inline void set_center(const Point3D& center) { _center = center; }
 
     private:
         inline bool hit_geometric(const Ray& ray, double& t0, double& t1) const {
@@ -49,34 +63,47 @@ class Sphere: public Hittable {
         }
 
         inline bool hit_algebric(const Ray& ray, double& t0, double& t1) const {
-            // Sphere equation : (px - cx)^2 + (py - cy)^2 + (pz - cz)^2 = R^2
-            // (P(t) - C)^2 =  R^2
-            // ((o + tD) - C)^2 - R^2 = 0, with o + tD the ray equation
-            auto oc = ray.origin() - _center;
-            auto a = 1;
-            auto b = 2 * Vector3::dot_product(oc, ray.direction());
-            auto c = oc.squared_length() - _radius * _radius;
+            return algebric_roots(ray, _center, _radius, t0, t1);
+        }
 
-            auto discriminant = b * b - 4 * a * c;
+        Point3D _center;
+        double _radius;
+        MaterialId _material;
+};
 
-            if (discriminant < 0)
-                return false;
+inline bool Sphere::algebric_roots(const Ray& ray, const Point3D& center, double radius, double& t0, double& t1) {
+    // Sphere equation : (px - cx)^2 + (py - cy)^2 + (pz - cz)^2 = R^2
+    // (P(t) - C)^2 =  R^2
+    // ((o + tD) - C)^2 - R^2 = 0, with o + tD the ray equation
+    auto oc = ray.origin() - center;
+    auto a = 1;
+    auto b = 2 * Vector3::dot_product(oc, ray.direction());
+    auto c = oc.squared_length() - radius * radius;
 
-            auto sqrtd = std::sqrt(discriminant);
+    auto discriminant = b * b - 4 * a * c;
 
-            // 2 roots
-            t0 = (-b - sqrtd) / (2 * a);
-            t1 = (-b + sqrtd) / (2 * a);
+    if (discriminant < 0)
+        return false;
 
-            return true;
-        }
+    auto sqrtd = std::sqrt(discriminant);
 
-        Point3D _center;
-        double _radius;
-        std::shared_ptr<Material> _material;
-};
+    // 2 roots
+    t0 = (-b - sqrtd) / (2 * a);
+    t1 = (-b + sqrtd) / (2 * a);
+
+    return true;
+}
 
 bool Sphere::hit(const Ray& ray, double t_min, double t_max, hit_record& record) const {
+    if (!intersect(ray, t_min, t_max, record))
+        return false;
+
+    compute_surface(ray, record);
+
+    return true;
+}
+
+bool Sphere::intersect(const Ray& ray, double t_min, double t_max, hit_record& record) const {
     double t0, t1;
     bool result;
 
@@ -101,12 +128,25 @@ bool Sphere::hit(const Ray& ray, double t_min, double t_max, hit_record& record)
     }
 
     record.t = root;
+    record.object = this;
+
+    return true;
+}
+
+void Sphere::compute_surface(const Ray& ray, hit_record& record) const {
     record.point = ray.position(record.t);
     auto normal = (record.point - _center).unit_vector();
     record.set_face_normal(ray, normal);
     record.material = _material;
+}
 
-    return true;
+bool Sphere::occluded(const Ray& ray, double t_min, double t_max) const {
+    double t0, t1;
+
+    if (!hit_algebric(ray, t0, t1))
+        return false;
+
+    return (t_min <= t0 && t0 <= t_max) || (t_min <= t1 && t1 <= t_max);
 }
 
 bool Sphere::bounding_box(AABB& output_box) const {
@@ -117,3 +157,43 @@ bool Sphere::bounding_box(AABB& output_box) const {
 
     return true;
 }
+
+bool Sphere::clip_bounds(const AABB& box, AABB& output_box) const {
+    if (!bounding_box(output_box))
+        return false;
+
+    output_box = AABB::intersection(output_box, box);
+
+    // Points of the sphere with their other two coordinates in the box are at most
+    // sqrt(r^2 - d1^2 - d2^2) away from the center along the remaining axis, d being the distances
+    // from the center to the box slabs. A second pass uses the slabs tightened by the first one.
+    for (int pass = 0; pass < 2; ++pass) {
+        if (output_box.is_empty())
+            return false;
+
+        double distance2[3];
+
+        for (int a = 0; a < 3; ++a) {
+            auto d = std::max({ 0.0, output_box.min()[a] - _center[a], _center[a] - output_box.max()[a] });
+            distance2[a] = d * d;
+        }
+
+        auto min = output_box.min();
+        auto max = output_box.max();
+
+        for (int a = 0; a < 3; ++a) {
+            auto h2 = _radius * _radius - distance2[(a + 1) % 3] - distance2[(a + 2) % 3];
+
+            if (h2 < 0)
+                return false;
+
+            auto h = std::sqrt(h2);
+            min[a] = std::max(min[a], _center[a] - h);
+            max[a] = std::min(max[a], _center[a] + h);
+        }
+
+        output_box = AABB(min, max);
+    }
+
+    return !output_box.is_empty();
+}
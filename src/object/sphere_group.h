@@ -0,0 +1,344 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <typeinfo>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "object/hittable.h"
+#include "object/aabb.h"
+#include "object/bvh_build.h"
+#include "object/sphere.h"
+#include "material/material.h"
+#include "scene/scene.h"
+
+// Up to Width spheres stored per coordinate (SoA), intersected with one SIMD kernel that returns the
+// closest root over every lane. A BVH over groups of nearby spheres has Width times fewer leaves
+// than a BVH over the spheres. The roots are computed as Sphere computes them, so a group reports
+// the same hits as its spheres.
+template <int Width>
+class SphereGroup: public Hittable {
+    static_assert(Width == 4 || Width == 8, "SphereGroup supports 4 and 8 spheres");
+
+    public:
+        SphereGroup();
+
+        // Returns false when the group is full
+        bool add(const Point3D& center, double radius, MaterialId material);
+
+        virtual bool hit(const Ray& ray, double t_min, double t_max, hit_record& record) const override;
+        virtual bool intersect(const Ray& ray, double t_min, double t_max, hit_record& record) const override;
+        virtual void compute_surface(const Ray& ray, hit_record& record) const override;
+        virtual bool occluded(const Ray& ray, double t_min, double t_max) const override;
+        virtual bool bounding_box(AABB& output_box) const override;
+
+        int size() const { return _count; }
+
+        // Bit mask of the spheres with a root within [t_min, t_max], writes the nearest such root of
+        // every lane
+        int intersect_lanes(const Ray& ray, double t_min, double t_max, double* t) const;
+
+    private:
+        double _center[3][Width];
+        double _radius[Width];
+        MaterialId _material[Width];
+        int _count = 0;
+        AABB _box = AABB::empty();
+};
+
+// `objects` with its spheres gathered into groups of up to Width nearby spheres (the leaves of a SAH
+// build over the spheres), other objects are kept as they are. Exact Spheres only, a subclass may
+// override hit().
+template <int Width>
+Objects group_spheres(const Objects& objects, BVHBuildOptions options = BVHBuildOptions());
+
+template <int Width>
+SphereGroup<Width>::SphereGroup() {
+    // The kernels read every lane, unused ones are masked out
+    for (int lane = 0; lane < Width; ++lane) {
+        for (int a = 0; a < 3; ++a)
+            _center[a][lane] = 0;
+
+        _radius[lane] = 0;
+        _material[lane] = 0;
+    }
+}
+
+template <int Width>
+bool SphereGroup<Width>::add(const Point3D& center, double radius, MaterialId material) {
+    if (_count == Width)
+        return false;
+
+    for (int a = 0; a < 3; ++a)
+        _center[a][_count] = center[a];
+
+    _radius[_count] = radius;
+    _material[_count] = material;
+    _count++;
+
+    auto extent = Vector3(radius, radius, radius);
+    _box = AABB::surrounding_box(_box, AABB(center - extent, center + extent));
+
+    return true;
+}
+
+template <int Width>
+int SphereGroup<Width>::intersect_lanes(const Ray& ray, double t_min, double t_max, double* t) const {
+    const auto& origin = ray.origin();
+    const auto& direction = ray.direction();
+    const int used = (1 << _count) - 1;
+
+#if defined(__AVX512F__)
+    if constexpr (Width == 8) {
+        auto ocx = _mm512_sub_pd(_mm512_set1_pd(origin.x()), _mm512_loadu_pd(_center[0]));
+        auto ocy = _mm512_sub_pd(_mm512_set1_pd(origin.y()), _mm512_loadu_pd(_center[1]));
+        auto ocz = _mm512_sub_pd(_mm512_set1_pd(origin.z()), _mm512_loadu_pd(_center[2]));
+        auto radius = _mm512_loadu_pd(_radius);
+
+        // (o + tD - C)^2 = R^2 with a = 1, as Sphere::hit_algebric
+        auto dot = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(ocx, _mm512_set1_pd(direction.x())), _mm512_mul_pd(ocy, _mm512_set1_pd(direction.y()))),
+                                 _mm512_mul_pd(ocz, _mm512_set1_pd(direction.z())));
+        auto b = _mm512_mul_pd(_mm512_set1_pd(2), dot);
+        auto squared_length = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(ocx, ocx), _mm512_mul_pd(ocy, ocy)), _mm512_mul_pd(ocz, ocz));
+        auto c = _mm512_sub_pd(squared_length, _mm512_mul_pd(radius, radius));
+        auto discriminant = _mm512_sub_pd(_mm512_mul_pd(b, b), _mm512_mul_pd(_mm512_set1_pd(4), c));
+
+        __mmask8 real = _mm512_cmp_pd_mask(discriminant, _mm512_setzero_pd(), _CMP_GE_OQ);
+        auto sqrtd = _mm512_sqrt_pd(discriminant);
+        auto half = _mm512_set1_pd(0.5);
+        auto t0 = _mm512_mul_pd(_mm512_sub_pd(_mm512_sub_pd(_mm512_setzero_pd(), b), sqrtd), half);
+        auto t1 = _mm512_mul_pd(_mm512_add_pd(_mm512_sub_pd(_mm512_setzero_pd(), b), sqrtd), half);
+
+        auto lo = _mm512_set1_pd(t_min);
+        auto hi = _mm512_set1_pd(t_max);
+        __mmask8 hit0 = real & _mm512_cmp_pd_mask(t0, lo, _CMP_GE_OQ) & _mm512_cmp_pd_mask(t0, hi, _CMP_LE_OQ);
+        __mmask8 hit1 = real & _mm512_cmp_pd_mask(t1, lo, _CMP_GE_OQ) & _mm512_cmp_pd_mask(t1, hi, _CMP_LE_OQ);
+
+        // The near root when it is in range, the far one otherwise
+        _mm512_storeu_pd(t, _mm512_mask_blend_pd(hit0, t1, t0));
+
+        return (hit0 | hit1) & used;
+    }
+#endif
+
+#if defined(__AVX__)
+    int mask = 0;
+
+    auto dx = _mm256_set1_pd(direction.x());
+    auto dy = _mm256_set1_pd(direction.y());
+    auto dz = _mm256_set1_pd(direction.z());
+    auto zero = _mm256_setzero_pd();
+    auto half = _mm256_set1_pd(0.5);
+    auto lo = _mm256_set1_pd(t_min);
+    auto hi = _mm256_set1_pd(t_max);
+
+    for (int lane = 0; lane < _count; lane += 4) {
+        auto ocx = _mm256_sub_pd(_mm256_set1_pd(origin.x()), _mm256_loadu_pd(_center[0] + lane));
+        auto ocy = _mm256_sub_pd(_mm256_set1_pd(origin.y()), _mm256_loadu_pd(_center[1] + lane));
+        auto ocz = _mm256_sub_pd(_mm256_set1_pd(origin.z()), _mm256_loadu_pd(_center[2] + lane));
+        auto radius = _mm256_loadu_pd(_radius + lane);
+
+        // (o + tD - C)^2 = R^2 with a = 1, as Sphere::hit_algebric
+        auto dot = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ocx, dx), _mm256_mul_pd(ocy, dy)), _mm256_mul_pd(ocz, dz));
+        auto b = _mm256_mul_pd(_mm256_set1_pd(2), dot);
+        auto squared_length = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ocx, ocx), _mm256_mul_pd(ocy, ocy)), _mm256_mul_pd(ocz, ocz));
+        auto c = _mm256_sub_pd(squared_length, _mm256_mul_pd(radius, radius));
+        auto discriminant = _mm256_sub_pd(_mm256_mul_pd(b, b), _mm256_mul_pd(_mm256_set1_pd(4), c));
+
+        auto real = _mm256_cmp_pd(discriminant, zero, _CMP_GE_OQ);
+        auto sqrtd = _mm256_sqrt_pd(discriminant);
+        auto t0 = _mm256_mul_pd(_mm256_sub_pd(_mm256_sub_pd(zero, b), sqrtd), half);
+        auto t1 = _mm256_mul_pd(_mm256_add_pd(_mm256_sub_pd(zero, b), sqrtd), half);
+
+        auto hit0 = _mm256_and_pd(real, _mm256_and_pd(_mm256_cmp_pd(t0, lo, _CMP_GE_OQ), _mm256_cmp_pd(t0, hi, _CMP_LE_OQ)));
+        auto hit1 = _mm256_and_pd(real, _mm256_and_pd(_mm256_cmp_pd(t1, lo, _CMP_GE_OQ), _mm256_cmp_pd(t1, hi, _CMP_LE_OQ)));
+
+        // The near root when it is in range, the far one otherwise
+        _mm256_storeu_pd(t + lane, _mm256_blendv_pd(t1, t0, hit0));
+        mask |= _mm256_movemask_pd(_mm256_or_pd(hit0, hit1)) << lane;
+    }
+
+    return mask & used;
+#elif defined(__SSE2__)
+    int mask = 0;
+
+    auto dx = _mm_set1_pd(direction.x());
+    auto dy = _mm_set1_pd(direction.y());
+    auto dz = _mm_set1_pd(direction.z());
+    auto zero = _mm_setzero_pd();
+    auto half = _mm_set1_pd(0.5);
+    auto lo = _mm_set1_pd(t_min);
+    auto hi = _mm_set1_pd(t_max);
+
+    for (int lane = 0; lane < _count; lane += 2) {
+        auto ocx = _mm_sub_pd(_mm_set1_pd(origin.x()), _mm_loadu_pd(_center[0] + lane));
+        auto ocy = _mm_sub_pd(_mm_set1_pd(origin.y()), _mm_loadu_pd(_center[1] + lane));
+        auto ocz = _mm_sub_pd(_mm_set1_pd(origin.z()), _mm_loadu_pd(_center[2] + lane));
+        auto radius = _mm_loadu_pd(_radius + lane);
+
+        // (o + tD - C)^2 = R^2 with a = 1, as Sphere::hit_algebric
+        auto dot = _mm_add_pd(_mm_add_pd(_mm_mul_pd(ocx, dx), _mm_mul_pd(ocy, dy)), _mm_mul_pd(ocz, dz));
+        auto b = _mm_mul_pd(_mm_set1_pd(2), dot);
+        auto squared_length = _mm_add_pd(_mm_add_pd(_mm_mul_pd(ocx, ocx), _mm_mul_pd(ocy, ocy)), _mm_mul_pd(ocz, ocz));
+        auto c = _mm_sub_pd(squared_length, _mm_mul_pd(radius, radius));
+        auto discriminant = _mm_sub_pd(_mm_mul_pd(b, b), _mm_mul_pd(_mm_set1_pd(4), c));
+
+        auto real = _mm_cmpge_pd(discriminant, zero);
+        auto sqrtd = _mm_sqrt_pd(discriminant);
+        auto t0 = _mm_mul_pd(_mm_sub_pd(_mm_sub_pd(zero, b), sqrtd), half);
+        auto t1 = _mm_mul_pd(_mm_add_pd(_mm_sub_pd(zero, b), sqrtd), half);
+
+        auto hit0 = _mm_and_pd(real, _mm_and_pd(_mm_cmpge_pd(t0, lo), _mm_cmple_pd(t0, hi)));
+        auto hit1 = _mm_and_pd(real, _mm_and_pd(_mm_cmpge_pd(t1, lo), _mm_cmple_pd(t1, hi)));
+
+        // The near root when it is in range, the far one otherwise (SSE2 has no blendv)
+        _mm_storeu_pd(t + lane, _mm_or_pd(_mm_and_pd(hit0, t0), _mm_andnot_pd(hit0, t1)));
+        mask |= _mm_movemask_pd(_mm_or_pd(hit0, hit1)) << lane;
+    }
+
+    return mask & used;
+#else
+    int mask = 0;
+
+    for (int lane = 0; lane < _count; ++lane) {
+        auto oc = origin - Point3D(_center[0][lane], _center[1][lane], _center[2][lane]);
+        auto b = 2 * Vector3::dot_product(oc, direction);
+        auto c = oc.squared_length() - _radius[lane] * _radius[lane];
+        auto discriminant = b * b - 4 * c;
+
+        if (discriminant < 0)
+            continue;
+
+        auto sqrtd = std::sqrt(discriminant);
+        auto t0 = (-b - sqrtd) / 2;
+        auto t1 = (-b + sqrtd) / 2;
+
+        if (t_min <= t0 && t0 <= t_max)
+            t[lane] = t0;
+        else if (t_min <= t1 && t1 <= t_max)
+            t[lane] = t1;
+        else
+            continue;
+
+        mask |= 1 << lane;
+    }
+
+    return mask & used;
+#endif
+}
+
+template <int Width>
+bool SphereGroup<Width>::hit(const Ray& ray, double t_min, double t_max, hit_record& record) const {
+    if (!intersect(ray, t_min, t_max, record))
+        return false;
+
+    compute_surface(ray, record);
+
+    return true;
+}
+
+template <int Width>
+bool SphereGroup<Width>::intersect(const Ray& ray, double t_min, double t_max, hit_record& record) const {
+    double t[Width];
+    int mask = intersect_lanes(ray, t_min, t_max, t);
+    int nearest = -1;
+
+    while (mask) {
+        int lane = __builtin_ctz(mask);
+        mask &= mask - 1;
+
+        if (nearest < 0 || t[lane] < t[nearest])
+            nearest = lane;
+    }
+
+    if (nearest < 0)
+        return false;
+
+    record.t = t[nearest];
+    record.primitive = static_cast<uint32_t>(nearest);
+    record.object = this;
+
+    return true;
+}
+
+template <int Width>
+void SphereGroup<Width>::compute_surface(const Ray& ray, hit_record& record) const {
+    auto lane = record.primitive;
+    auto center = Point3D(_center[0][lane], _center[1][lane], _center[2][lane]);
+
+    record.point = ray.position(record.t);
+    record.set_face_normal(ray, (record.point - center).unit_vector());
+    record.material = _material[lane];
+}
+
+template <int Width>
+bool SphereGroup<Width>::occluded(const Ray& ray, double t_min, double t_max) const {
+    double t[Width];
+
+    return intersect_lanes(ray, t_min, t_max, t) != 0;
+}
+
+template <int Width>
+bool SphereGroup<Width>::bounding_box(AABB& output_box) const {
+    output_box = _box;
+
+    return _count > 0;
+}
+
+template <int Width>
+Objects group_spheres(const Objects& objects, BVHBuildOptions options) {
+    Objects grouped, spheres;
+
+    for (const auto& object : objects) {
+        if (typeid(*object) == typeid(Sphere))
+            spheres.push_back(object);
+        else
+            grouped.push_back(object);
+    }
+
+    if (spheres.empty())
+        return grouped;
+
+    // Leaves of at most one group, which the SAH costs as a single intersection
+    options.split_method = BVHSplitMethod::SAH;
+    options.max_leaf_size = Width;
+    options.leaf_block_size = Width;
+
+    auto builder = BVHBuilder(spheres, options);
+    auto root = builder.build();
+    const auto& order = builder.ordered_indices();
+
+    std::vector<const BVHBuildNode*> stack = { root.get() };
+
+    while (!stack.empty()) {
+        const auto* node = stack.back();
+        stack.pop_back();
+
+        if (!node->is_leaf()) {
+            stack.push_back(node->children[0].get());
+            stack.push_back(node->children[1].get());
+            continue;
+        }
+
+        // Leaves the builder could not split (coincident centers) may hold more than Width spheres
+        std::shared_ptr<SphereGroup<Width>> group;
+
+        for (auto i = node->first; i < node->first + node->count; ++i) {
+            const auto& sphere = static_cast<const Sphere&>(*spheres[order[i]]);
+
+            if (!group || group->size() == Width) {
+                group = std::make_shared<SphereGroup<Width>>();
+                grouped.push_back(group);
+            }
+
+            group->add(sphere.center(), sphere.radius(), sphere.material());
+        }
+    }
+
+    return grouped;
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <memory>
+#include <type_traits>
+#include <typeinfo>
+#include <variant>
+#include <vector>
+
+#include "object/hittable.h"
+#include "object/aabb.h"
+#include "object/linear_bvh.h"
+#include "object/sphere.h"
+#include "object/triangle.h"
+#include "scene/scene.h"
+
+// Closed set of primitive types, stored by value and intersected without a virtual call. Any other
+// Hittable keeps its pointer and the virtual interface.
+using Primitive = std::variant<Sphere, Triangle, std::shared_ptr<Hittable>>;
+
+inline Primitive make_primitive(const std::shared_ptr<Hittable>& object) {
+    // Exact types only, a subclass may override hit()
+    const auto& type = typeid(*object);
+
+    if (type == typeid(Sphere))
+        return static_cast<const Sphere&>(*object);
+
+    if (type == typeid(Triangle))
+        return static_cast<const Triangle&>(*object);
+
+    return object;
+}
+
+inline bool intersect(const Primitive& primitive, const Ray& ray, double t_min, double t_max, hit_record& record) {
+    return std::visit([&](const auto& object) {
+        using T = std::decay_t<decltype(object)>;
+
+        if constexpr (std::is_same<T, std::shared_ptr<Hittable>>::value)
+            return object->intersect(ray, t_min, t_max, record);
+        else
+            return object.T::intersect(ray, t_min, t_max, record);
+    }, primitive);
+}
+
+inline bool occluded(const Primitive& primitive, const Ray& ray, double t_min, double t_max) {
+    return std::visit([&](const auto& object) {
+        using T = std::decay_t<decltype(object)>;
+
+        if constexpr (std::is_same<T, std::shared_ptr<Hittable>>::value)
+            return object->occluded(ray, t_min, t_max);
+        else
+            return object.T::occluded(ray, t_min, t_max);
+    }, primitive);
+}
+
+// LinearBVH whose leaves hold Primitives instead of Hittable pointers, so the leaf tests dispatch
+// on a switch and can be inlined into the traversal. The primitives are copied at construction:
+// spheres moved afterwards are not seen, use LinearBVH for scenes that are refitted.
+class StaticBVH: public Hittable {
+    public:
+        StaticBVH(const Scene& scene, const BVHBuildOptions& options = BVHBuildOptions());
+        StaticBVH(const Objects& objects, const BVHBuildOptions& options = BVHBuildOptions());
+
+        virtual bool hit(const Ray& ray, double t_min, double t_max, hit_record& record) const override;
+        virtual bool intersect(const Ray& ray, double t_min, double t_max, hit_record& record) const override;
+        virtual bool occluded(const Ray& ray, double t_min, double t_max) const override;
+        virtual bool bounding_box(AABB& output_box) const override;
+
+        // Primitives kept behind the virtual interface
+        std::size_t virtual_primitive_count() const;
+        std::size_t memory_usage() const;
+
+    private:
+        LinearBVH _bvh;
+        std::vector<Primitive> _primitives;
+};
+
+StaticBVH::StaticBVH(const Scene& scene, const BVHBuildOptions& options) : StaticBVH(scene.objects(), options) {}
+
+StaticBVH::StaticBVH(const Objects& objects, const BVHBuildOptions& options) : _bvh(objects, options) {
+    _primitives.reserve(_bvh.primitives().size());
+
+    for (const auto& object : _bvh.primitives())
+        _primitives.push_back(make_primitive(object));
+}
+
+bool StaticBVH::hit(const Ray& ray, double t_min, double t_max, hit_record& record) const {
+    if (!intersect(ray, t_min, t_max, record))
+        return false;
+
+    record.object->compute_surface(ray, record);
+
+    return true;
+}
+
+bool StaticBVH::intersect(const Ray& ray, double t_min, double t_max, hit_record& record) const {
+    return _bvh.traverse(ray, t_min, t_max, [&](uint32_t first, uint32_t count, double& t_max) {
+        bool has_hit = false;
+
+        for (uint32_t i = first; i < first + count; ++i) {
+            if (::intersect(_primitives[i], ray, t_min, t_max, record)) {
+                has_hit = true;
+                t_max = record.t;
+            }
+        }
+
+        return has_hit;
+    });
+}
+
+bool StaticBVH::occluded(const Ray& ray, double t_min, double t_max) const {
+    return _bvh.traverse_any(ray, t_min, t_max, [&](uint32_t first, uint32_t count) {
+        for (uint32_t i = first; i < first + count; ++i) {
+            if (::occluded(_primitives[i], ray, t_min, t_max))
+                return true;
+        }
+
+        return false;
+    });
+}
+
+bool StaticBVH::bounding_box(AABB& output_box) const {
+    return _bvh.bounding_box(output_box);
+}
+
+std::size_t StaticBVH::virtual_primitive_count() const {
+    std::size_t count = 0;
+
+    for (const auto& primitive : _primitives)
+        count += std::holds_alternative<std::shared_ptr<Hittable>>(primitive);
+
+    return count;
+}
+
+std::size_t StaticBVH::memory_usage() const {
+    return _bvh.memory_usage() + _primitives.size() * sizeof(Primitive);
+}
@@ -1,26 +1,276 @@
 #pragma once
 
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
 #include "object/hittable.h"
+#include "object/aabb.h"
+#include "material/material.h"
+#include "utils/vector3.h"
+#include "utils/macro.h"
+
+enum class TriangleTest {
+    // Möller and Trumbore, "Fast, Minimum Storage Ray/Triangle Intersection". Rays through a shared
+    // edge can slip between the two triangles.
+    MollerTrumbore,
+    // Woop, Benthin and Wald, "Watertight Ray/Triangle Intersection". Slower, but a ray hits at
+    // least one of the triangles sharing an edge, for closed meshes.
+    Watertight
+};
 
-class Triangle : public Hittable {
+class Triangle: public Hittable {
     public:
         Triangle() {}
-        Triangle(Vector3 a, Vector3 b, Vector3 c, std::shared_ptr<Material> material) : _a(a), _b(b), _c(c) {
-            _edge1 = b - a;
-            _edge2 = c - a;
-            normal = Vector3::cross_product(edge1, edge2).unit_vector();
-        };
-
-    virtual bool hit(const ray& r, Float t_min, Float t_max, hit_record& rec, random_gen& rng);
-    virtual bool bounding_box(Float t0, Float t1, aabb& box) const;
-
-    vec3 normal;
-    vec3 a, b, c, na, nb, nc;
-    vec3 edge1, edge2;
-    Float area;
-    bool normals_provided;
-    bool single;
-    std::shared_ptr<material> mp;
-    std::shared_ptr<alpha_texture> alpha_mask;
-    std::shared_ptr<bump_texture> bump_tex;
+        Triangle(const Point3D& a, const Point3D& b, const Point3D& c, MaterialId material, TriangleTest test = TriangleTest::MollerTrumbore);
+
+        virtual bool hit(const Ray& ray, double t_min, double t_max, hit_record& record) const override;
+        virtual bool intersect(const Ray& ray, double t_min, double t_max, hit_record& record) const override;
+        virtual void compute_surface(const Ray& ray, hit_record& record) const override;
+        virtual bool occluded(const Ray& ray, double t_min, double t_max) const override;
+        virtual bool bounding_box(AABB& output_box) const override;
+        virtual bool clip_bounds(const AABB& box, AABB& output_box) const override;
+        // The vertices: spatial splits clip triangles with the same box differently
+        virtual void hash_geometry(Hasher& hasher) const override;
+
+        inline Point3D vertex(int index) const { return _vertices[index]; }
+        inline Vector3 normal() const { return _normal; }
+
+        // Distance along the ray and barycentrics of vertices b and c, also used by Mesh
+        inline static bool moller_trumbore(const Ray& ray, const Point3D& a, const Vector3& edge1, const Vector3& edge2, double& t, double& u, double& v);
+        // Takes the vertices themselves rather than edges, so that triangles sharing an edge transform
+        // it with exactly the same operations. Never contracted to FMAs, which would break that.
+        NO_FP_CONTRACT inline static bool watertight(const Ray& ray, const Point3D& a, const Point3D& b, const Point3D& c, double& t, double& u, double& v);
+
+        // Axis-aligned triangles have flat boxes, which AABB::hit never reports as hit
+        inline static AABB pad_flat_axes(const AABB& box);
+
+    private:
+        inline bool intersect_any(const Ray& ray, double& t, double& u, double& v) const {
+            if (_test == TriangleTest::Watertight)
+                return watertight(ray, _vertices[0], _vertices[1], _vertices[2], t, u, v);
+
+            return moller_trumbore(ray, _vertices[0], _edge1, _edge2, t, u, v);
+        }
+
+        Point3D _vertices[3];
+        Vector3 _edge1;
+        Vector3 _edge2;
+        Vector3 _normal;
+        MaterialId _material;
+        TriangleTest _test;
 };
+
+Triangle::Triangle(const Point3D& a, const Point3D& b, const Point3D& c, MaterialId material, TriangleTest test)
+    : _vertices{ a, b, c }, _edge1(b - a), _edge2(c - a), _material(material), _test(test) {
+    _normal = Vector3::cross_product(_edge1, _edge2).unit_vector();
+}
+
+inline bool Triangle::moller_trumbore(const Ray& ray, const Point3D& a, const Vector3& edge1, const Vector3& edge2, double& t, double& u, double& v) {
+    auto p = Vector3::cross_product(ray.direction(), edge2);
+    auto determinant = Vector3::dot_product(edge1, p);
+
+    // The ray is parallel to the triangle (or the triangle is degenerate)
+    if (std::fabs(determinant) < 1e-12)
+        return false;
+
+    auto inv_determinant = 1 / determinant;
+    auto s = ray.origin() - a;
+    u = Vector3::dot_product(s, p) * inv_determinant;
+
+    if (u < 0 || u > 1)
+        return false;
+
+    auto q = Vector3::cross_product(s, edge1);
+    v = Vector3::dot_product(ray.direction(), q) * inv_determinant;
+
+    if (v < 0 || u + v > 1)
+        return false;
+
+    t = Vector3::dot_product(edge2, q) * inv_determinant;
+
+    return true;
+}
+
+NO_FP_CONTRACT inline bool Triangle::watertight(const Ray& ray, const Point3D& vertex_a, const Point3D& vertex_b, const Point3D& vertex_c, double& t, double& u, double& v) {
+#if defined(__clang__)
+#pragma clang fp contract(off)
+#endif
+    auto direction = ray.direction();
+
+    // Ray space: the largest direction axis becomes z, x and y are sheared so the ray is +z
+    int kz = std::fabs(direction.x()) > std::fabs(direction.y())
+        ? (std::fabs(direction.x()) > std::fabs(direction.z()) ? 0 : 2)
+        : (std::fabs(direction.y()) > std::fabs(direction.z()) ? 1 : 2);
+    int kx = (kz + 1) % 3;
+    int ky = (kx + 1) % 3;
+
+    // Keeps the winding of the triangle
+    if (direction[kz] < 0)
+        std::swap(kx, ky);
+
+    auto sx = direction[kx] / direction[kz];
+    auto sy = direction[ky] / direction[kz];
+    auto sz = 1 / direction[kz];
+
+    auto a = vertex_a - ray.origin();
+    auto b = vertex_b - ray.origin();
+    auto c = vertex_c - ray.origin();
+
+    auto ax = a[kx] - sx * a[kz];
+    auto ay = a[ky] - sy * a[kz];
+    auto bx = b[kx] - sx * b[kz];
+    auto by = b[ky] - sy * b[kz];
+    auto cx = c[kx] - sx * c[kz];
+    auto cy = c[ky] - sy * c[kz];
+
+    // Scaled barycentrics, edges are tested with the same operations from both sides
+    auto w_a = cx * by - cy * bx;
+    auto w_b = ax * cy - ay * cx;
+    auto w_c = bx * ay - by * ax;
+
+    // A ray exactly on an edge: the sign of its edge function decides which triangle gets the ray,
+    // recomputed in higher precision as in the paper
+    if (w_a == 0 || w_b == 0 || w_c == 0) {
+        w_a = static_cast<double>(static_cast<long double>(cx) * by - static_cast<long double>(cy) * bx);
+        w_b = static_cast<double>(static_cast<long double>(ax) * cy - static_cast<long double>(ay) * cx);
+        w_c = static_cast<double>(static_cast<long double>(bx) * ay - static_cast<long double>(by) * ax);
+    }
+
+    if ((w_a < 0 || w_b < 0 || w_c < 0) && (w_a > 0 || w_b > 0 || w_c > 0))
+        return false;
+
+    auto determinant = w_a + w_b + w_c;
+
+    if (determinant == 0)
+        return false;
+
+    auto distance = w_a * sz * a[kz] + w_b * sz * b[kz] + w_c * sz * c[kz];
+    auto inv_determinant = 1 / determinant;
+
+    t = distance * inv_determinant;
+    u = w_b * inv_determinant;
+    v = w_c * inv_determinant;
+
+    return true;
+}
+
+bool Triangle::hit(const Ray& ray, double t_min, double t_max, hit_record& record) const {
+    if (!intersect(ray, t_min, t_max, record))
+        return false;
+
+    compute_surface(ray, record);
+
+    return true;
+}
+
+bool Triangle::intersect(const Ray& ray, double t_min, double t_max, hit_record& record) const {
+    double t, u, v;
+
+    if (!intersect_any(ray, t, u, v) || t < t_min || t_max < t)
+        return false;
+
+    record.t = t;
+    record.u = u;
+    record.v = v;
+    record.object = this;
+
+    return true;
+}
+
+void Triangle::compute_surface(const Ray& ray, hit_record& record) const {
+    record.point = ray.position(record.t);
+    record.set_face_normal(ray, _normal);
+    record.material = _material;
+}
+
+bool Triangle::occluded(const Ray& ray, double t_min, double t_max) const {
+    double t, u, v;
+
+    return intersect_any(ray, t, u, v) && t_min <= t && t <= t_max;
+}
+
+bool Triangle::bounding_box(AABB& output_box) const {
+    output_box = AABB::empty();
+
+    for (const auto& vertex : _vertices)
+        output_box = AABB::surrounding_box(output_box, vertex);
+
+    output_box = pad_flat_axes(output_box);
+
+    return true;
+}
+
+void Triangle::hash_geometry(Hasher& hasher) const {
+    for (const auto& vertex : _vertices)
+        for (int a = 0; a < 3; ++a)
+            hasher.add(vertex[a]);
+}
+
+inline AABB Triangle::pad_flat_axes(const AABB& box) {
+    auto min = box.min();
+    auto max = box.max();
+    auto padding = 1e-8 * std::max({ 1.0, max.x() - min.x(), max.y() - min.y(), max.z() - min.z() });
+
+    for (int a = 0; a < 3; ++a) {
+        if (max[a] - min[a] < padding) {
+            min[a] -= padding;
+            max[a] += padding;
+        }
+    }
+
+    return AABB(min, max);
+}
+
+bool Triangle::clip_bounds(const AABB& box, AABB& output_box) const {
+    // Sutherland-Hodgman: clips the triangle against the 6 slab planes, then bounds what is left
+    std::vector<Point3D> polygon = { vertex(0), vertex(1), vertex(2) };
+    std::vector<Point3D> clipped;
+
+    for (int a = 0; a < 3 && !polygon.empty(); ++a) {
+        for (int side = 0; side < 2 && !polygon.empty(); ++side) {
+            auto plane = side == 0 ? box.min()[a] : box.max()[a];
+            // Positive inside the box
+            auto distance = [&](const Point3D& p) { return side == 0 ? p[a] - plane : plane - p[a]; };
+
+            clipped.clear();
+
+            for (std::size_t i = 0; i < polygon.size(); ++i) {
+                auto p = polygon[i];
+                auto q = polygon[(i + 1) % polygon.size()];
+                auto dp = distance(p);
+                auto dq = distance(q);
+
+                if (dp >= 0)
+                    clipped.push_back(p);
+
+                if ((dp < 0 && dq > 0) || (dp > 0 && dq < 0)) {
+                    auto crossing = p + (dp / (dp - dq)) * (q - p);
+                    // Exactly on the plane, whatever the rounding of the interpolation
+                    crossing[a] = plane;
+                    clipped.push_back(crossing);
+                }
+            }
+
+            std::swap(polygon, clipped);
+        }
+    }
+
+    if (polygon.empty())
+        return false;
+
+    output_box = AABB::empty();
+
+    for (const auto& point : polygon)
+        output_box = AABB::surrounding_box(output_box, point);
+
+    // Keeps the box within the clipping box despite the rounding of the other coordinates
+    output_box = AABB::intersection(output_box, box);
+
+    if (output_box.is_empty())
+        return false;
+
+    output_box = pad_flat_axes(output_box);
+
+    return true;
+}
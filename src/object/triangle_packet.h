@@ -0,0 +1,260 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "object/ray.h"
+#include "object/triangle.h"
+#include "utils/vector3.h"
+
+// Width triangles of a BVH leaf, stored per coordinate (SoA) as a first vertex and two edges, so that
+// one SIMD instruction runs the same step of Möller-Trumbore on every lane. Lanes stay in double
+// precision: a packet reports the same hits as Triangle::moller_trumbore on its triangles.
+template <int Width>
+struct alignas(64) TrianglePacket {
+    static_assert(Width == 4 || Width == 8, "TrianglePacket supports 4 and 8 triangles");
+
+    static constexpr uint32_t empty = std::numeric_limits<uint32_t>::max();
+
+    double v0[3][Width];
+    double edge1[3][Width];
+    double edge2[3][Width];
+    // Index of the triangle of each lane in its mesh, empty for unused lanes
+    uint32_t primitive[Width];
+
+    // Every lane unused: null edges are degenerate and never hit
+    TrianglePacket();
+
+    void set(int lane, const Point3D& a, const Point3D& b, const Point3D& c, uint32_t index);
+
+    // Bit mask of the lanes hit within [t_min, t_max], writes the distance and the barycentrics of
+    // vertices b and c of every lane
+    int intersect(const Ray& ray, double t_min, double t_max, double* t, double* u, double* v) const;
+    // Lane of the closest hit, or -1
+    int nearest(const Ray& ray, double t_min, double t_max, double& t, double& u, double& v) const;
+};
+
+using Triangle4 = TrianglePacket<4>;
+using Triangle8 = TrianglePacket<8>;
+
+template <int Width>
+TrianglePacket<Width>::TrianglePacket() {
+    for (int lane = 0; lane < Width; ++lane) {
+        for (int a = 0; a < 3; ++a)
+            v0[a][lane] = edge1[a][lane] = edge2[a][lane] = 0;
+
+        primitive[lane] = empty;
+    }
+}
+
+template <int Width>
+void TrianglePacket<Width>::set(int lane, const Point3D& a, const Point3D& b, const Point3D& c, uint32_t index) {
+    for (int axis = 0; axis < 3; ++axis) {
+        v0[axis][lane] = a[axis];
+        edge1[axis][lane] = b[axis] - a[axis];
+        edge2[axis][lane] = c[axis] - a[axis];
+    }
+
+    primitive[lane] = index;
+}
+
+template <int Width>
+int TrianglePacket<Width>::intersect(const Ray& ray, double t_min, double t_max, double* t, double* u, double* v) const {
+#if defined(__AVX512F__)
+    if constexpr (Width == 8) {
+        const auto& origin = ray.origin();
+        const auto& direction = ray.direction();
+
+        auto dx = _mm512_set1_pd(direction.x());
+        auto dy = _mm512_set1_pd(direction.y());
+        auto dz = _mm512_set1_pd(direction.z());
+
+        auto e1x = _mm512_load_pd(edge1[0]);
+        auto e1y = _mm512_load_pd(edge1[1]);
+        auto e1z = _mm512_load_pd(edge1[2]);
+        auto e2x = _mm512_load_pd(edge2[0]);
+        auto e2y = _mm512_load_pd(edge2[1]);
+        auto e2z = _mm512_load_pd(edge2[2]);
+
+        // p = direction x edge2
+        auto px = _mm512_sub_pd(_mm512_mul_pd(dy, e2z), _mm512_mul_pd(dz, e2y));
+        auto py = _mm512_sub_pd(_mm512_mul_pd(dz, e2x), _mm512_mul_pd(dx, e2z));
+        auto pz = _mm512_sub_pd(_mm512_mul_pd(dx, e2y), _mm512_mul_pd(dy, e2x));
+        auto determinant = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(e1x, px), _mm512_mul_pd(e1y, py)), _mm512_mul_pd(e1z, pz));
+        auto inv_determinant = _mm512_div_pd(_mm512_set1_pd(1), determinant);
+
+        auto sx = _mm512_sub_pd(_mm512_set1_pd(origin.x()), _mm512_load_pd(v0[0]));
+        auto sy = _mm512_sub_pd(_mm512_set1_pd(origin.y()), _mm512_load_pd(v0[1]));
+        auto sz = _mm512_sub_pd(_mm512_set1_pd(origin.z()), _mm512_load_pd(v0[2]));
+        auto lane_u = _mm512_mul_pd(_mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(sx, px), _mm512_mul_pd(sy, py)), _mm512_mul_pd(sz, pz)), inv_determinant);
+
+        // q = s x edge1
+        auto qx = _mm512_sub_pd(_mm512_mul_pd(sy, e1z), _mm512_mul_pd(sz, e1y));
+        auto qy = _mm512_sub_pd(_mm512_mul_pd(sz, e1x), _mm512_mul_pd(sx, e1z));
+        auto qz = _mm512_sub_pd(_mm512_mul_pd(sx, e1y), _mm512_mul_pd(sy, e1x));
+        auto lane_v = _mm512_mul_pd(_mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(dx, qx), _mm512_mul_pd(dy, qy)), _mm512_mul_pd(dz, qz)), inv_determinant);
+        auto lane_t = _mm512_mul_pd(_mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(e2x, qx), _mm512_mul_pd(e2y, qy)), _mm512_mul_pd(e2z, qz)), inv_determinant);
+
+        auto zero = _mm512_setzero_pd();
+        auto one = _mm512_set1_pd(1);
+
+        // The same rejections as the scalar test, parallel rays and unused lanes included
+        __mmask8 mask = _mm512_cmp_pd_mask(_mm512_abs_pd(determinant), _mm512_set1_pd(1e-12), _CMP_GE_OQ);
+        mask &= _mm512_cmp_pd_mask(lane_u, zero, _CMP_GE_OQ) & _mm512_cmp_pd_mask(lane_u, one, _CMP_LE_OQ);
+        mask &= _mm512_cmp_pd_mask(lane_v, zero, _CMP_GE_OQ) & _mm512_cmp_pd_mask(_mm512_add_pd(lane_u, lane_v), one, _CMP_LE_OQ);
+        mask &= _mm512_cmp_pd_mask(lane_t, _mm512_set1_pd(t_min), _CMP_GE_OQ) & _mm512_cmp_pd_mask(lane_t, _mm512_set1_pd(t_max), _CMP_LE_OQ);
+
+        _mm512_storeu_pd(t, lane_t);
+        _mm512_storeu_pd(u, lane_u);
+        _mm512_storeu_pd(v, lane_v);
+
+        return mask;
+    }
+#endif
+
+#if defined(__AVX__)
+    const auto& origin = ray.origin();
+    const auto& direction = ray.direction();
+    int mask = 0;
+
+    auto dx = _mm256_set1_pd(direction.x());
+    auto dy = _mm256_set1_pd(direction.y());
+    auto dz = _mm256_set1_pd(direction.z());
+    auto sign = _mm256_set1_pd(-0.0);
+    auto zero = _mm256_setzero_pd();
+    auto one = _mm256_set1_pd(1);
+
+    for (int lane = 0; lane < Width; lane += 4) {
+        auto e1x = _mm256_load_pd(edge1[0] + lane);
+        auto e1y = _mm256_load_pd(edge1[1] + lane);
+        auto e1z = _mm256_load_pd(edge1[2] + lane);
+        auto e2x = _mm256_load_pd(edge2[0] + lane);
+        auto e2y = _mm256_load_pd(edge2[1] + lane);
+        auto e2z = _mm256_load_pd(edge2[2] + lane);
+
+        // p = direction x edge2
+        auto px = _mm256_sub_pd(_mm256_mul_pd(dy, e2z), _mm256_mul_pd(dz, e2y));
+        auto py = _mm256_sub_pd(_mm256_mul_pd(dz, e2x), _mm256_mul_pd(dx, e2z));
+        auto pz = _mm256_sub_pd(_mm256_mul_pd(dx, e2y), _mm256_mul_pd(dy, e2x));
+        auto determinant = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(e1x, px), _mm256_mul_pd(e1y, py)), _mm256_mul_pd(e1z, pz));
+        auto inv_determinant = _mm256_div_pd(one, determinant);
+
+        auto sx = _mm256_sub_pd(_mm256_set1_pd(origin.x()), _mm256_load_pd(v0[0] + lane));
+        auto sy = _mm256_sub_pd(_mm256_set1_pd(origin.y()), _mm256_load_pd(v0[1] + lane));
+        auto sz = _mm256_sub_pd(_mm256_set1_pd(origin.z()), _mm256_load_pd(v0[2] + lane));
+        auto lane_u = _mm256_mul_pd(_mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(sx, px), _mm256_mul_pd(sy, py)), _mm256_mul_pd(sz, pz)), inv_determinant);
+
+        // q = s x edge1
+        auto qx = _mm256_sub_pd(_mm256_mul_pd(sy, e1z), _mm256_mul_pd(sz, e1y));
+        auto qy = _mm256_sub_pd(_mm256_mul_pd(sz, e1x), _mm256_mul_pd(sx, e1z));
+        auto qz = _mm256_sub_pd(_mm256_mul_pd(sx, e1y), _mm256_mul_pd(sy, e1x));
+        auto lane_v = _mm256_mul_pd(_mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx, qx), _mm256_mul_pd(dy, qy)), _mm256_mul_pd(dz, qz)), inv_determinant);
+        auto lane_t = _mm256_mul_pd(_mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(e2x, qx), _mm256_mul_pd(e2y, qy)), _mm256_mul_pd(e2z, qz)), inv_determinant);
+
+        // The same rejections as the scalar test, parallel rays and unused lanes included
+        auto valid = _mm256_cmp_pd(_mm256_andnot_pd(sign, determinant), _mm256_set1_pd(1e-12), _CMP_GE_OQ);
+        valid = _mm256_and_pd(valid, _mm256_and_pd(_mm256_cmp_pd(lane_u, zero, _CMP_GE_OQ), _mm256_cmp_pd(lane_u, one, _CMP_LE_OQ)));
+        valid = _mm256_and_pd(valid, _mm256_and_pd(_mm256_cmp_pd(lane_v, zero, _CMP_GE_OQ), _mm256_cmp_pd(_mm256_add_pd(lane_u, lane_v), one, _CMP_LE_OQ)));
+        valid = _mm256_and_pd(valid, _mm256_and_pd(_mm256_cmp_pd(lane_t, _mm256_set1_pd(t_min), _CMP_GE_OQ), _mm256_cmp_pd(lane_t, _mm256_set1_pd(t_max), _CMP_LE_OQ)));
+
+        _mm256_storeu_pd(t + lane, lane_t);
+        _mm256_storeu_pd(u + lane, lane_u);
+        _mm256_storeu_pd(v + lane, lane_v);
+        mask |= _mm256_movemask_pd(valid) << lane;
+    }
+
+    return mask;
+#elif defined(__SSE2__)
+    const auto& origin = ray.origin();
+    const auto& direction = ray.direction();
+    int mask = 0;
+
+    auto dx = _mm_set1_pd(direction.x());
+    auto dy = _mm_set1_pd(direction.y());
+    auto dz = _mm_set1_pd(direction.z());
+    auto sign = _mm_set1_pd(-0.0);
+    auto zero = _mm_setzero_pd();
+    auto one = _mm_set1_pd(1);
+
+    for (int lane = 0; lane < Width; lane += 2) {
+        auto e1x = _mm_load_pd(edge1[0] + lane);
+        auto e1y = _mm_load_pd(edge1[1] + lane);
+        auto e1z = _mm_load_pd(edge1[2] + lane);
+        auto e2x = _mm_load_pd(edge2[0] + lane);
+        auto e2y = _mm_load_pd(edge2[1] + lane);
+        auto e2z = _mm_load_pd(edge2[2] + lane);
+
+        // p = direction x edge2
+        auto px = _mm_sub_pd(_mm_mul_pd(dy, e2z), _mm_mul_pd(dz, e2y));
+        auto py = _mm_sub_pd(_mm_mul_pd(dz, e2x), _mm_mul_pd(dx, e2z));
+        auto pz = _mm_sub_pd(_mm_mul_pd(dx, e2y), _mm_mul_pd(dy, e2x));
+        auto determinant = _mm_add_pd(_mm_add_pd(_mm_mul_pd(e1x, px), _mm_mul_pd(e1y, py)), _mm_mul_pd(e1z, pz));
+        auto inv_determinant = _mm_div_pd(one, determinant);
+
+        auto sx = _mm_sub_pd(_mm_set1_pd(origin.x()), _mm_load_pd(v0[0] + lane));
+        auto sy = _mm_sub_pd(_mm_set1_pd(origin.y()), _mm_load_pd(v0[1] + lane));
+        auto sz = _mm_sub_pd(_mm_set1_pd(origin.z()), _mm_load_pd(v0[2] + lane));
+        auto lane_u = _mm_mul_pd(_mm_add_pd(_mm_add_pd(_mm_mul_pd(sx, px), _mm_mul_pd(sy, py)), _mm_mul_pd(sz, pz)), inv_determinant);
+
+        // q = s x edge1
+        auto qx = _mm_sub_pd(_mm_mul_pd(sy, e1z), _mm_mul_pd(sz, e1y));
+        auto qy = _mm_sub_pd(_mm_mul_pd(sz, e1x), _mm_mul_pd(sx, e1z));
+        auto qz = _mm_sub_pd(_mm_mul_pd(sx, e1y), _mm_mul_pd(sy, e1x));
+        auto lane_v = _mm_mul_pd(_mm_add_pd(_mm_add_pd(_mm_mul_pd(dx, qx), _mm_mul_pd(dy, qy)), _mm_mul_pd(dz, qz)), inv_determinant);
+        auto lane_t = _mm_mul_pd(_mm_add_pd(_mm_add_pd(_mm_mul_pd(e2x, qx), _mm_mul_pd(e2y, qy)), _mm_mul_pd(e2z, qz)), inv_determinant);
+
+        auto valid = _mm_cmpge_pd(_mm_andnot_pd(sign, determinant), _mm_set1_pd(1e-12));
+        valid = _mm_and_pd(valid, _mm_and_pd(_mm_cmpge_pd(lane_u, zero), _mm_cmple_pd(lane_u, one)));
+        valid = _mm_and_pd(valid, _mm_and_pd(_mm_cmpge_pd(lane_v, zero), _mm_cmple_pd(_mm_add_pd(lane_u, lane_v), one)));
+        valid = _mm_and_pd(valid, _mm_and_pd(_mm_cmpge_pd(lane_t, _mm_set1_pd(t_min)), _mm_cmple_pd(lane_t, _mm_set1_pd(t_max))));
+
+        _mm_storeu_pd(t + lane, lane_t);
+        _mm_storeu_pd(u + lane, lane_u);
+        _mm_storeu_pd(v + lane, lane_v);
+        mask |= _mm_movemask_pd(valid) << lane;
+    }
+
+    return mask;
+#else
+    int mask = 0;
+
+    for (int lane = 0; lane < Width; ++lane) {
+        auto a = Point3D(v0[0][lane], v0[1][lane], v0[2][lane]);
+        auto e1 = Vector3(edge1[0][lane], edge1[1][lane], edge1[2][lane]);
+        auto e2 = Vector3(edge2[0][lane], edge2[1][lane], edge2[2][lane]);
+
+        if (Triangle::moller_trumbore(ray, a, e1, e2, t[lane], u[lane], v[lane]) && t_min <= t[lane] && t[lane] <= t_max)
+            mask |= 1 << lane;
+    }
+
+    return mask;
+#endif
+}
+
+template <int Width>
+int TrianglePacket<Width>::nearest(const Ray& ray, double t_min, double t_max, double& t, double& u, double& v) const {
+    double distances[Width], us[Width], vs[Width];
+    int mask = intersect(ray, t_min, t_max, distances, us, vs);
+    int nearest_lane = -1;
+
+    while (mask) {
+        int lane = __builtin_ctz(mask);
+        mask &= mask - 1;
+
+        if (nearest_lane < 0 || distances[lane] < distances[nearest_lane])
+            nearest_lane = lane;
+    }
+
+    if (nearest_lane >= 0) {
+        t = distances[nearest_lane];
+        u = us[nearest_lane];
+        v = vs[nearest_lane];
+    }
+
+    return nearest_lane;
+}
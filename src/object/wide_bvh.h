@@ -0,0 +1,322 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#if defined(__SSE__)
+#include <immintrin.h>
+#endif
+
+#include "object/hittable.h"
+#include "object/aabb.h"
+#include "object/bvh_build.h"
+#include "scene/scene.h"
+
+// Node of a BVH with up to Width children, their bounds stored per axis (SoA) so that one SIMD
+// instruction processes the same slab of every child
+template <int Width>
+struct alignas(64) WideBVHNode {
+    static constexpr uint32_t empty = std::numeric_limits<uint32_t>::max();
+
+    float min[3][Width];
+    float max[3][Width];
+    // Interior child: index of its node, leaf child: index of its first primitive, unused slot: empty
+    uint32_t offset[Width];
+    // Number of primitives of a leaf child, 0 otherwise
+    uint16_t count[Width];
+};
+
+// Ray data shared by every node test: the near and far planes are picked once from the direction sign
+struct WideBVHRay {
+    float origin[3];
+    float inv_direction[3];
+    int direction_is_negative[3];
+};
+
+// BVH4 / BVH8 collapsed from a binary build, traversed with one SIMD box test per node
+template <int Width>
+class WideBVH: public Hittable {
+    static_assert(Width == 4 || Width == 8, "WideBVH supports 4 and 8 children per node");
+
+    public:
+        using Node = WideBVHNode<Width>;
+
+        // Every node can push Width - 1 children, the builder bounds the depth of the binary tree
+        static constexpr int stack_size = 128 * Width;
+        // Slabs are computed in single precision, far distances are padded to stay conservative
+        static constexpr float padding = 1 + 4 * std::numeric_limits<float>::epsilon();
+
+        WideBVH(const Scene& scene, const BVHBuildOptions& options = BVHBuildOptions());
+        WideBVH(const Objects& objects, const BVHBuildOptions& options = BVHBuildOptions());
+
+        virtual bool hit(const Ray& ray, double t_min, double t_max, hit_record& record) const override;
+        virtual bool bounding_box(AABB& output_box) const override;
+
+        std::size_t node_count() const { return _nodes.size(); }
+        std::size_t memory_usage() const;
+
+        // Tests the ray against every child of the node, returns a bit mask of the hit children
+        // and writes their entry distances. Exposed for benchmarks.
+        static int intersect_children(const Node& node, const WideBVHRay& ray, float t_min, float t_max, float* distances);
+
+    private:
+        struct StackEntry {
+            uint32_t offset;
+            uint16_t count;
+            float distance;
+        };
+
+        uint32_t collapse(const BVHBuildNode& node);
+
+        std::vector<Node> _nodes;
+        Objects _primitives;
+        AABB _bounds;
+};
+
+using BVH4 = WideBVH<4>;
+using BVH8 = WideBVH<8>;
+
+template <int Width>
+WideBVH<Width>::WideBVH(const Scene& scene, const BVHBuildOptions& options) : WideBVH(scene.objects(), options) {}
+
+template <int Width>
+WideBVH<Width>::WideBVH(const Objects& objects, const BVHBuildOptions& options) {
+    auto builder = BVHBuilder(objects, options);
+    auto root = builder.build();
+
+    if (!root)
+        return;
+
+    for (auto index : builder.ordered_indices())
+        _primitives.push_back(objects[index]);
+
+    _bounds = root->bounds;
+
+    // A single leaf still needs a node to live in
+    if (root->is_leaf()) {
+        auto wrapper = BVHBuildNode();
+        wrapper.bounds = root->bounds;
+        wrapper.children[0] = std::move(root);
+        collapse(wrapper);
+    } else {
+        collapse(*root);
+    }
+}
+
+// Collapses the binary subtree into wide nodes by opening the largest interior children
+// until the node is full, children are emitted after their parent (depth-first)
+template <int Width>
+uint32_t WideBVH<Width>::collapse(const BVHBuildNode& build_node) {
+    std::vector<const BVHBuildNode*> children;
+
+    for (const auto& child : build_node.children) {
+        if (child)
+            children.push_back(child.get());
+    }
+
+    while (static_cast<int>(children.size()) < Width) {
+        int largest = -1;
+
+        for (std::size_t i = 0; i < children.size(); ++i) {
+            if (!children[i]->is_leaf() && (largest < 0 || children[i]->bounds.surface_area() > children[largest]->bounds.surface_area()))
+                largest = static_cast<int>(i);
+        }
+
+        if (largest < 0)
+            break;
+
+        auto opened = children[largest];
+        children[largest] = opened->children[0].get();
+        children.push_back(opened->children[1].get());
+    }
+
+    auto index = static_cast<uint32_t>(_nodes.size());
+    _nodes.emplace_back();
+
+    for (int i = 0; i < Width; ++i) {
+        // Reference through the index, `_nodes` grows while the children are collapsed
+        auto& node = _nodes[index];
+
+        if (i >= static_cast<int>(children.size())) {
+            for (int a = 0; a < 3; ++a) {
+                node.min[a][i] = INFINITY;
+                node.max[a][i] = -INFINITY;
+            }
+
+            node.offset[i] = Node::empty;
+            node.count[i] = 0;
+            continue;
+        }
+
+        const auto* child = children[i];
+
+        for (int a = 0; a < 3; ++a) {
+            auto lo = static_cast<float>(child->bounds.min()[a]);
+            auto hi = static_cast<float>(child->bounds.max()[a]);
+            node.min[a][i] = lo > child->bounds.min()[a] ? std::nextafter(lo, -INFINITY) : lo;
+            node.max[a][i] = hi < child->bounds.max()[a] ? std::nextafter(hi, INFINITY) : hi;
+        }
+
+        if (child->is_leaf()) {
+            node.offset[i] = static_cast<uint32_t>(child->first);
+            node.count[i] = static_cast<uint16_t>(child->count);
+        } else {
+            auto child_index = collapse(*child);
+            _nodes[index].offset[i] = child_index;
+            _nodes[index].count[i] = 0;
+        }
+    }
+
+    return index;
+}
+
+template <int Width>
+int WideBVH<Width>::intersect_children(const Node& node, const WideBVHRay& ray, float t_min, float t_max, float* distances) {
+    const auto& neg = ray.direction_is_negative;
+
+#if defined(__AVX__)
+    if constexpr (Width == 8) {
+        auto near = _mm256_set1_ps(t_min);
+        auto far = _mm256_set1_ps(t_max);
+
+        for (int a = 0; a < 3; ++a) {
+            auto origin = _mm256_set1_ps(ray.origin[a]);
+            auto inv = _mm256_set1_ps(ray.inv_direction[a]);
+            auto t0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(neg[a] ? node.max[a] : node.min[a]), origin), inv);
+            auto t1 = _mm256_mul_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(neg[a] ? node.min[a] : node.max[a]), origin), inv), _mm256_set1_ps(padding));
+
+            // With NaN (0 * inf) in the first operand, max and min return the second one
+            near = _mm256_max_ps(t0, near);
+            far = _mm256_min_ps(t1, far);
+        }
+
+        _mm256_storeu_ps(distances, near);
+
+        return _mm256_movemask_ps(_mm256_cmp_ps(near, far, _CMP_LE_OQ));
+    }
+#endif
+
+#if defined(__SSE__)
+    int mask = 0;
+
+    for (int lane = 0; lane < Width; lane += 4) {
+        auto near = _mm_set1_ps(t_min);
+        auto far = _mm_set1_ps(t_max);
+
+        for (int a = 0; a < 3; ++a) {
+            auto origin = _mm_set1_ps(ray.origin[a]);
+            auto inv = _mm_set1_ps(ray.inv_direction[a]);
+            auto t0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps((neg[a] ? node.max[a] : node.min[a]) + lane), origin), inv);
+            auto t1 = _mm_mul_ps(_mm_mul_ps(_mm_sub_ps(_mm_load_ps((neg[a] ? node.min[a] : node.max[a]) + lane), origin), inv), _mm_set1_ps(padding));
+
+            near = _mm_max_ps(t0, near);
+            far = _mm_min_ps(t1, far);
+        }
+
+        _mm_storeu_ps(distances + lane, near);
+        mask |= _mm_movemask_ps(_mm_cmple_ps(near, far)) << lane;
+    }
+
+    return mask;
+#else
+    int mask = 0;
+
+    for (int i = 0; i < Width; ++i) {
+        auto near = t_min;
+        auto far = t_max;
+
+        for (int a = 0; a < 3; ++a) {
+            auto t0 = ((neg[a] ? node.max[a][i] : node.min[a][i]) - ray.origin[a]) * ray.inv_direction[a];
+            auto t1 = ((neg[a] ? node.min[a][i] : node.max[a][i]) - ray.origin[a]) * ray.inv_direction[a] * padding;
+
+            near = t0 > near ? t0 : near;
+            far = t1 < far ? t1 : far;
+        }
+
+        distances[i] = near;
+        mask |= (near <= far) << i;
+    }
+
+    return mask;
+#endif
+}
+
+template <int Width>
+bool WideBVH<Width>::hit(const Ray& ray, double t_min, double t_max, hit_record& record) const {
+    if (_nodes.empty())
+        return false;
+
+    WideBVHRay wide_ray;
+
+    for (int a = 0; a < 3; ++a) {
+        wide_ray.origin[a] = static_cast<float>(ray.origin()[a]);
+        wide_ray.inv_direction[a] = static_cast<float>(1.0 / ray.direction()[a]);
+        wide_ray.direction_is_negative[a] = wide_ray.inv_direction[a] < 0;
+    }
+
+    StackEntry stack[stack_size];
+    int stack_top = 0;
+    stack[stack_top++] = { 0, 0, static_cast<float>(t_min) };
+
+    bool has_hit = false;
+    alignas(32) float distances[Width];
+
+    while (stack_top > 0) {
+        auto entry = stack[--stack_top];
+
+        // Entered farther than the closest hit found since it was pushed
+        if (entry.distance > t_max * padding)
+            continue;
+
+        if (entry.count > 0) {
+            for (uint32_t i = entry.offset; i < entry.offset + entry.count; ++i) {
+                if (_primitives[i]->hit(ray, t_min, t_max, record)) {
+                    has_hit = true;
+                    t_max = record.t;
+                }
+            }
+            continue;
+        }
+
+        const auto& node = _nodes[entry.offset];
+        int mask = intersect_children(node, wide_ray, static_cast<float>(t_min), static_cast<float>(t_max) * padding, distances);
+
+        // Push the hit children farthest first, so the nearest one is popped next
+        int first = stack_top;
+
+        while (mask) {
+            int i = __builtin_ctz(mask);
+            mask &= mask - 1;
+
+            auto child = StackEntry { node.offset[i], node.count[i], distances[i] };
+            int j = stack_top++;
+
+            while (j > first && stack[j - 1].distance < child.distance) {
+                stack[j] = stack[j - 1];
+                --j;
+            }
+
+            stack[j] = child;
+        }
+    }
+
+    return has_hit;
+}
+
+template <int Width>
+bool WideBVH<Width>::bounding_box(AABB& output_box) const {
+    if (_nodes.empty())
+        return false;
+
+    output_box = _bounds;
+
+    return true;
+}
+
+template <int Width>
+std::size_t WideBVH<Width>::memory_usage() const {
+    return _nodes.size() * sizeof(Node) + _primitives.size() * sizeof(std::shared_ptr<Hittable>);
+}
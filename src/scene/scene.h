@@ -2,6 +2,7 @@
 
 #include "object/hittable.h"
 #include "object/aabb.h"
+#include "material/material_table.h"
 #include "scene/camera.h"
 #include "utils/image.h"
 #include "utils/progress_bar.h"
@@ -20,11 +21,15 @@ class Scene: public Hittable {
     public:
         Scene(const Camera& camera): _camera(camera) {}
 
-        Objects objects() const;
+        const Objects& objects() const;
         void add_object(std::shared_ptr<Hittable> object);
+        MaterialId add_material(std::shared_ptr<Material> material);
+        const MaterialTable& materials() const;
         void render(const Image& image, const int samples_per_pixel);
 
         virtual bool hit(const Ray& ray, double t_min, double t_max, hit_record& record) const override;
+        virtual bool intersect(const Ray& ray, double t_min, double t_max, hit_record& record) const override;
+        virtual bool occluded(const Ray& ray, double t_min, double t_max) const override;
         virtual bool bounding_box(AABB& output_box) const override;
 
     private:
@@ -32,10 +37,11 @@ class Scene: public Hittable {
         Color ray_color(const Ray& ray, int depth);
 
         Objects _objects;
+        MaterialTable _materials;
         Camera _camera;
 };
 
-Objects Scene::objects() const {
+const Objects& Scene::objects() const {
     return _objects;
 }
 
@@ -46,22 +52,47 @@ void Scene::add_object(std::shared_ptr<Hittable> object) {
     _objects.push_back(object);
 }
 
+MaterialId Scene::add_material(std::shared_ptr<Material> material) {
+    return _materials.add(material);
+}
+
+const MaterialTable& Scene::materials() const {
+    return _materials;
+}
+
 bool Scene::hit(const Ray& ray, double t_min, double t_max, hit_record& record) const {
-    hit_record tmp;
+    if (!intersect(ray, t_min, t_max, record))
+        return false;
+
+    record.object->compute_surface(ray, record);
+
+    return true;
+}
+
+bool Scene::intersect(const Ray& ray, double t_min, double t_max, hit_record& record) const {
     bool has_hit = false;
     auto closest = t_max;
 
+    // Objects only write the record when they find a closer hit
     for (const auto& object : _objects) {
-        if (object->hit(ray, t_min, closest, tmp)) {
+        if (object->intersect(ray, t_min, closest, record)) {
             has_hit = true;
-            closest = tmp.t;
-            record = tmp;
+            closest = record.t;
         }
     }
 
     return has_hit;
 }
 
+bool Scene::occluded(const Ray& ray, double t_min, double t_max) const {
+    for (const auto& object : _objects) {
+        if (object->occluded(ray, t_min, t_max))
+            return true;
+    }
+
+    return false;
+}
+
 bool Scene::bounding_box(AABB& output_box) const {
     if (_objects.empty())
         return false;
@@ -92,7 +123,7 @@ Color Scene::ray_color(const Ray& ray, int depth) {
         Ray scattered;
         Color attenuation;
 
-        if (record.material->scatter(ray, record, attenuation, scattered)) {
+        if (_materials.scatter(record.material, ray, record, attenuation, scattered)) {
             return attenuation * ray_color(scattered, depth - 1);
         }
 
@@ -1,12 +1,44 @@
 #pragma once
 
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <future>
+#include <memory>
+
 #include "utils/vector3.h"
 #include "utils/utils.h"
 
+#include "scene/camera.h"
+#include "scene/scene.h"
+#include "object/bvh_node.h"
+#include "object/linear_bvh.h"
+#include "object/wide_bvh.h"
+#include "object/instance.h"
+#include "object/dynamic_bvh.h"
+#include "object/lazy_bvh.h"
+#include "object/compressed_bvh.h"
+#include "object/bvh_cache.h"
+#include "object/kd_tree.h"
+#include "object/grid.h"
+#include "object/static_bvh.h"
+#include "utils/morton.h"
+#include "object/sphere.h"
+#include "object/triangle.h"
+#include "object/mesh.h"
+#include "object/sphere_group.h"
+#include "object/particle_cloud.h"
+#include "material/lambertian.h"
+#include "material/metal.h"
+#include "material/dielectric.h"
+
 class Tests
 {
     public:
         static void check_vector3();
+        static void check_bvh();
 
     private:
         // Operator vector & scalar
@@ -41,6 +73,44 @@ class Tests
         static void test_squared_length();
         static void test_length();
         static void test_unit_vector();
+
+        // BVH
+        static void test_bvh_median_matches_scene();
+        static void test_bvh_sah_matches_scene();
+        static void test_bvh_sah_leaf_size();
+        static void test_bvh_parallel_build_deterministic();
+        static void test_linear_bvh_matches_scene();
+        static void test_wide_bvh_matches_scene();
+        static void test_wide_bvh_grazing_rays();
+        static void test_radix_sort_morton_codes();
+        static void test_lbvh_matches_scene();
+        static void test_lbvh_treelets_lower_sah_cost();
+        static void test_sbvh_matches_scene();
+        static void test_linear_bvh_siblings_adjacent();
+        static void test_linear_bvh_leaf_size_limit();
+        static void test_instances_match_transformed_spheres();
+        static void test_linear_bvh_refit();
+        static void test_dynamic_bvh_insert_remove();
+        static void test_lazy_bvh_concurrent_first_touch();
+        static void test_linear_bvh_layouts_match();
+        static void test_compressed_bvh_matches_scene();
+        static void test_bvh_cache_round_trip();
+        static void test_kd_tree_matches_scene();
+        static void test_grid_matches_scene();
+        static void test_occluded_matches_hit();
+        static void test_deferred_surface_matches_eager();
+        static void test_static_dispatch_matches_virtual();
+        static void test_triangles_match_scene();
+        static void test_watertight_triangle_edges();
+        static void test_mesh_matches_triangles();
+        static void test_triangle_packets_match_triangles();
+        static void test_sphere_groups_match_spheres();
+        static void test_particle_cloud_matches_spheres();
+
+        // Helpers
+        static Scene random_spheres(int count);
+        static Scene random_triangles(int count, TriangleTest test);
+        static bool same_closest_hits(const Hittable& reference, const Hittable& tested, int ray_count);
 };
 
 // Operator vector & scalar
@@ -204,6 +274,1098 @@ void Tests::test_unit_vector() {
     print_result(result, __FUNCTION__);
 }
 
+// BVH
+
+Scene Tests::random_spheres(int count) {
+    srand(1234);
+
+    auto scene = Scene(Camera(Point3D(0, 0, 10), Point3D(0, 0, 0), Vector3(0, 1, 0), 40.0, 1.0, 10.0));
+    auto material = scene.add_material(std::make_shared<Lambertian>(Color(0.5, 0.5, 0.5)));
+
+    for (int i = 0; i < count; ++i) {
+        auto center = Vector3::random(-5, 5);
+        scene.add_object(std::make_shared<Sphere>(center, random_double(0.05, 0.6), material));
+    }
+
+    return scene;
+}
+
+Scene Tests::random_triangles(int count, TriangleTest test) {
+    srand(4321);
+
+    auto scene = Scene(Camera(Point3D(0, 0, 10), Point3D(0, 0, 0), Vector3(0, 1, 0), 40.0, 1.0, 10.0));
+    auto material = scene.add_material(std::make_shared<Lambertian>(Color(0.5, 0.5, 0.5)));
+
+    for (int i = 0; i < count; ++i) {
+        auto a = Vector3::random(-5, 5);
+        scene.add_object(std::make_shared<Triangle>(a, a + Vector3::random(-1, 1), a + Vector3::random(-1, 1), material, test));
+    }
+
+    return scene;
+}
+
+bool Tests::same_closest_hits(const Hittable& reference, const Hittable& tested, int ray_count) {
+    for (int i = 0; i < ray_count; ++i) {
+        auto ray = Ray(Vector3::random(-8, 8), Vector3::random_in_unit_sphere());
+
+        hit_record expected, record;
+        bool expected_hit = reference.hit(ray, 0.001, infinity, expected);
+        bool has_hit = tested.hit(ray, 0.001, infinity, record);
+
+        if (expected_hit != has_hit)
+            return false;
+
+        if (has_hit && std::fabs(expected.t - record.t) > 1e-9)
+            return false;
+    }
+
+    return true;
+}
+
+void Tests::test_bvh_median_matches_scene() {
+    auto scene = random_spheres(300);
+    BVHBuildOptions options;
+    options.split_method = BVHSplitMethod::RandomMedian;
+    auto bvh = BVHNode(scene, options);
+    auto result = same_closest_hits(scene, bvh, 2000);
+    print_result(result, __FUNCTION__);
+}
+
+void Tests::test_bvh_sah_matches_scene() {
+    auto scene = random_spheres(300);
+    auto bvh = BVHNode(scene, BVHBuildOptions());
+    auto result = same_closest_hits(scene, bvh, 2000);
+    print_result(result, __FUNCTION__);
+}
+
+void Tests::test_bvh_sah_leaf_size() {
+    auto scene = random_spheres(500);
+    BVHBuildOptions options;
+    options.max_leaf_size = 2;
+    auto stats = BVHNode(scene, options).stats();
+    // A binary tree whose leaves hold at most 2 primitives has at least n / 2 leaves
+    auto result = (stats.leaf_count >= 250 && stats.node_count == 2 * stats.leaf_count - 1);
+    print_result(result, __FUNCTION__);
+}
+
+void Tests::test_bvh_parallel_build_deterministic() {
+    auto scene = random_spheres(20000);
+    bool result = true;
+
+    for (auto method : { BVHSplitMethod::SAH, BVHSplitMethod::RandomMedian }) {
+        BVHBuildOptions options;
+        options.split_method = method;
+        options.seed = 7;
+        options.thread_count = 1;
+
+        auto serial = BVHBuilder(scene.objects(), options);
+        serial.build();
+
+        options.thread_count = 4;
+        options.parallel_binning_threshold = 512;
+
+        auto parallel = BVHBuilder(scene.objects(), options);
+        parallel.build();
+
+        result = result && serial.ordered_indices() == parallel.ordered_indices();
+        result = result && serial.stats().node_count == parallel.stats().node_count;
+    }
+
+    // Thresholds under 4 still bin in chunks of at least one primitive
+    auto small_scene = random_spheres(2000);
+    BVHBuildOptions options;
+    options.thread_count = 4;
+    options.parallel_binning_threshold = 1;
+
+    auto serial = LinearBVH(small_scene);
+    auto parallel = LinearBVH(small_scene, options);
+    result = result && parallel.stats().node_count == serial.stats().node_count && same_closest_hits(small_scene, parallel, 500);
+
+    print_result(result, __FUNCTION__);
+}
+
+void Tests::test_linear_bvh_matches_scene() {
+    auto scene = random_spheres(300);
+    auto bvh = LinearBVH(scene);
+    auto result = same_closest_hits(scene, bvh, 2000);
+    print_result(result, __FUNCTION__);
+}
+
+void Tests::test_linear_bvh_siblings_adjacent() {
+    auto scene = random_spheres(300);
+    auto bvh = LinearBVH(scene);
+    const auto& nodes = bvh.nodes();
+
+    // Depth-first over sibling pairs: children always come after their parent, in pairs starting
+    // on even indices (index 1 is padding)
+    bool result = !nodes.empty();
+    std::size_t primitives = 0;
+
+    for (std::size_t i = 0; i < nodes.size(); ++i) {
+        if (i == 1)
+            continue;
+
+        if (nodes[i].is_leaf())
+            primitives += nodes[i].count;
+        else
+            result = result && nodes[i].offset > i && nodes[i].offset % 2 == 0 && nodes[i].offset + 1 < nodes.size();
+    }
+
+    result = result && primitives == 300;
+    print_result(result, __FUNCTION__);
+}
+
+void Tests::test_linear_bvh_leaf_size_limit() {
+    // The median builder keeps a whole range under max_leaf_size as one leaf, whose count must fit
+    // the 16 bits of LinearBVHNode
+    std::vector<AABB> bounds;
+
+    for (int i = 0; i < 70000; ++i) {
+        auto center = Vector3::random(-5, 5);
+        bounds.push_back(AABB(center - Vector3(0.1, 0.1, 0.1), center + Vector3(0.1, 0.1, 0.1)));
+    }
+
+    BVHBuildOptions options;
+    options.split_method = BVHSplitMethod::RandomMedian;
+    options.max_leaf_size = 1 << 20;
+
+    std::vector<std::size_t> order;
+    auto bvh = LinearBVH(bounds, order, options);
+    const auto& nodes = bvh.nodes();
+    std::size_t primitives = 0;
+
+    for (std::size_t i = 0; i < nodes.size(); ++i) {
+        if (i != 1 && nodes[i].is_leaf())
+            primitives += nodes[i].count;
+    }
+
+    auto result = order.size() == bounds.size() && primitives == bounds.size();
+    print_result(result, __FUNCTION__);
+}
+
+void Tests::test_wide_bvh_matches_scene() {
+    auto scene = random_spheres(300);
+    auto result = same_closest_hits(scene, BVH4(scene), 2000) && same_closest_hits(scene, BVH8(scene), 2000);
+
+    // Sparse nodes (empty child slots) and a root leaf
+    auto small = random_spheres(3);
+    result = result && same_closest_hits(small, BVH4(small), 500) && same_closest_hits(small, BVH8(small), 500);
+
+    print_result(result, __FUNCTION__);
+}
+
+void Tests::test_wide_bvh_grazing_rays() {
+    // Rays aimed next to triangle vertices graze the corners of the leaf boxes, where the single
+    // precision slabs must stay as conservative as the ones of LinearBVH
+    auto scene = random_triangles(2000, TriangleTest::MollerTrumbore);
+    auto linear = LinearBVH(scene);
+    auto bvh4 = BVH4(scene);
+    auto bvh8 = BVH8(scene);
+    bool result = true;
+
+    for (int i = 0; i < 20000 && result; ++i) {
+        const auto& triangle = static_cast<const Triangle&>(*scene.objects()[i % scene.objects().size()]);
+        auto target = triangle.vertex(i % 3) + 1e-7 * (triangle.vertex((i + 1) % 3) - triangle.vertex(i % 3));
+        auto origin = Vector3::random(-8, 8);
+        auto ray = Ray(origin, (target - origin).unit_vector());
+
+        hit_record expected, record4, record8;
+        bool expected_hit = linear.hit(ray, 0.001, infinity, expected);
+
+        result = bvh4.hit(ray, 0.001, infinity, record4) == expected_hit && bvh8.hit(ray, 0.001, infinity, record8) == expected_hit;
+        result = result && (!expected_hit || (record4.t == expected.t && record8.t == expected.t));
+    }
+
+    print_result(result, __FUNCTION__);
+}
+
+void Tests::test_radix_sort_morton_codes() {
+    srand(99);
+
+    std::vector<MortonPrimitive> items;
+
+    for (uint32_t i = 0; i < 50000; ++i)
+        items.push_back({ morton_code(random_double(), random_double(), random_double(), 63), i });
+
+    auto expected = items;
+    std::stable_sort(expected.begin(), expected.end(), [](const auto& a, const auto& b) { return a.code < b.code; });
+
+    auto pool = ThreadPool(3);
+    radix_sort(items, 63, &pool);
+
+    bool result = true;
+
+    for (std::size_t i = 0; i < items.size(); ++i)
+        result = result && items[i].code == expected[i].code && items[i].index == expected[i].index;
+
+    print_result(result, __FUNCTION__);
+}
+
+void Tests::test_lbvh_matches_scene() {
+    auto scene = random_spheres(300);
+    bool result = true;
+
+    for (int bits : { 30, 63 }) {
+        BVHBuildOptions options;
+        options.split_method = BVHSplitMethod::LBVH;
+        options.morton_bits = bits;
+
+        result = result && same_closest_hits(scene, LinearBVH(scene, options), 2000);
+    }
+
+    print_result(result, __FUNCTION__);
+}
+
+void Tests::test_lbvh_treelets_lower_sah_cost() {
+    auto scene = random_spheres(2000);
+
+    BVHBuildOptions options;
+    options.split_method = BVHSplitMethod::LBVH;
+
+    auto lbvh = LinearBVH(scene, options);
+
+    options.treelet_size = 7;
+    auto restructured = LinearBVH(scene, options);
+
+    auto result = restructured.stats().sah_cost < lbvh.stats().sah_cost && same_closest_hits(scene, restructured, 2000);
+    print_result(result, __FUNCTION__);
+}
+
+void Tests::test_instances_match_transformed_spheres() {
+    // Flat scene holding a transformed copy of every sphere
+    auto reference = random_spheres(0);
+    srand(99);
+
+    auto material = reference.add_material(std::make_shared<Lambertian>(Color(0.5, 0.5, 0.5)));
+    auto blas_objects = Objects();
+    std::vector<std::pair<Point3D, double>> spheres;
+
+    for (int i = 0; i < 20; ++i) {
+        spheres.push_back({ Vector3::random(-1, 1), random_double(0.05, 0.3) });
+        blas_objects.push_back(std::make_shared<Sphere>(spheres.back().first, spheres.back().second, material));
+    }
+
+    // A single bottom-level BVH shared by every instance
+    auto blas = std::make_shared<LinearBVH>(blas_objects);
+
+    auto instances = Objects();
+
+    for (int i = 0; i < 30; ++i) {
+        auto scale = random_double(0.5, 2);
+        auto transform = Transform::translation(Vector3::random(-6, 6))
+            * Transform::rotation(Vector3::random(-1, 1), random_double(0, 360))
+            * Transform::scaling(scale);
+
+        instances.push_back(std::make_shared<Instance>(blas, transform));
+
+        for (const auto& [center, radius] : spheres)
+            reference.add_object(std::make_shared<Sphere>(transform.point(center), radius * scale, material));
+    }
+
+    auto tlas = LinearBVH(instances);
+    auto result = (blas.use_count() == 31);
+
+    for (int i = 0; i < 2000 && result; ++i) {
+        auto ray = Ray(Vector3::random(-8, 8), Vector3::random_in_unit_sphere());
+
+        hit_record expected, record;
+        bool expected_hit = reference.hit(ray, 0.001, infinity, expected);
+        bool has_hit = tlas.hit(ray, 0.001, infinity, record);
+
+        result = (expected_hit == has_hit);
+
+        if (result && has_hit) {
+            result = std::fabs(expected.t - record.t) < 1e-7
+                && (expected.normal - record.normal).length() < 1e-6
+                && expected.front_face == record.front_face;
+        }
+    }
+
+    auto transform = Transform::translation(Vector3(1, 2, 3)) * Transform::rotation(Vector3(1, 1, 0), 30) * Transform::scaling(Vector3(1, 2, 3));
+    auto point = Point3D(0.5, -2, 4);
+    result = result && (transform.inverse().point(transform.point(point)) - point).length() < 1e-12;
+
+    print_result(result, __FUNCTION__);
+}
+
+void Tests::test_linear_bvh_refit() {
+    auto scene = random_spheres(20000);
+
+    BVHBuildOptions options;
+    options.thread_count = 4;
+
+    auto bvh = LinearBVH(scene, options);
+    auto node_count = bvh.nodes().size();
+
+    // Small moves: refitted, same topology
+    for (const auto& object : scene.objects()) {
+        auto sphere = std::static_pointer_cast<Sphere>(object);
+        sphere->set_center(sphere->center() + Vector3::random(-0.05, 0.05));
+    }
+
+    auto result = !bvh.update() && bvh.nodes().size() == node_count && bvh.sah_ratio() < options.rebuild_sah_ratio;
+    result = result && same_closest_hits(scene, bvh, 2000);
+
+    // Every sphere moved somewhere else: the refitted tree is too degraded and gets rebuilt
+    for (const auto& object : scene.objects())
+        std::static_pointer_cast<Sphere>(object)->set_center(Vector3::random(-5, 5));
+
+    result = result && bvh.update() && bvh.sah_ratio() == 1;
+    result = result && same_closest_hits(scene, bvh, 2000);
+
+    print_result(result, __FUNCTION__);
+}
+
+void Tests::test_dynamic_bvh_insert_remove() {
+    auto scene = random_spheres(3000);
+    const auto& objects = scene.objects();
+
+    auto bvh = DynamicBVH();
+    std::vector<DynamicBVH::Handle> handles;
+
+    for (std::size_t i = 0; i < 2000; ++i)
+        handles.push_back(bvh.insert(objects[i]));
+
+    // Remove every third object, then insert the last thousand
+    auto reference = random_spheres(0);
+
+    for (std::size_t i = 0; i < 2000; ++i) {
+        if (i % 3 == 0)
+            bvh.remove(handles[i]);
+        else
+            reference.add_object(objects[i]);
+    }
+
+    // Removed twice or never inserted: rejected without touching the tree or the free list, which
+    // the inserts below then reuse
+    auto removed_twice = !bvh.remove(handles[0]) && !bvh.remove(handles[1998]) && !bvh.remove(static_cast<DynamicBVH::Handle>(10 * objects.size()))
+        && bvh.size() == reference.objects().size();
+
+    for (std::size_t i = 2000; i < objects.size(); ++i) {
+        bvh.insert(objects[i]);
+        reference.add_object(objects[i]);
+    }
+
+    auto stats = bvh.stats();
+    auto sah_cost = BVHNode(reference, BVHBuildOptions()).stats().sah_cost;
+    const auto& edits = bvh.edit_stats();
+
+    auto result = bvh.size() == reference.objects().size()
+        && stats.leaf_count == bvh.size() && stats.node_count == 2 * bvh.size() - 1
+        && edits.insert_count == 3000 && edits.remove_count == 667
+        // Leaves hold one sphere where the SAH build packs up to four
+        && stats.sah_cost < 2 * sah_cost;
+    result = result && removed_twice && same_closest_hits(reference, bvh, 2000);
+
+    print_result(result, __FUNCTION__);
+}
+
+void Tests::test_lazy_bvh_concurrent_first_touch() {
+    auto scene = random_spheres(5000);
+
+    BVHBuildOptions options;
+    options.lazy_subtree_size = 256;
+
+    std::vector<Ray> rays;
+    std::vector<double> expected;
+
+    for (int i = 0; i < 2000; ++i) {
+        rays.push_back(Ray(Vector3::random(-8, 8), Vector3::random_in_unit_sphere()));
+
+        hit_record record;
+        expected.push_back(scene.hit(rays.back(), 0.001, infinity, record) ? record.t : infinity);
+    }
+
+    auto bvh = LazyBVH(scene, options);
+    auto result = bvh.built_subtree_count() == 0 && bvh.subtree_count() >= 5000 / 256;
+
+    // Every thread traces the same rays, so they reach each subtree at about the same time
+    std::vector<std::future<bool>> futures;
+
+    for (int thread = 0; thread < 4; ++thread) {
+        futures.push_back(std::async(std::launch::async, [&]() {
+            for (std::size_t i = 0; i < rays.size(); ++i) {
+                hit_record record;
+                auto t = bvh.hit(rays[i], 0.001, infinity, record) ? record.t : infinity;
+
+                if (std::fabs(t - expected[i]) > 1e-9 && t != expected[i])
+                    return false;
+            }
+
+            return true;
+        }));
+    }
+
+    for (auto& future : futures)
+        result = future.get() && result;
+
+    auto touched = bvh.built_subtree_count();
+    bvh.build_all();
+
+    result = result && touched > 0 && bvh.built_subtree_count() == bvh.subtree_count();
+    result = result && same_closest_hits(scene, bvh, 2000);
+
+    print_result(result, __FUNCTION__);
+}
+
+void Tests::test_sbvh_matches_scene() {
+    // A few large spheres among small ones, object splits leave them overlapping every child
+    auto scene = random_spheres(1000);
+    auto material = scene.add_material(std::make_shared<Lambertian>(Color(0.5, 0.5, 0.5)));
+
+    for (int i = 0; i < 10; ++i)
+        scene.add_object(std::make_shared<Sphere>(Vector3::random(-5, 5), random_double(2, 4), material));
+
+    BVHBuildOptions options;
+    options.split_method = BVHSplitMethod::SBVH;
+    options.spatial_split_budget = 0.1;
+
+    auto builder = BVHBuilder(scene.objects(), options);
+    builder.build();
+    auto duplicated = builder.stats().duplicated_references;
+
+    auto result = duplicated > 0 && duplicated <= 101 && builder.ordered_indices().size() == 1010 + duplicated;
+    result = result && same_closest_hits(scene, LinearBVH(scene, options), 2000) && same_closest_hits(scene, BVHNode(scene, options), 2000);
+
+    print_result(result, __FUNCTION__);
+}
+
+void Tests::test_linear_bvh_layouts_match() {
+    auto scene = random_spheres(5000);
+    auto depth_first = LinearBVH(scene);
+    auto depth_first_stats = depth_first.stats();
+
+    bool result = true;
+
+    for (auto layout : { BVHNodeLayout::Treelet, BVHNodeLayout::VanEmdeBoas }) {
+        BVHBuildOptions options;
+        options.node_layout = layout;
+
+        auto bvh = LinearBVH(scene, options);
+        auto stats = bvh.stats();
+        const auto& nodes = bvh.nodes();
+
+        // Same tree, only the pairs moved
+        result = result && nodes.size() == depth_first.nodes().size() && stats.node_count == depth_first_stats.node_count;
+        result = result && std::fabs(stats.sah_cost - depth_first_stats.sah_cost) < 1e-9 * depth_first_stats.sah_cost;
+        result = result && reinterpret_cast<std::uintptr_t>(&nodes[2]) % 64 == 0;
+
+        for (std::size_t i = 0; i < nodes.size(); ++i) {
+            if (i != 1 && !nodes[i].is_leaf())
+                result = result && nodes[i].offset > i && nodes[i].offset % 2 == 0 && nodes[i].offset + 1 < nodes.size();
+        }
+
+        result = result && same_closest_hits(scene, bvh, 2000);
+    }
+
+    print_result(result, __FUNCTION__);
+}
+
+void Tests::test_compressed_bvh_matches_scene() {
+    // Small spheres far from the origin, where a quantization step is many float ulps
+    auto scene = random_spheres(3000);
+    auto material = scene.add_material(std::make_shared<Lambertian>(Color(0.5, 0.5, 0.5)));
+
+    for (int i = 0; i < 200; ++i)
+        scene.add_object(std::make_shared<Sphere>(Point3D(5000, 0, 0) + Vector3::random(-1, 1), 0.05, material));
+
+    auto bvh8 = CompressedBVH8(scene);
+    auto bvh16 = CompressedBVH16(scene);
+    auto single = random_spheres(3);
+
+    auto result = same_closest_hits(scene, bvh8, 2000) && same_closest_hits(scene, bvh16, 2000);
+    result = result && same_closest_hits(single, CompressedBVH8(single), 500);
+    result = result && bvh8.memory_usage() < bvh16.memory_usage() && bvh16.memory_usage() < LinearBVH(scene).memory_usage();
+
+    // Rays aimed at the far spheres
+    for (int i = 0; i < 500; ++i) {
+        auto origin = Vector3::random(-8, 8);
+        auto ray = Ray(origin, (Point3D(5000, 0, 0) + Vector3::random(-1, 1) - origin).unit_vector());
+
+        hit_record expected, record8, record16;
+        bool expected_hit = scene.hit(ray, 0.001, infinity, expected);
+
+        result = result && bvh8.hit(ray, 0.001, infinity, record8) == expected_hit && bvh16.hit(ray, 0.001, infinity, record16) == expected_hit;
+        result = result && (!expected_hit || (record8.t == expected.t && record16.t == expected.t));
+    }
+
+    print_result(result, __FUNCTION__);
+}
+
+void Tests::test_bvh_cache_round_trip() {
+    auto scene = random_spheres(2000);
+    auto cache = BVHCache("/tmp/raytracer_bvh_cache_test");
+
+    BVHBuildOptions options;
+    options.max_leaf_size = 8;
+
+    auto file_path = cache.path(BVHCache::key(scene.objects(), BVHBuildOptions()));
+    auto other_path = cache.path(BVHCache::key(scene.objects(), options));
+    std::remove(file_path.c_str());
+    std::remove(other_path.c_str());
+
+    // Built and stored, then mapped back
+    auto built = cache.load_or_build(scene.objects());
+    auto loaded = cache.load_or_build(scene.objects());
+
+    auto result = cache.build_count() == 1 && cache.load_count() == 1;
+    result = result && loaded->nodes().size() == built->nodes().size();
+    result = result && std::memcmp(&loaded->nodes()[0], &built->nodes()[0], built->nodes().size() * sizeof(LinearBVHNode)) == 0;
+    result = result && same_closest_hits(scene, *loaded, 2000);
+
+    // Mapped nodes are private, refits write to memory only
+    loaded->refit();
+    result = result && std::fabs(loaded->sah_ratio() - 1) < 1e-6 && same_closest_hits(scene, *loaded, 500);
+
+    // Other options make another file
+    cache.load_or_build(scene.objects(), options);
+    result = result && cache.build_count() == 2 && other_path != file_path;
+
+    // A corrupt file is rebuilt and overwritten
+    {
+        std::fstream file(file_path, std::ios::binary | std::ios::in | std::ios::out);
+        file.seekp(sizeof(BVHCacheHeader) + 100);
+        file.put('x');
+    }
+
+    auto rebuilt = cache.load_or_build(scene.objects());
+    result = result && cache.build_count() == 3 && same_closest_hits(scene, *rebuilt, 500);
+    cache.load_or_build(scene.objects());
+    result = result && cache.load_count() == 2;
+
+    // Mirrored triangles with the same bounds, which spatial splits clip differently
+    Objects triangle = { std::make_shared<Triangle>(Point3D(0, 0, 0), Point3D(1, 0, 1), Point3D(0, 1, 1), 0) };
+    Objects mirrored = { std::make_shared<Triangle>(Point3D(1, 1, 0), Point3D(0, 1, 1), Point3D(1, 0, 1), 0) };
+    options.split_method = BVHSplitMethod::SBVH;
+    result = result && BVHCache::key(triangle, options) != BVHCache::key(mirrored, options);
+
+    print_result(result, __FUNCTION__);
+}
+
+void Tests::test_kd_tree_matches_scene() {
+    auto scene = random_spheres(2000);
+    auto material = scene.add_material(std::make_shared<Lambertian>(Color(0.5, 0.5, 0.5)));
+
+    // Spheres on a grid share their edges along every axis
+    for (int x = -3; x <= 3; ++x) {
+        for (int y = -3; y <= 3; ++y)
+            scene.add_object(std::make_shared<Sphere>(Point3D(x, y, 0), 0.5, material));
+    }
+
+    auto kd_tree = KdTree(scene);
+    auto stats = kd_tree.stats();
+
+    auto result = same_closest_hits(scene, kd_tree, 3000);
+    result = result && stats.reference_count >= scene.objects().size() && stats.leaf_count == (stats.node_count + 1) / 2;
+
+    KdTreeBuildOptions options;
+    options.clip_primitives = false;
+    options.max_leaf_size = 4;
+    result = result && same_closest_hits(scene, KdTree(scene, options), 2000);
+
+    options.max_depth = 3;
+    auto shallow = KdTree(scene, options);
+    result = result && shallow.stats().max_depth <= 4 && same_closest_hits(scene, shallow, 500);
+
+    auto single = random_spheres(1);
+    result = result && same_closest_hits(single, KdTree(single), 500);
+
+    print_result(result, __FUNCTION__);
+}
+
+void Tests::test_grid_matches_scene() {
+    auto scene = random_spheres(2000);
+    auto material = scene.add_material(std::make_shared<Lambertian>(Color(0.5, 0.5, 0.5)));
+
+    // Dense cluster for the second level, and a ground sphere kept out of the cells
+    for (int i = 0; i < 300; ++i)
+        scene.add_object(std::make_shared<Sphere>(Point3D(random_double(-0.5, 0.5), random_double(-0.5, 0.5), random_double(-0.5, 0.5)), 0.02, material));
+
+    scene.add_object(std::make_shared<Sphere>(Point3D(0, -1000, 0), 990, material));
+
+    auto grid = Grid(scene);
+    auto stats = grid.stats();
+
+    auto result = same_closest_hits(scene, grid, 3000);
+    result = result && stats.large_primitive_count == 1 && stats.subgrid_count == 0 && stats.reference_count >= scene.objects().size() - 1;
+
+    GridBuildOptions options;
+    options.two_level = true;
+    options.thread_count = 1;
+    auto two_level = Grid(scene, options);
+    result = result && two_level.stats().subgrid_count > 0 && same_closest_hits(scene, two_level, 3000);
+
+    options.thread_count = 4;
+    auto parallel = Grid(scene, options);
+    result = result && parallel.stats().reference_count == two_level.stats().reference_count && parallel.memory_usage() == two_level.memory_usage();
+
+    auto single = random_spheres(1);
+    result = result && same_closest_hits(single, Grid(single), 500);
+
+    print_result(result, __FUNCTION__);
+}
+
+void Tests::test_occluded_matches_hit() {
+    auto scene = random_spheres(500);
+    auto bvh_node = BVHNode(scene, BVHBuildOptions());
+    auto linear_bvh = std::make_shared<LinearBVH>(scene);
+    auto instance = Instance(linear_bvh, Transform::translation(Vector3(1, 2, 3)) * Transform::scaling(2));
+
+    auto result = true;
+
+    for (int i = 0; i < 2000 && result; ++i) {
+        auto ray = Ray(Vector3::random(-8, 8), Vector3::random_in_unit_sphere().unit_vector());
+        // Short segments too, as shadow rays stop at the light
+        auto t_max = i % 2 ? infinity : random_double(0, 4);
+
+        hit_record record;
+        bool expected = scene.hit(ray, 0.001, t_max, record);
+
+        result = scene.occluded(ray, 0.001, t_max) == expected
+            && bvh_node.occluded(ray, 0.001, t_max) == expected
+            && linear_bvh->occluded(ray, 0.001, t_max) == expected
+            && instance.occluded(ray, 0.001, t_max) == instance.hit(ray, 0.001, t_max, record);
+    }
+
+    print_result(result, __FUNCTION__);
+}
+
+void Tests::test_deferred_surface_matches_eager() {
+    auto scene = random_spheres(500);
+    auto bvh_node = BVHNode(scene, BVHBuildOptions());
+    auto linear_bvh = LinearBVH(scene);
+
+    auto same_surface = [](const hit_record& a, const hit_record& b) {
+        return a.t == b.t && a.point == b.point && a.normal == b.normal && a.front_face == b.front_face && a.material == b.material;
+    };
+
+    auto result = true;
+
+    for (int i = 0; i < 2000 && result; ++i) {
+        auto ray = Ray(Vector3::random(-8, 8), Vector3::random_in_unit_sphere().unit_vector());
+
+        // Every candidate evaluated in full, the last closer one wins
+        hit_record expected, candidate;
+        bool expected_hit = false;
+        auto closest = infinity;
+
+        for (const auto& object : scene.objects()) {
+            if (object->hit(ray, 0.001, closest, candidate)) {
+                expected_hit = true;
+                closest = candidate.t;
+                expected = candidate;
+            }
+        }
+
+        for (const Hittable* tested : { static_cast<const Hittable*>(&scene), static_cast<const Hittable*>(&bvh_node), static_cast<const Hittable*>(&linear_bvh) }) {
+            hit_record record;
+            bool has_hit = tested->hit(ray, 0.001, infinity, record);
+            result = result && has_hit == expected_hit && (!has_hit || same_surface(record, expected));
+        }
+    }
+
+    print_result(result, __FUNCTION__);
+}
+
+void Tests::test_static_dispatch_matches_virtual() {
+    auto scene = random_spheres(2000);
+
+    // Not in the closed set, kept behind its pointer
+    auto blas = std::make_shared<LinearBVH>(random_spheres(50));
+    scene.add_object(std::make_shared<Instance>(blas, Transform::translation(Vector3(0, 7, 0))));
+
+    auto static_bvh = StaticBVH(scene);
+    auto linear_bvh = LinearBVH(scene);
+
+    auto result = static_bvh.virtual_primitive_count() == 1 && same_closest_hits(scene, static_bvh, 3000);
+
+    for (int i = 0; i < 2000 && result; ++i) {
+        auto ray = Ray(Vector3::random(-8, 8), Vector3::random_in_unit_sphere().unit_vector());
+        auto t_max = i % 2 ? infinity : random_double(0, 4);
+
+        hit_record record;
+        result = static_bvh.occluded(ray, 0.001, t_max) == linear_bvh.hit(ray, 0.001, t_max, record);
+    }
+
+    // Built-in materials scatter through the variant, others through their pointer
+    auto materials = MaterialTable();
+    materials.add(std::make_shared<Lambertian>(Color(0.5, 0.5, 0.5)));
+    materials.add(std::make_shared<Metal>(Color(0.7, 0.6, 0.5), 0.3));
+    materials.add(std::make_shared<Dielectric>(1.5));
+
+    for (int i = 0; i < 300 && result; ++i) {
+        auto ray = Ray(Vector3::random(-8, 8), Vector3::random_in_unit_sphere().unit_vector());
+        hit_record record;
+
+        if (!scene.hit(ray, 0.001, infinity, record))
+            continue;
+
+        for (MaterialId id = 0; id < materials.size(); ++id) {
+            Color expected_attenuation, attenuation;
+            Ray expected_scattered, scattered;
+
+            srand(i);
+            bool expected = materials[id].scatter(ray, record, expected_attenuation, expected_scattered);
+            srand(i);
+            bool scatters = materials.scatter(id, ray, record, attenuation, scattered);
+
+            result = result && scatters == expected && attenuation == expected_attenuation
+                && scattered.origin() == expected_scattered.origin() && scattered.direction() == expected_scattered.direction();
+        }
+    }
+
+    print_result(result, __FUNCTION__);
+}
+
+void Tests::test_triangles_match_scene() {
+    auto scene = random_triangles(2000, TriangleTest::MollerTrumbore);
+    auto material = scene.add_material(std::make_shared<Lambertian>(Color(0.5, 0.5, 0.5)));
+
+    // Axis-aligned, with flat bounding boxes
+    scene.add_object(std::make_shared<Triangle>(Point3D(-6, -6, 0), Point3D(6, -6, 0), Point3D(-6, 6, 0), material));
+    scene.add_object(std::make_shared<Triangle>(Point3D(2, -6, -6), Point3D(2, 6, -6), Point3D(2, -6, 6), material));
+
+    auto result = same_closest_hits(scene, BVHNode(scene, BVHBuildOptions()), 2000)
+        && same_closest_hits(scene, LinearBVH(scene), 2000)
+        && same_closest_hits(scene, StaticBVH(scene), 2000)
+        && same_closest_hits(scene, KdTree(scene), 2000)
+        && same_closest_hits(scene, Grid(scene), 2000);
+
+    BVHBuildOptions options;
+    options.split_method = BVHSplitMethod::SBVH;
+    result = result && same_closest_hits(scene, LinearBVH(scene, options), 2000);
+
+    // Both tests find the same hits away from the edges
+    result = result && same_closest_hits(random_triangles(2000, TriangleTest::MollerTrumbore), random_triangles(2000, TriangleTest::Watertight), 2000);
+
+    // Clipped bounds stay in the box and keep every point of the triangle inside it
+    auto triangle = Triangle(Point3D(0, 0, 0), Point3D(4, 1, 0.5), Point3D(1, 3, 2), material);
+    auto box = AABB(Point3D(0.5, 0.5, 0), Point3D(2, 2, 1));
+    AABB clipped;
+    result = result && triangle.clip_bounds(box, clipped);
+
+    for (int i = 0; i < 1000 && result; ++i) {
+        auto u = random_double();
+        auto v = random_double() * (1 - u);
+        auto p = triangle.vertex(0) + u * (triangle.vertex(1) - triangle.vertex(0)) + v * (triangle.vertex(2) - triangle.vertex(0));
+        bool in_box = true, in_clipped = true;
+
+        for (int a = 0; a < 3; ++a) {
+            in_box = in_box && box.min()[a] <= p[a] && p[a] <= box.max()[a];
+            in_clipped = in_clipped && clipped.min()[a] - 1e-9 <= p[a] && p[a] <= clipped.max()[a] + 1e-9;
+            result = result && box.min()[a] <= clipped.min()[a] && clipped.max()[a] <= box.max()[a];
+        }
+
+        result = result && (!in_box || in_clipped);
+    }
+
+    result = result && !triangle.clip_bounds(AABB(Point3D(3, 2.5, 0), Point3D(4, 3, 2)), clipped);
+
+    print_result(result, __FUNCTION__);
+}
+
+void Tests::test_watertight_triangle_edges() {
+    // A planar quad split along its diagonal, rays aimed right at the shared edge. Möller-Trumbore
+    // lets about 6% of them through.
+    auto a = Point3D(-1.3, -0.7, 0.2);
+    auto b = Point3D(1.1, -0.9, -0.1);
+    auto c = Point3D(0.9, 1.7, 0.3);
+    auto d = a + (c - b);
+
+    auto first = Triangle(a, b, c, 0, TriangleTest::Watertight);
+    // Starts at c: the kernel sees the shared edge in another vertex order
+    auto second = Triangle(c, d, a, 0, TriangleTest::Watertight);
+
+    auto result = true;
+
+    for (int i = 0; i < 100000 && result; ++i) {
+        auto target = a + random_double() * (c - a);
+        auto origin = Point3D(random_double(-3, 3), random_double(-3, 3), random_double(2, 5));
+        auto ray = Ray(origin, (target - origin).unit_vector());
+
+        result = first.occluded(ray, 0, infinity) || second.occluded(ray, 0, infinity);
+    }
+
+    print_result(result, __FUNCTION__);
+}
+
+void Tests::test_mesh_matches_triangles() {
+    // A bumpy height field on a grid, every vertex written once per attribute and shared by up to 6
+    // faces. Coordinates are exact in float, so the mesh and the reference see the same triangles.
+    const int side = 30;
+    const std::string path = "/tmp/raytracer_mesh_test.obj";
+
+    auto scene = random_spheres(0);
+    auto material = scene.add_material(std::make_shared<Lambertian>(Color(0.5, 0.5, 0.5)));
+    auto reference = random_spheres(0);
+    std::vector<Point3D> grid;
+
+    {
+        std::ofstream file(path);
+
+        for (int z = 0; z <= side; ++z) {
+            for (int x = 0; x <= side; ++x) {
+                grid.push_back(Point3D(x * 0.25 - 3.75, random_int(-8, 8) / 16.0, z * 0.25 - 3.75));
+                file << "v " << grid.back().x() << " " << grid.back().y() << " " << grid.back().z() << "\n";
+                file << "vt " << x / double(side) << " " << z / double(side) << "\n";
+            }
+        }
+
+        file << "vn 0 1 0\n";
+
+        for (int z = 0; z < side; ++z) {
+            for (int x = 0; x < side; ++x) {
+                int v = z * (side + 1) + x;
+                int quad[4] = { v, v + side + 1, v + side + 2, v + 1 };
+
+                for (const auto& face : { std::array<int, 3>{ quad[0], quad[1], quad[2] }, std::array<int, 3>{ quad[0], quad[2], quad[3] } }) {
+                    // 1-based
+                    file << "f";
+
+                    for (auto index : face)
+                        file << " " << index + 1 << "/" << index + 1 << "/1";
+
+                    file << "\n";
+                    reference.add_object(std::make_shared<Triangle>(grid[face[0]], grid[face[1]], grid[face[2]], material));
+                }
+            }
+        }
+    }
+
+    auto mesh = Mesh::load_obj(path, material);
+    std::remove(path.c_str());
+
+    auto result = mesh && mesh->triangle_count() == 2 * side * side && mesh->vertex_count() == (side + 1) * (side + 1);
+    result = result && same_closest_hits(reference, *mesh, 3000);
+
+    // Shading data interpolated from the shared buffers
+    for (int i = 0; i < 500 && result; ++i) {
+        auto ray = Ray(Point3D(random_double(-3, 3), 5, random_double(-3, 3)), Vector3(random_double(-0.2, 0.2), -1, random_double(-0.2, 0.2)).unit_vector());
+        hit_record record;
+
+        if (!mesh->hit(ray, 0.001, infinity, record))
+            continue;
+
+        result = record.normal.y() == 1 && record.material == material
+            && std::fabs(record.u - (record.point.x() + 3.75) / 7.5) < 1e-6 && std::fabs(record.v - (record.point.z() + 3.75) / 7.5) < 1e-6;
+    }
+
+    result = result && Mesh::load_obj("/tmp/raytracer_missing.obj", material) == nullptr;
+
+    print_result(result, __FUNCTION__);
+}
+
+void Tests::test_triangle_packets_match_triangles() {
+    srand(99);
+
+    // Overlapping triangles with float vertices, as a mesh stores them
+    auto reference = random_spheres(0);
+    auto material = reference.add_material(std::make_shared<Lambertian>(Color(0.5, 0.5, 0.5)));
+    std::vector<float> positions;
+    std::vector<uint32_t> indices;
+
+    for (int i = 0; i < 1500; ++i) {
+        auto a = Vector3::random(-5, 5);
+        Point3D vertices[3] = { a, a + Vector3::random(-1, 1), a + Vector3::random(-1, 1) };
+
+        for (auto& vertex : vertices) {
+            for (int k = 0; k < 3; ++k) {
+                vertex[k] = static_cast<float>(vertex[k]);
+                positions.push_back(static_cast<float>(vertex[k]));
+            }
+
+            indices.push_back(static_cast<uint32_t>(indices.size()));
+        }
+
+        reference.add_object(std::make_shared<Triangle>(vertices[0], vertices[1], vertices[2], material));
+    }
+
+    auto result = true;
+
+    for (int width : { 4, 8 }) {
+        for (std::size_t leaf_size : { std::size_t(1), std::size_t(4), std::size_t(8), std::size_t(16) }) {
+            BVHBuildOptions options;
+            options.max_leaf_size = leaf_size;
+            auto mesh = Mesh(positions, {}, {}, indices, material, TriangleTest::MollerTrumbore, options, width);
+
+            result = result && mesh.stats().packet_count >= static_cast<std::size_t>((1500 + width - 1) / width) && same_closest_hits(reference, mesh, 2000);
+
+            for (int i = 0; i < 500 && result; ++i) {
+                auto ray = Ray(Vector3::random(-8, 8), Vector3::random_in_unit_sphere());
+                result = mesh.occluded(ray, 0.001, 3) == reference.occluded(ray, 0.001, 3);
+            }
+        }
+    }
+
+    // A single packet: the nearest lane is the closest of its triangles
+    Triangle8 packet;
+    Triangle triangles[5];
+
+    for (int lane = 0; lane < 5; ++lane) {
+        auto a = Vector3::random(-1, 1) + Vector3(0, 0, lane - 2);
+        triangles[lane] = Triangle(a, a + Vector3::random(-2, 2), a + Vector3::random(-2, 2), material);
+        packet.set(lane, triangles[lane].vertex(0), triangles[lane].vertex(1), triangles[lane].vertex(2), lane);
+    }
+
+    for (int i = 0; i < 2000 && result; ++i) {
+        auto ray = Ray(Vector3::random(-3, 3) + Vector3(0, 0, -8), Vector3(random_double(-0.3, 0.3), random_double(-0.3, 0.3), 1));
+        int expected_lane = -1;
+        double expected_t = infinity;
+
+        for (int lane = 0; lane < 5; ++lane) {
+            hit_record record;
+
+            if (triangles[lane].intersect(ray, 0.001, expected_t, record)) {
+                expected_lane = lane;
+                expected_t = record.t;
+            }
+        }
+
+        double t, u, v;
+        int lane = packet.nearest(ray, 0.001, infinity, t, u, v);
+        result = lane == expected_lane && (lane < 0 || std::fabs(t - expected_t) < 1e-9);
+    }
+
+    print_result(result, __FUNCTION__);
+}
+
+void Tests::test_sphere_groups_match_spheres() {
+    srand(2024);
+
+    // A material per sphere, so that the surface comes from the right lane
+    auto reference = random_spheres(0);
+
+    for (int i = 0; i < 400; ++i)
+        reference.add_object(std::make_shared<Sphere>(Vector3::random(-5, 5), random_double(0.05, 0.6), static_cast<MaterialId>(i)));
+
+    // Coincident spheres end up in leaves the builder cannot split
+    for (int i = 0; i < 11; ++i)
+        reference.add_object(std::make_shared<Sphere>(Point3D(0, 0, 0), 0.1 * (i + 1), static_cast<MaterialId>(400 + i)));
+
+    auto result = true;
+
+    for (int width : { 4, 8 }) {
+        auto grouped = width == 4 ? group_spheres<4>(reference.objects()) : group_spheres<8>(reference.objects());
+        auto bvh = LinearBVH(grouped);
+
+        result = result && grouped.size() >= static_cast<std::size_t>(411 / width) && grouped.size() < 411 && same_closest_hits(reference, bvh, 3000);
+
+        for (int i = 0; i < 2000 && result; ++i) {
+            auto ray = Ray(Vector3::random(-8, 8), Vector3::random_in_unit_sphere());
+            hit_record expected, record;
+
+            if (reference.hit(ray, 0.001, infinity, expected) && bvh.hit(ray, 0.001, infinity, record))
+                result = record.material == expected.material && (record.normal - expected.normal).length() < 1e-9 && record.front_face == expected.front_face;
+
+            result = result && bvh.occluded(ray, 0.001, 2) == reference.occluded(ray, 0.001, 2);
+        }
+    }
+
+    // A subclass may override hit(), it is kept as it is
+    struct SubclassedSphere: public Sphere {
+        using Sphere::Sphere;
+    };
+
+    auto subclassed = std::make_shared<SubclassedSphere>(Point3D(0, 0, 0), 1, 0);
+    auto grouped = group_spheres<4>({ subclassed });
+    result = result && grouped.size() == 1 && grouped[0] == subclassed;
+
+    print_result(result, __FUNCTION__);
+}
+
+void Tests::test_particle_cloud_matches_spheres() {
+    srand(25);
+
+    auto reference = random_spheres(0);
+    std::vector<Particle> particles;
+    std::vector<MaterialId> materials;
+
+    for (int i = 0; i < 3000; ++i) {
+        auto center = Vector3::random(-5, 5);
+        particles.push_back(Particle { { float(center.x()), float(center.y()), float(center.z()) }, float(random_double(0.02, 0.3)) });
+        materials.push_back(static_cast<MaterialId>(i));
+    }
+
+    // Particles are single precision, the reference spheres get the same rounded values. Read back
+    // from the stored particles: GCC 12 at -O2 vectorizes a sphere built next to the conversion
+    // from the unrounded doubles.
+    for (std::size_t i = 0; i < particles.size(); ++i) {
+        const auto& particle = particles[i];
+        reference.add_object(std::make_shared<Sphere>(Point3D(particle.position[0], particle.position[1], particle.position[2]), particle.radius, materials[i]));
+    }
+
+    auto cloud = ParticleCloud(particles, materials);
+    auto result = cloud.size() == particles.size() && same_closest_hits(reference, cloud, 3000);
+
+    for (int i = 0; i < 2000 && result; ++i) {
+        auto ray = Ray(Vector3::random(-8, 8), Vector3::random_in_unit_sphere());
+        hit_record expected, record;
+
+        if (reference.hit(ray, 0.001, infinity, expected) && cloud.hit(ray, 0.001, infinity, record))
+            result = record.material == expected.material && (record.normal - expected.normal).length() < 1e-9;
+
+        result = result && cloud.occluded(ray, 0.001, 2) == reference.occluded(ray, 0.001, 2);
+    }
+
+    // A raw dump loads to the same cloud, with one material
+    const std::string path = "/tmp/raytracer_particles_test.raw";
+
+    {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char*>(particles.data()), particles.size() * sizeof(Particle));
+    }
+
+    auto loaded = ParticleCloud::load_raw(path, 7);
+    std::remove(path.c_str());
+
+    result = result && loaded && loaded->size() == particles.size() && same_closest_hits(cloud, *loaded, 1000);
+
+    for (int i = 0; i < 200 && result; ++i) {
+        hit_record record;
+
+        if (loaded->hit(Ray(Vector3::random(-8, 8), Vector3::random_in_unit_sphere()), 0.001, infinity, record))
+            result = record.material == 7;
+    }
+
+    print_result(result, __FUNCTION__);
+}
+
+void Tests::check_bvh() {
+    print_info("Checking BVH...");
+
+    test_bvh_median_matches_scene();
+    test_bvh_sah_matches_scene();
+    test_bvh_sah_leaf_size();
+    test_bvh_parallel_build_deterministic();
+    test_linear_bvh_matches_scene();
+    test_linear_bvh_siblings_adjacent();
+    test_linear_bvh_leaf_size_limit();
+    test_wide_bvh_matches_scene();
+    test_wide_bvh_grazing_rays();
+    test_radix_sort_morton_codes();
+    test_lbvh_matches_scene();
+    test_lbvh_treelets_lower_sah_cost();
+    test_sbvh_matches_scene();
+    test_instances_match_transformed_spheres();
+    test_linear_bvh_refit();
+    test_dynamic_bvh_insert_remove();
+    test_lazy_bvh_concurrent_first_touch();
+    test_linear_bvh_layouts_match();
+    test_compressed_bvh_matches_scene();
+    test_bvh_cache_round_trip();
+    test_kd_tree_matches_scene();
+    test_grid_matches_scene();
+    test_occluded_matches_hit();
+    test_deferred_surface_matches_eager();
+    test_static_dispatch_matches_virtual();
+    test_triangles_match_scene();
+    test_watertight_triangle_edges();
+    test_mesh_matches_triangles();
+    test_triangle_packets_match_triangles();
+    test_sphere_groups_match_spheres();
+    test_particle_cloud_matches_spheres();
+}
+
 void Tests::check_vector3() {
     print_info("Checking Vector3...");
 
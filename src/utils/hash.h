@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+// 64-bit FNV-1a over 64-bit words, to key and check cached data. Not cryptographic.
+class Hasher {
+    public:
+        inline void add(const void* data, std::size_t size);
+
+        template <typename T>
+        inline void add(const T& value) {
+            static_assert(std::is_trivially_copyable<T>::value, "Hasher only adds trivially copyable values");
+            add(&value, sizeof(T));
+        }
+
+        uint64_t value() const { return _hash; }
+
+    private:
+        static constexpr uint64_t prime = 1099511628211ull;
+
+        uint64_t _hash = 14695981039346656037ull;
+};
+
+inline void Hasher::add(const void* data, std::size_t size) {
+    auto bytes = static_cast<const unsigned char*>(data);
+    std::size_t i = 0;
+
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t word;
+        std::memcpy(&word, bytes + i, sizeof(word));
+        _hash = (_hash ^ word) * prime;
+    }
+
+    for (; i < size; ++i)
+        _hash = (_hash ^ bytes[i]) * prime;
+}
@@ -1 +1,12 @@
+#pragma once
+
 #define DEBUG 0
+
+// Keeps the compiler from fusing a * b - c * d into a fused multiply-add, which rounds the two
+// products differently, whatever -ffp-contract the file is built with (clang takes
+// `#pragma clang fp contract(off)` in the function body instead)
+#if defined(__GNUC__) && !defined(__clang__)
+#define NO_FP_CONTRACT __attribute__((optimize("fp-contract=off")))
+#else
+#define NO_FP_CONTRACT
+#endif
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Private mapping of a whole file: pages are read on first access, writes stay in memory
+class MappedFile {
+    public:
+        MappedFile(const std::string& path);
+        ~MappedFile();
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        bool is_open() const { return _data != nullptr; }
+        char* data() const { return _data; }
+        std::size_t size() const { return _size; }
+
+    private:
+        char* _data = nullptr;
+        std::size_t _size = 0;
+};
+
+MappedFile::MappedFile(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+
+    if (fd < 0)
+        return;
+
+    struct stat info;
+
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+        auto data = mmap(nullptr, info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+
+        if (data != MAP_FAILED) {
+            _data = static_cast<char*>(data);
+            _size = static_cast<std::size_t>(info.st_size);
+        }
+    }
+
+    // The mapping keeps the file alive
+    close(fd);
+}
+
+MappedFile::~MappedFile() {
+    if (_data)
+        munmap(_data, _size);
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "utils/thread_pool.h"
+
+struct MortonPrimitive {
+    uint64_t code;
+    uint32_t index;
+};
+
+// Inserts two zeros after each of the 10 low bits of v
+inline uint32_t expand_bits_10(uint32_t v) {
+    v &= 0x3FF;
+    v = (v | (v << 16)) & 0x030000FF;
+    v = (v | (v << 8)) & 0x0300F00F;
+    v = (v | (v << 4)) & 0x030C30C3;
+    v = (v | (v << 2)) & 0x09249249;
+
+    return v;
+}
+
+// Inserts two zeros after each of the 21 low bits of v
+inline uint64_t expand_bits_21(uint64_t v) {
+    v &= 0x1FFFFF;
+    v = (v | (v << 32)) & 0x001F00000000FFFFull;
+    v = (v | (v << 16)) & 0x001F0000FF0000FFull;
+    v = (v | (v << 8)) & 0x100F00F00F00F00Full;
+    v = (v | (v << 4)) & 0x10C30C30C30C30C3ull;
+    v = (v | (v << 2)) & 0x1249249249249249ull;
+
+    return v;
+}
+
+// Interleaves coordinates in [0, 1] into a 30 or 63-bit code, x taking the highest bit of each triplet
+inline uint64_t morton_code(double x, double y, double z, int bits) {
+    auto quantize = [](double value, double scale) {
+        return static_cast<uint64_t>(std::min(std::max(value * scale, 0.0), scale - 1));
+    };
+
+    if (bits <= 30) {
+        auto scale = 1024.0;
+        return (expand_bits_10(quantize(x, scale)) << 2) | (expand_bits_10(quantize(y, scale)) << 1) | expand_bits_10(quantize(z, scale));
+    }
+
+    auto scale = 2097152.0;
+    return (expand_bits_21(quantize(x, scale)) << 2) | (expand_bits_21(quantize(y, scale)) << 1) | expand_bits_21(quantize(z, scale));
+}
+
+// Stable LSD radix sort on the low `bits` bits of the codes, 8 bits per pass.
+// Chunks count and scatter in parallel; the result does not depend on the number of threads.
+inline void radix_sort(std::vector<MortonPrimitive>& items, int bits, ThreadPool* pool) {
+    const std::size_t grain = 1 << 14;
+    const int radix = 256;
+
+    auto size = items.size();
+    auto chunks = std::max<std::size_t>(1, (size + grain - 1) / grain);
+
+    std::vector<MortonPrimitive> buffer(size);
+    std::vector<std::size_t> offsets(chunks * radix);
+
+    auto for_chunks = [&](auto fn) {
+        if (pool)
+            pool->parallel_for(0, size, grain, fn);
+        else
+            fn(0, size);
+    };
+
+    for (int shift = 0; shift < bits; shift += 8) {
+        std::fill(offsets.begin(), offsets.end(), 0);
+
+        for_chunks([&](std::size_t begin, std::size_t end) {
+            auto* histogram = &offsets[(begin / grain) * radix];
+
+            for (auto i = begin; i < end; ++i)
+                histogram[(items[i].code >> shift) & 0xFF]++;
+        });
+
+        // Exclusive scan in digit-major order keeps the sort stable across chunks
+        std::size_t sum = 0;
+
+        for (int digit = 0; digit < radix; ++digit) {
+            for (std::size_t chunk = 0; chunk < chunks; ++chunk) {
+                auto count = offsets[chunk * radix + digit];
+                offsets[chunk * radix + digit] = sum;
+                sum += count;
+            }
+        }
+
+        for_chunks([&](std::size_t begin, std::size_t end) {
+            auto* offset = &offsets[(begin / grain) * radix];
+
+            for (auto i = begin; i < end; ++i)
+                buffer[offset[(items[i].code >> shift) & 0xFF]++] = items[i];
+        });
+
+        items.swap(buffer);
+    }
+}
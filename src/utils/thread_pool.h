@@ -0,0 +1,119 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+class ThreadPool
+{
+    public:
+        // 0 threads means one per hardware thread
+        explicit ThreadPool(std::size_t thread_count = 0);
+        ~ThreadPool();
+
+        // Not copyable
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        std::size_t size() const { return _workers.size(); }
+
+        std::future<void> submit(std::function<void()> task);
+
+        // Calls fn(chunk_begin, chunk_end) on chunks of at most `grain` items and waits for all of them.
+        // Chunk boundaries only depend on the range and the grain, not on the number of threads.
+        template <typename F>
+        void parallel_for(std::size_t begin, std::size_t end, std::size_t grain, F fn);
+
+        inline static std::size_t hardware_threads() {
+            return std::max<std::size_t>(1, std::thread::hardware_concurrency());
+        }
+
+    private:
+        void worker();
+
+        std::vector<std::thread> _workers;
+        std::queue<std::packaged_task<void()>> _tasks;
+        std::mutex _mutex;
+        std::condition_variable _condition;
+        bool _stopping = false;
+};
+
+ThreadPool::ThreadPool(std::size_t thread_count) {
+    if (thread_count == 0)
+        thread_count = hardware_threads();
+
+    for (std::size_t i = 0; i < thread_count; ++i)
+        _workers.emplace_back([this]() { worker(); });
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        auto lock = std::lock_guard<std::mutex>(_mutex);
+        _stopping = true;
+    }
+
+    _condition.notify_all();
+
+    for (auto& worker : _workers)
+        worker.join();
+}
+
+std::future<void> ThreadPool::submit(std::function<void()> task) {
+    auto packaged = std::packaged_task<void()>(std::move(task));
+    auto future = packaged.get_future();
+
+    {
+        auto lock = std::lock_guard<std::mutex>(_mutex);
+        _tasks.push(std::move(packaged));
+    }
+
+    _condition.notify_one();
+
+    return future;
+}
+
+template <typename F>
+void ThreadPool::parallel_for(std::size_t begin, std::size_t end, std::size_t grain, F fn) {
+    grain = std::max<std::size_t>(grain, 1);
+
+    // Nothing to gain from a round-trip through the queue
+    if (_workers.size() <= 1 || end - begin <= grain) {
+        for (auto chunk = begin; chunk < end; chunk += grain)
+            fn(chunk, std::min(end, chunk + grain));
+        return;
+    }
+
+    std::vector<std::future<void>> futures;
+
+    for (auto chunk = begin; chunk < end; chunk += grain) {
+        auto chunk_end = std::min(end, chunk + grain);
+        futures.push_back(submit([&fn, chunk, chunk_end]() { fn(chunk, chunk_end); }));
+    }
+
+    for (auto& future : futures)
+        future.get();
+}
+
+void ThreadPool::worker() {
+    while (true) {
+        std::packaged_task<void()> task;
+
+        {
+            auto lock = std::unique_lock<std::mutex>(_mutex);
+            _condition.wait(lock, [this]() { return _stopping || !_tasks.empty(); });
+
+            if (_stopping && _tasks.empty())
+                return;
+
+            task = std::move(_tasks.front());
+            _tasks.pop();
+        }
+
+        task();
+    }
+}
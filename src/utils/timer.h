@@ -0,0 +1,23 @@
+#pragma once
+
+#include <chrono>
+
+class Timer
+{
+    public:
+        Timer() : _start(std::chrono::steady_clock::now()) {}
+
+        inline void reset() {
+            _start = std::chrono::steady_clock::now();
+        }
+
+        // Elapsed time in seconds since construction or the last reset
+        inline double elapsed() const {
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - _start;
+
+            return elapsed.count();
+        }
+
+    private:
+        std::chrono::steady_clock::time_point _start;
+};
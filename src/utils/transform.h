@@ -0,0 +1,140 @@
+#pragma once
+
+#include <cmath>
+
+#include "utils/vector3.h"
+#include "utils/utils.h"
+
+// Affine transform stored as the first three rows of a 4x4 matrix, the last row is always (0, 0, 0, 1)
+class Transform {
+    public:
+        Transform(): _m{ { 1, 0, 0, 0 }, { 0, 1, 0, 0 }, { 0, 0, 1, 0 } } {}
+
+        inline double operator()(int row, int column) const { return _m[row][column]; }
+
+        inline Point3D point(const Point3D& p) const;
+        inline Vector3 vector(const Vector3& v) const;
+        // Normals go through the inverse transpose, call it on the inverse transform
+        inline Vector3 normal(const Vector3& n) const;
+
+        inline Transform inverse() const;
+
+        // Applies `rhs` first, then `*this`
+        inline Transform operator*(const Transform& rhs) const;
+
+        inline static Transform translation(const Vector3& offset);
+        inline static Transform scaling(const Vector3& factors);
+        inline static Transform scaling(double factor) { return scaling(Vector3(factor, factor, factor)); }
+        // Rotation of `degrees` around `axis`, counterclockwise when looking down the axis
+        inline static Transform rotation(const Vector3& axis, double degrees);
+
+    private:
+        double _m[3][4];
+};
+
+inline Point3D Transform::point(const Point3D& p) const {
+    return Point3D(
+        _m[0][0] * p.x() + _m[0][1] * p.y() + _m[0][2] * p.z() + _m[0][3],
+        _m[1][0] * p.x() + _m[1][1] * p.y() + _m[1][2] * p.z() + _m[1][3],
+        _m[2][0] * p.x() + _m[2][1] * p.y() + _m[2][2] * p.z() + _m[2][3]
+    );
+}
+
+inline Vector3 Transform::vector(const Vector3& v) const {
+    return Vector3(
+        _m[0][0] * v.x() + _m[0][1] * v.y() + _m[0][2] * v.z(),
+        _m[1][0] * v.x() + _m[1][1] * v.y() + _m[1][2] * v.z(),
+        _m[2][0] * v.x() + _m[2][1] * v.y() + _m[2][2] * v.z()
+    );
+}
+
+inline Vector3 Transform::normal(const Vector3& n) const {
+    return Vector3(
+        _m[0][0] * n.x() + _m[1][0] * n.y() + _m[2][0] * n.z(),
+        _m[0][1] * n.x() + _m[1][1] * n.y() + _m[2][1] * n.z(),
+        _m[0][2] * n.x() + _m[1][2] * n.y() + _m[2][2] * n.z()
+    );
+}
+
+inline Transform Transform::inverse() const {
+    // Inverse of the linear part from its cofactors, then the translation is moved through it
+    auto c00 = _m[1][1] * _m[2][2] - _m[1][2] * _m[2][1];
+    auto c01 = _m[1][2] * _m[2][0] - _m[1][0] * _m[2][2];
+    auto c02 = _m[1][0] * _m[2][1] - _m[1][1] * _m[2][0];
+
+    auto inv_det = 1.0 / (_m[0][0] * c00 + _m[0][1] * c01 + _m[0][2] * c02);
+
+    Transform result;
+
+    result._m[0][0] = c00 * inv_det;
+    result._m[0][1] = (_m[0][2] * _m[2][1] - _m[0][1] * _m[2][2]) * inv_det;
+    result._m[0][2] = (_m[0][1] * _m[1][2] - _m[0][2] * _m[1][1]) * inv_det;
+    result._m[1][0] = c01 * inv_det;
+    result._m[1][1] = (_m[0][0] * _m[2][2] - _m[0][2] * _m[2][0]) * inv_det;
+    result._m[1][2] = (_m[0][2] * _m[1][0] - _m[0][0] * _m[1][2]) * inv_det;
+    result._m[2][0] = c02 * inv_det;
+    result._m[2][1] = (_m[0][1] * _m[2][0] - _m[0][0] * _m[2][1]) * inv_det;
+    result._m[2][2] = (_m[0][0] * _m[1][1] - _m[0][1] * _m[1][0]) * inv_det;
+
+    auto translation = -result.vector(Vector3(_m[0][3], _m[1][3], _m[2][3]));
+
+    for (int i = 0; i < 3; ++i)
+        result._m[i][3] = translation[i];
+
+    return result;
+}
+
+inline Transform Transform::operator*(const Transform& rhs) const {
+    Transform result;
+
+    for (int i = 0; i < 3; ++i) {
+        for (int j = 0; j < 4; ++j) {
+            result._m[i][j] = _m[i][0] * rhs._m[0][j] + _m[i][1] * rhs._m[1][j] + _m[i][2] * rhs._m[2][j];
+        }
+
+        result._m[i][3] += _m[i][3];
+    }
+
+    return result;
+}
+
+inline Transform Transform::translation(const Vector3& offset) {
+    Transform result;
+
+    for (int i = 0; i < 3; ++i)
+        result._m[i][3] = offset[i];
+
+    return result;
+}
+
+inline Transform Transform::scaling(const Vector3& factors) {
+    Transform result;
+
+    for (int i = 0; i < 3; ++i)
+        result._m[i][i] = factors[i];
+
+    return result;
+}
+
+inline Transform Transform::rotation(const Vector3& axis, double degrees) {
+    // Rodrigues' rotation formula
+    auto a = axis.unit_vector();
+    auto theta = degrees_to_radians(degrees);
+    auto c = std::cos(theta);
+    auto s = std::sin(theta);
+    auto t = 1 - c;
+
+    Transform result;
+
+    result._m[0][0] = t * a.x() * a.x() + c;
+    result._m[0][1] = t * a.x() * a.y() - s * a.z();
+    result._m[0][2] = t * a.x() * a.z() + s * a.y();
+    result._m[1][0] = t * a.x() * a.y() + s * a.z();
+    result._m[1][1] = t * a.y() * a.y() + c;
+    result._m[1][2] = t * a.y() * a.z() - s * a.x();
+    result._m[2][0] = t * a.x() * a.z() - s * a.y();
+    result._m[2][1] = t * a.y() * a.z() + s * a.x();
+    result._m[2][2] = t * a.z() * a.z() + c;
+
+    return result;
+}
@@ -26,7 +26,7 @@ class Vector3
         inline double operator[](std::size_t i) const { return _data[i]; }
     	inline double& operator[](std::size_t i) { return _data[i]; };
 
-        inline bool operator==(const Vector3 &v) {
+        inline bool operator==(const Vector3 &v) const {
             return (x() == v.x() && y() == v.y() && z() == v.z());
         }
 